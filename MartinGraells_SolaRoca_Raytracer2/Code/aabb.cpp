@@ -0,0 +1,167 @@
+#include "aabb.h"
+
+#include "ray.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    double const inf = numeric_limits<double>::infinity();
+}
+
+AABB::AABB()
+:
+    lower(inf, inf, inf),
+    upper(-inf, -inf, -inf)
+{}
+
+AABB::AABB(Point const &lower, Point const &upper)
+:
+    lower(lower),
+    upper(upper)
+{}
+
+AABB AABB::infinite()
+{
+    return AABB(Point(-inf, -inf, -inf), Point(inf, inf, inf));
+}
+
+bool AABB::empty() const
+{
+    return lower.x > upper.x || lower.y > upper.y || lower.z > upper.z;
+}
+
+bool AABB::finite() const
+{
+    for (unsigned axis = 0; axis != 3; ++axis)
+        if (!isfinite(lower.data[axis]) || !isfinite(upper.data[axis]))
+            return false;
+    return true;
+}
+
+void AABB::extend(Point const &point)
+{
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        lower.data[axis] = min(lower.data[axis], point.data[axis]);
+        upper.data[axis] = max(upper.data[axis], point.data[axis]);
+    }
+}
+
+void AABB::extend(AABB const &box)
+{
+    if (box.empty())
+        return;
+    extend(box.lower);
+    extend(box.upper);
+}
+
+Point AABB::corner(unsigned idx) const
+{
+    return Point(idx & 1 ? upper.x : lower.x,
+                 idx & 2 ? upper.y : lower.y,
+                 idx & 4 ? upper.z : lower.z);
+}
+
+Point AABB::center() const
+{
+    return (lower + upper) / 2;
+}
+
+AABB AABB::expanded(Vector const &margin) const
+{
+    return AABB(lower - margin, upper + margin);
+}
+
+bool AABB::overlaps(AABB const &box) const
+{
+    for (unsigned axis = 0; axis != 3; ++axis)
+        if (box.upper.data[axis] < lower.data[axis]
+            || box.lower.data[axis] > upper.data[axis])
+            return false;
+    return !empty() && !box.empty();
+}
+
+bool AABB::overlapsSegment(Point const &from, Point const &to) const
+{
+    if (empty())
+        return false;
+
+    // slab test, clipping the segment parameter range [0, 1]
+    double tmin = 0.0;
+    double tmax = 1.0;
+    Vector dir = to - from;
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        if (dir.data[axis] == 0.0)
+        {
+            if (from.data[axis] < lower.data[axis]
+                || from.data[axis] > upper.data[axis])
+                return false;
+            continue;
+        }
+        double t1 = (lower.data[axis] - from.data[axis]) / dir.data[axis];
+        double t2 = (upper.data[axis] - from.data[axis]) / dir.data[axis];
+        tmin = max(tmin, min(t1, t2));
+        tmax = min(tmax, max(t1, t2));
+        if (tmin > tmax)
+            return false;
+    }
+    return true;
+}
+
+double AABB::entry(Ray const &ray) const
+{
+    if (empty())
+        return inf;
+
+    double tmin = 0.0;
+    double tmax = inf;
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        if (ray.D.data[axis] == 0.0)
+        {
+            if (ray.O.data[axis] < lower.data[axis]
+                || ray.O.data[axis] > upper.data[axis])
+                return inf;
+            continue;
+        }
+        double t1 = (lower.data[axis] - ray.O.data[axis]) / ray.D.data[axis];
+        double t2 = (upper.data[axis] - ray.O.data[axis]) / ray.D.data[axis];
+        tmin = max(tmin, min(t1, t2));
+        tmax = min(tmax, max(t1, t2));
+        if (tmin > tmax)
+            return inf;
+    }
+    return tmin;
+}
+
+bool AABB::intersects(Ray const &ray) const
+{
+    if (empty())
+        return false;
+
+    double tmin = 0.0;
+    double tmax = inf;
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        if (ray.D.data[axis] == 0.0)
+        {
+            if (ray.O.data[axis] < lower.data[axis]
+                || ray.O.data[axis] > upper.data[axis])
+                return false;
+            continue;
+        }
+        double t1 = (lower.data[axis] - ray.O.data[axis]) / ray.D.data[axis];
+        double t2 = (upper.data[axis] - ray.O.data[axis]) / ray.D.data[axis];
+        tmin = max(tmin, min(t1, t2));
+        tmax = min(tmax, max(t1, t2));
+        if (tmin > tmax)
+            return false;
+    }
+    return true;
+}
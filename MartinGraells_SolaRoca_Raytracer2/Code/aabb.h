@@ -0,0 +1,44 @@
+#ifndef AABB_H_
+#define AABB_H_
+
+#include "triple.h"
+
+class Ray;
+
+// Axis aligned bounding box. A default constructed box is empty and
+// grows with extend(); unbounded shapes (planes) use AABB::infinite().
+class AABB
+{
+    public:
+        Point lower;
+        Point upper;
+
+        AABB();                         // empty
+        AABB(Point const &lower, Point const &upper);
+        static AABB infinite();
+
+        bool empty() const;
+        bool finite() const;
+
+        void extend(Point const &point);
+        void extend(AABB const &box);
+
+        Point corner(unsigned idx) const;   // idx in [0, 8)
+        Point center() const;
+
+        // box grown by margin on every side
+        AABB expanded(Vector const &margin) const;
+
+        bool overlaps(AABB const &box) const;
+
+        // does the line segment from - to touch the box?
+        bool overlapsSegment(Point const &from, Point const &to) const;
+
+        // does the ray (t >= 0) touch the box?
+        bool intersects(Ray const &ray) const;
+        // t where the ray (t >= 0) enters the box, 0 if it starts inside,
+        // infinity if it misses
+        double entry(Ray const &ray) const;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "animation.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+using json = nlohmann::json;
+
+Animation::Animation(json const &node, unsigned numObjects)
+{
+    if (!node.is_object())
+        throw runtime_error("Animation must be an object.");
+
+    auto frames = node.find("Frames");
+    if (frames == node.end() || !frames->is_array() || frames->size() != 2
+        || (*frames)[0] < 0 || (*frames)[1] < (*frames)[0])
+        throw runtime_error("Animation needs \"Frames\": [first, last].");
+    d_first = (*frames)[0];
+    d_last = (*frames)[1];
+
+    if (node.find("Eye") != node.end())
+        d_eye = parseTrack(node["Eye"], "position");
+
+    if (node.find("Objects") != node.end())
+    {
+        json const &objects = node["Objects"];
+        if (!objects.is_object())
+            throw runtime_error("Animation \"Objects\" must map object "
+                                "indices to keyframes.");
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+        {
+            unsigned idx = stoul(it.key());
+            if (idx >= numObjects)
+                throw runtime_error("Animation of object " + it.key()
+                                    + ", which does not exist.");
+            d_objects[idx] = parseTrack(it.value(), "translate");
+        }
+    }
+}
+
+unsigned Animation::first() const
+{
+    return d_first;
+}
+
+unsigned Animation::last() const
+{
+    return d_last;
+}
+
+bool Animation::movesEye() const
+{
+    return !d_eye.empty();
+}
+
+Point Animation::eye(double frame) const
+{
+    return interpolate(d_eye, frame);
+}
+
+vector<unsigned> Animation::objects() const
+{
+    vector<unsigned> indices;
+    for (auto const &track : d_objects)
+        indices.push_back(track.first);
+    return indices;
+}
+
+Vector Animation::offset(unsigned object, double frame) const
+{
+    auto track = d_objects.find(object);
+    return track == d_objects.end() ? Vector() : interpolate(track->second, frame);
+}
+
+Animation::Track Animation::parseTrack(json const &node, char const *key)
+{
+    if (!node.is_array() || node.empty())
+        throw runtime_error("Keyframes must be a non-empty array.");
+
+    Track track;
+    for (json const &keyframe : node)
+    {
+        if (keyframe.find("frame") == keyframe.end()
+            || keyframe.find(key) == keyframe.end())
+            throw runtime_error(string("A keyframe needs \"frame\" and \"")
+                                + key + "\".");
+        track.push_back(Keyframe{keyframe["frame"], Triple(keyframe[key])});
+    }
+    stable_sort(track.begin(), track.end(), [](Keyframe const &a, Keyframe const &b)
+    {
+        return a.frame < b.frame;
+    });
+    return track;
+}
+
+Triple Animation::interpolate(Track const &track, double frame)
+{
+    if (frame <= track.front().frame)
+        return track.front().value;
+    if (frame >= track.back().frame)
+        return track.back().value;
+
+    auto next = upper_bound(track.begin(), track.end(), frame,
+                            [](double frame, Keyframe const &keyframe)
+    {
+        return frame < keyframe.frame;
+    });
+    auto prev = next - 1;
+    double f = (frame - prev->frame) / (next->frame - prev->frame);
+    return (1 - f) * prev->value + f * next->value;
+}
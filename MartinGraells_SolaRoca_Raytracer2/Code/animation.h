@@ -0,0 +1,61 @@
+#ifndef ANIMATION_H_
+#define ANIMATION_H_
+
+#include "triple.h"
+
+#include "json/json_fwd.h"
+
+#include <map>
+#include <vector>
+
+// Keyframed camera and object motion of a scene, from its "Animation"
+// node:
+//
+//   "Animation": {
+//       "Frames": [0, 47],
+//       "Eye": [{"frame": 0, "position": [200, 200, 1000]},
+//               {"frame": 47, "position": [400, 200, 900]}],
+//       "Objects": {"2": [{"frame": 0, "translate": [0, 0, 0]},
+//                         {"frame": 47, "translate": [0, 150, 0]}]}
+//   }
+//
+// Values are interpolated linearly between keyframes and held before the
+// first and after the last one. Objects are given by their index in the
+// "Objects" array.
+class Animation
+{
+    struct Keyframe
+    {
+        double frame;
+        Triple value;
+    };
+    typedef std::vector<Keyframe> Track;    // sorted by frame
+
+    unsigned d_first = 0;
+    unsigned d_last = 0;
+    Track d_eye;
+    std::map<unsigned, Track> d_objects;
+
+    public:
+        Animation() = default;      // a single frame, nothing moves
+
+        // throws a runtime_error for malformed nodes or object indices of
+        // numObjects and up
+        Animation(nlohmann::json const &node, unsigned numObjects);
+
+        unsigned first() const;
+        unsigned last() const;
+
+        bool movesEye() const;
+        Point eye(double frame) const;
+
+        // indices of the objects that move
+        std::vector<unsigned> objects() const;
+        Vector offset(unsigned object, double frame) const;
+
+    private:
+        static Track parseTrack(nlohmann::json const &node, char const *key);
+        static Triple interpolate(Track const &track, double frame);
+};
+
+#endif
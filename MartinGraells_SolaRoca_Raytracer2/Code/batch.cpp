@@ -0,0 +1,155 @@
+#include "batch.h"
+
+#include "boundedqueue.h"
+#include "image.h"
+#include "raytracer.h"
+#include "resourcecache.h"
+#include "tracelog.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+    // one scene on its way through the pipeline
+    struct Job
+    {
+        size_t index = 0;
+        string ifname;
+        string ofname;
+        unique_ptr<Raytracer> raytracer;
+        Image img;
+        bool ok = false;        // all stages so far succeeded
+        double load = 0;        // milliseconds per stage
+        double render = 0;
+        double encode = 0;
+    };
+
+    double millisecondsSince(steady_clock::time_point start)
+    {
+        return duration<double, milli>(steady_clock::now() - start).count();
+    }
+
+    // scene.json -> scene.png (or the format)
+    string outputName(string const &ifname, string const &format)
+    {
+        string ofname = ifname;
+        size_t dot = ofname.find_last_of('.');
+        if (dot != string::npos && dot > ofname.find_last_of('/') + 1)
+            ofname.erase(dot);
+        return ofname + '.' + (format.empty() ? "png" : format);
+    }
+}
+
+Batch::Batch(vector<string> const &scenes, string const &format,
+             function<void(Raytracer &)> const &configure, size_t queueSize)
+:
+    d_scenes(scenes),
+    d_format(format),
+    d_configure(configure),
+    d_queueSize(queueSize)
+{}
+
+bool Batch::run()
+{
+    auto start = steady_clock::now();
+    auto cache = make_shared<ResourceCache>();
+    BoundedQueue<Job> loaded(d_queueSize);
+    BoundedQueue<Job> rendered(d_queueSize);
+
+    // the progress messages of the three stages would interleave, only
+    // the reports of the encoder are printed
+    ostream report(cout.rdbuf());
+    streambuf *coutBuffer = cout.rdbuf(nullptr);
+
+    thread loader([&]()
+    {
+        TraceLog::setThreadName("batch loader");
+        for (size_t idx = 0; idx != d_scenes.size(); ++idx)
+        {
+            TraceScope scope("load", d_scenes[idx], idx);
+            auto stageStart = steady_clock::now();
+            Job job;
+            job.index = idx;
+            job.ifname = d_scenes[idx];
+            job.ofname = outputName(job.ifname, d_format);
+            job.raytracer.reset(new Raytracer(cache));
+            job.ok = job.raytracer->readScene(job.ifname);
+            if (job.ok && job.raytracer->isAnimated())
+            {
+                // one output file per scene, a sequence does not fit
+                cerr << "Error: " << job.ifname << " is animated, render "
+                        "it on its own, not with --batch.\n";
+                job.ok = false;
+            }
+            if (job.ok)
+                d_configure(*job.raytracer);
+            job.load = millisecondsSince(stageStart);
+            loaded.push(move(job));
+        }
+        loaded.close();
+    });
+
+    unsigned failed = 0;
+    double stageTotal = 0;
+    thread encoder([&]()
+    {
+        TraceLog::setThreadName("batch encoder");
+        Job job;
+        while (rendered.pop(job))
+        {
+            if (job.ok)
+            {
+                TraceScope scope("encode", job.ofname, job.index);
+                auto stageStart = steady_clock::now();
+                job.ok = job.img.write(job.ofname, d_format);
+                job.encode = millisecondsSince(stageStart);
+            }
+            job.img = Image();          // free the frame before waiting
+            job.raytracer.reset();
+
+            report << '[' << job.index + 1 << '/' << d_scenes.size() << "] "
+                   << job.ifname;
+            if (job.ok)
+                report << " -> " << job.ofname << fixed << setprecision(1)
+                       << ": load " << job.load << " ms, render "
+                       << job.render << " ms, encode " << job.encode << " ms\n";
+            else
+                report << ": FAILED\n";
+            report.unsetf(ios::floatfield);
+            failed += !job.ok;
+            stageTotal += job.load + job.render + job.encode;
+        }
+    });
+
+    // rendering is the slowest stage, it runs on this thread
+    Job job;
+    while (loaded.pop(job))
+    {
+        if (job.ok)
+        {
+            TraceScope scope("render scene", job.ifname, job.index);
+            auto stageStart = steady_clock::now();
+            job.ok = job.raytracer->renderImage(job.img);
+            job.render = millisecondsSince(stageStart);
+        }
+        rendered.push(move(job));
+    }
+    rendered.close();
+
+    loader.join();
+    encoder.join();
+    cout.rdbuf(coutBuffer);
+
+    double total = millisecondsSince(start);
+    cout << "Rendered " << d_scenes.size() - failed << " of " << d_scenes.size()
+         << " scenes in " << total / 1000 << " s (" << stageTotal / 1000
+         << " s of loading, rendering and encoding).\n";
+    return failed == 0;
+}
@@ -0,0 +1,32 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Raytracer;
+
+// Renders a list of scene files as a pipeline of three threads: while
+// scene k is traced, scene k + 1 is loaded (JSON, models, textures) and
+// scene k - 1 is encoded and written. The stages are connected by
+// BoundedQueues of queueSize scenes, so at most a few scenes are in
+// memory at once. Every scene gets a timing report when it is written.
+// Animated scenes are not rendered, they fail with an error.
+class Batch
+{
+    std::vector<std::string> d_scenes;
+    std::string d_format;       // of the outputs, empty: png
+    std::function<void(Raytracer &)> d_configure;   // command line overrides
+    size_t d_queueSize;
+
+    public:
+        Batch(std::vector<std::string> const &scenes, std::string const &format,
+              std::function<void(Raytracer &)> const &configure,
+              size_t queueSize = 1);
+
+        // false if any scene failed
+        bool run();
+};
+
+#endif
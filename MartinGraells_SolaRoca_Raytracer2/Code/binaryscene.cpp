@@ -0,0 +1,258 @@
+#include "binaryscene.h"
+
+#include "mappedfile.h"
+#include "scenestream.h"
+
+#include "json/json.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+uint32_t const BinaryScene::version;
+uint32_t const BinaryScene::byteOrderMark;
+
+namespace
+{
+    char const magic[8] = {'R', 'A', 'Y', 'S', 'C', 'E', 'N', 'E'};
+    size_t const alignment = 64;
+
+    size_t const recordSize[BinaryScene::NUM_SECTIONS] =
+    {
+        1,
+        1,
+        sizeof(PackedMaterial),
+        sizeof(PackedSphere),
+        sizeof(PackedTriangle),
+        sizeof(PackedQuad)
+    };
+
+    // the sections of a scene being converted
+    class Packer
+    {
+        vector<PackedMaterial> d_materials;
+        map<array<double, 7>, uint32_t> d_materialIndex;
+        vector<PackedSphere> d_spheres;
+        vector<PackedTriangle> d_triangles;
+        vector<PackedQuad> d_quads;
+        json d_objects = json::array();
+        AABB d_bounds[BinaryScene::NUM_SECTIONS];
+
+        public:
+            void add(json const &node);
+            void write(ostream &out, string const &settings) const;
+
+        private:
+            uint32_t material(json const &node);
+            void point(json const &node, double *coords, BinaryScene::SectionId id);
+    };
+
+    void Packer::add(json const &node)
+    {
+        auto material = node.find("material");
+        auto type = node.find("type");
+        bool packable = material != node.end() && material->is_object()
+                        && material->find("texture") == material->end()
+                        && type != node.end();
+
+        if (packable && *type == "sphere" && node.find("angle") == node.end())
+        {
+            PackedSphere sphere = {};
+            point(node.at("position"), sphere.center, BinaryScene::SPHERES);
+            sphere.radius = node.at("radius");
+            sphere.material = this->material(*material);
+            Vector extent(sphere.radius, sphere.radius, sphere.radius);
+            Point center(sphere.center[0], sphere.center[1], sphere.center[2]);
+            d_bounds[BinaryScene::SPHERES].extend(AABB(center - extent, center + extent));
+            d_spheres.push_back(sphere);
+        }
+        else if (packable && *type == "triangle")
+        {
+            PackedTriangle triangle = {};
+            char const *names[] = {"vertex1", "vertex2", "vertex3"};
+            for (unsigned idx = 0; idx != 3; ++idx)
+                point(node.at(names[idx]), triangle.vertex[idx], BinaryScene::TRIANGLES);
+            triangle.material = this->material(*material);
+            d_triangles.push_back(triangle);
+        }
+        else if (packable && *type == "quad")
+        {
+            PackedQuad quad = {};
+            char const *names[] = {"vertex1", "vertex2", "vertex3", "vertex4"};
+            for (unsigned idx = 0; idx != 4; ++idx)
+                point(node.at(names[idx]), quad.vertex[idx], BinaryScene::QUADS);
+            quad.material = this->material(*material);
+            d_quads.push_back(quad);
+        }
+        else
+            d_objects.push_back(node);
+    }
+
+    uint32_t Packer::material(json const &node)
+    {
+        json const &color = node.at("color");
+        array<double, 7> key = {{color.at(0), color.at(1), color.at(2),
+                                 node.at("ka"), node.at("kd"), node.at("ks"),
+                                 node.at("n")}};
+        auto known = d_materialIndex.find(key);
+        if (known != d_materialIndex.end())
+            return known->second;
+
+        PackedMaterial material = {{key[0], key[1], key[2]},
+                                   key[3], key[4], key[5], key[6]};
+        d_materials.push_back(material);
+        return d_materialIndex[key] = d_materials.size() - 1;
+    }
+
+    void Packer::point(json const &node, double *coords, BinaryScene::SectionId id)
+    {
+        if (!node.is_array() || node.size() != 3)
+            throw runtime_error("Points must be [x, y, z].");
+        for (unsigned axis = 0; axis != 3; ++axis)
+            coords[axis] = node[axis];
+        d_bounds[id].extend(Point(coords[0], coords[1], coords[2]));
+    }
+
+    void Packer::write(ostream &out, string const &settings) const
+    {
+        string objects = d_objects.dump();
+        void const *data[BinaryScene::NUM_SECTIONS] =
+        {
+            settings.data(), objects.data(), d_materials.data(),
+            d_spheres.data(), d_triangles.data(), d_quads.data()
+        };
+        uint64_t counts[BinaryScene::NUM_SECTIONS] =
+        {
+            settings.size(), objects.size(), d_materials.size(),
+            d_spheres.size(), d_triangles.size(), d_quads.size()
+        };
+
+        BinaryScene::Header header = {};
+        memcpy(header.magic, magic, sizeof(magic));
+        header.version = BinaryScene::version;
+        header.byteOrder = BinaryScene::byteOrderMark;
+        uint64_t offset = sizeof(header);
+        for (unsigned id = 0; id != BinaryScene::NUM_SECTIONS; ++id)
+        {
+            offset = (offset + alignment - 1) / alignment * alignment;
+            BinaryScene::Section &section = header.sections[id];
+            section.offset = offset;
+            section.count = counts[id];
+            AABB const &box = d_bounds[id];
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                section.lower[axis] = box.lower.data[axis];
+                section.upper[axis] = box.upper.data[axis];
+            }
+            offset += counts[id] * recordSize[id];
+        }
+
+        out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        uint64_t written = sizeof(header);
+        char const zeros[alignment] = {};
+        for (unsigned id = 0; id != BinaryScene::NUM_SECTIONS; ++id)
+        {
+            out.write(zeros, header.sections[id].offset - written);
+            out.write(static_cast<char const *>(data[id]), counts[id] * recordSize[id]);
+            written = header.sections[id].offset + counts[id] * recordSize[id];
+        }
+    }
+}
+
+bool BinaryScene::isBinary(string const &filename)
+{
+    ifstream in(filename, ios::binary);
+    char start[sizeof(magic)];
+    return in.read(start, sizeof(start)) && memcmp(start, magic, sizeof(magic)) == 0;
+}
+
+bool BinaryScene::convert(string const &ifname, string const &ofname)
+try
+{
+    Packer packer;
+    SceneStream stream(ifname);
+    json settings = stream.read([&](json const &node, unsigned)
+    {
+        packer.add(node);
+    });
+    if (settings.find("Animation") != settings.end())
+        throw runtime_error("Animated scenes cannot be converted.");
+
+    // written next to the output first, an interrupted conversion does
+    // not leave a broken scene behind
+    string tmpname = ofname + ".tmp";
+    ofstream out(tmpname, ios::binary | ios::trunc);
+    if (!out)
+        throw runtime_error("Could not create " + tmpname + ".");
+    packer.write(out, settings.dump());
+    out.close();
+    if (!out || rename(tmpname.c_str(), ofname.c_str()) != 0)
+    {
+        remove(tmpname.c_str());
+        throw runtime_error("Could not write " + ofname + ".");
+    }
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+BinaryScene::BinaryScene(string const &filename)
+:
+    d_file(make_shared<MappedFile const>(filename))
+{
+    size_t size = d_file->size();
+    d_header = reinterpret_cast<Header const *>(d_file->data());
+    if (size < sizeof(Header) || memcmp(d_header->magic, magic, sizeof(magic)) != 0)
+        throw runtime_error(filename + " is not a binary scene.");
+    if (d_header->version != version || d_header->byteOrder != byteOrderMark)
+        throw runtime_error(filename + ": unsupported version or byte order.");
+
+    for (unsigned id = 0; id != NUM_SECTIONS; ++id)
+    {
+        Section const &section = d_header->sections[id];
+        if (section.offset % 8 != 0 || section.offset > size
+            || section.count > (size - section.offset) / recordSize[id])
+            throw runtime_error(filename + ": section " + to_string(id)
+                                + " does not fit in the file.");
+    }
+    if (count(MATERIALS) == 0
+        && count(SPHERES) + count(TRIANGLES) + count(QUADS) != 0)
+        throw runtime_error(filename + ": primitives without materials.");
+}
+
+string BinaryScene::text(SectionId id) const
+{
+    return string(data(id), count(id));
+}
+
+uint64_t BinaryScene::count(SectionId id) const
+{
+    return d_header->sections[id].count;
+}
+
+AABB BinaryScene::bounds(SectionId id) const
+{
+    Section const &section = d_header->sections[id];
+    return AABB(Point(section.lower[0], section.lower[1], section.lower[2]),
+                Point(section.upper[0], section.upper[1], section.upper[2]));
+}
+
+shared_ptr<MappedFile const> const &BinaryScene::file() const
+{
+    return d_file;
+}
+
+char const *BinaryScene::data(SectionId id) const
+{
+    return d_file->data() + d_header->sections[id].offset;
+}
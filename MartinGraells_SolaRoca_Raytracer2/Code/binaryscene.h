@@ -0,0 +1,130 @@
+#ifndef BINARYSCENE_H_
+#define BINARYSCENE_H_
+
+#include "aabb.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class MappedFile;
+
+// Records of the packed primitive sections. Material indices refer to the
+// material table.
+struct PackedMaterial
+{
+    double color[3];
+    double ka;
+    double kd;
+    double ks;
+    double n;
+};
+
+struct PackedSphere
+{
+    double center[3];
+    double radius;
+    uint32_t material;
+    uint32_t unused;
+};
+
+struct PackedTriangle
+{
+    double vertex[3][3];
+    uint32_t material;
+    uint32_t unused;
+};
+
+struct PackedQuad
+{
+    double vertex[4][3];
+    uint32_t material;
+    uint32_t unused;
+};
+
+// Binary scene file (.rsb), used in place from a read only mapping, so
+// even scenes with millions of primitives load without parsing them.
+// Written by convert() from a JSON scene. Layout, in native byte order:
+//
+//   Header      magic "RAYSCENE", version, section table
+//   settings    JSON text: all top level members but "Objects" (the
+//               camera, render settings and lights)
+//   objects     JSON text: array of the objects that are not packed
+//   materials   PackedMaterial[], the distinct materials of the packed
+//               primitives
+//   spheres     PackedSphere[]
+//   triangles   PackedTriangle[]
+//   quads       PackedQuad[]
+//
+// Every section starts at a multiple of 64 bytes. Spheres, triangles and
+// quads are packed unless they have a texture (or, for spheres, a
+// rotation); all other objects keep their JSON description.
+class BinaryScene
+{
+    public:
+        enum SectionId
+        {
+            SETTINGS,
+            OBJECTS,
+            MATERIALS,
+            SPHERES,
+            TRIANGLES,
+            QUADS,
+            NUM_SECTIONS
+        };
+
+        struct Section
+        {
+            uint64_t offset;
+            uint64_t count;     // bytes of text, records of the others
+            double lower[3];    // bounds of the primitives in the section
+            double upper[3];
+        };
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byteOrder;     // byteOrderMark as written
+            Section sections[NUM_SECTIONS];
+        };
+
+        static uint32_t const version = 1;
+        static uint32_t const byteOrderMark = 0x01020304;
+
+        // does filename start like a binary scene?
+        static bool isBinary(std::string const &filename);
+
+        // writes the JSON scene ifname as binary scene ofname, false (with
+        // a message on cerr) on errors
+        static bool convert(std::string const &ifname,
+                            std::string const &ofname);
+
+        // maps filename, throws a runtime_error if it is not a binary scene
+        // of this version or a section does not fit in the file
+        explicit BinaryScene(std::string const &filename);
+
+        std::string text(SectionId id) const;
+        uint64_t count(SectionId id) const;
+        AABB bounds(SectionId id) const;
+
+        template <typename Record>
+        Record const *records(SectionId id) const;
+
+        // the mapping, records stay valid as long as it is held
+        std::shared_ptr<MappedFile const> const &file() const;
+
+    private:
+        std::shared_ptr<MappedFile const> d_file;
+        Header const *d_header;
+
+        char const *data(SectionId id) const;
+};
+
+template <typename Record>
+inline Record const *BinaryScene::records(SectionId id) const
+{
+    return reinterpret_cast<Record const *>(data(id));
+}
+
+#endif
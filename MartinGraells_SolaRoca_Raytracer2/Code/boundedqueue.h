@@ -0,0 +1,68 @@
+#ifndef BOUNDEDQUEUE_H_
+#define BOUNDEDQUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Queue between two threads of a pipeline. push() blocks while the queue
+// holds capacity items, so a fast producer cannot run far ahead of its
+// consumer; pop() blocks while it is empty.
+//
+// Usage: producer: while (...) queue.push(item); queue.close();
+//        consumer: Item item; while (queue.pop(item)) ...
+template <typename Item>
+class BoundedQueue
+{
+    std::deque<Item> d_items;
+    size_t d_capacity;
+    bool d_closed = false;
+    std::mutex d_mutex;
+    std::condition_variable d_notFull;
+    std::condition_variable d_notEmpty;
+
+    public:
+        explicit BoundedQueue(size_t capacity)
+        :
+            d_capacity(capacity)
+        {}
+
+        void push(Item item)
+        {
+            std::unique_lock<std::mutex> lock(d_mutex);
+            d_notFull.wait(lock, [&]
+            {
+                return d_items.size() < d_capacity;
+            });
+            d_items.push_back(std::move(item));
+            d_notEmpty.notify_one();
+        }
+
+        // false once the queue is closed and empty
+        bool pop(Item &item)
+        {
+            std::unique_lock<std::mutex> lock(d_mutex);
+            d_notEmpty.wait(lock, [&]
+            {
+                return !d_items.empty() || d_closed;
+            });
+            if (d_items.empty())
+                return false;
+            item = std::move(d_items.front());
+            d_items.pop_front();
+            d_notFull.notify_one();
+            return true;
+        }
+
+        // no more items will be pushed
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            d_closed = true;
+            d_notEmpty.notify_all();
+        }
+};
+
+#endif
@@ -0,0 +1,549 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+using namespace std;
+
+unsigned const BVH::leafSize;
+unsigned const BVH::maxDepth;
+
+namespace
+{
+    unsigned const numBins = 16;        // per axis, for the SAH
+    size_t const parallelSize = 1 << 14;    // smaller nodes use one thread
+    size_t const mortonSize = 1 << 14;  // Balanced: larger nodes use codes
+    unsigned const mortonBits = 21;     // per axis
+    unsigned const radixBits = 11;      // sorted per pass
+    double const inf = numeric_limits<double>::infinity();
+
+    // a primitive while it is sorted into the tree, kept together so the
+    // passes over a node read memory in order
+    struct Ref
+    {
+        double lower[3];
+        double upper[3];
+        uint32_t prim;
+
+        double center(unsigned axis) const
+        {
+            return 0.5 * (lower[axis] + upper[axis]);
+        }
+    };
+
+    // a box and the number of primitives in it
+    struct Bin
+    {
+        double lower[3] = {inf, inf, inf};
+        double upper[3] = {-inf, -inf, -inf};
+        size_t count = 0;
+
+        void add(Ref const &ref)
+        {
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                lower[axis] = min(lower[axis], ref.lower[axis]);
+                upper[axis] = max(upper[axis], ref.upper[axis]);
+            }
+            ++count;
+        }
+
+        void addCenter(Ref const &ref)
+        {
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                lower[axis] = min(lower[axis], ref.center(axis));
+                upper[axis] = max(upper[axis], ref.center(axis));
+            }
+            ++count;
+        }
+
+        void add(Bin const &bin)
+        {
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                lower[axis] = min(lower[axis], bin.lower[axis]);
+                upper[axis] = max(upper[axis], bin.upper[axis]);
+            }
+            count += bin.count;
+        }
+
+        double halfArea() const
+        {
+            if (count == 0)
+                return 0.0;
+            double x = upper[0] - lower[0];
+            double y = upper[1] - lower[1];
+            double z = upper[2] - lower[2];
+            return x * y + y * z + z * x;
+        }
+    };
+
+    struct Keyed
+    {
+        uint64_t code;
+        uint32_t ref;
+    };
+
+    // number of parts the work on size primitives is shared between
+    unsigned chunksFor(size_t size, unsigned threads)
+    {
+        return size >= parallelSize ? threads : 1;
+    }
+
+    // calls work(chunk, from, to) for chunks consecutive parts of
+    // [begin, end) at the same time, the first on the calling thread. The
+    // parts only depend on begin, end and chunks.
+    template <typename Work>
+    void parallelChunks(size_t begin, size_t end, unsigned chunks, Work const &work)
+    {
+        size_t size = end - begin;
+        vector<thread> workers;
+        for (unsigned chunk = 1; chunk < chunks; ++chunk)
+            workers.emplace_back(work, chunk, begin + size * chunk / chunks,
+                                 begin + size * (chunk + 1) / chunks);
+        work(0, begin, begin + size / chunks);
+        for (thread &worker : workers)
+            worker.join();
+    }
+
+    // the low mortonBits bits of value, with two zero bits after each
+    uint64_t spread(uint64_t value)
+    {
+        value &= 0x1fffff;
+        value = (value | value << 32) & 0x1f00000000ffff;
+        value = (value | value << 16) & 0x1f0000ff0000ff;
+        value = (value | value << 8) & 0x100f00f00f00f00f;
+        value = (value | value << 4) & 0x10c30c30c30c30c3;
+        value = (value | value << 2) & 0x1249249249249249;
+        return value;
+    }
+
+    void setBox(BVHNode &node, Bin const &box)
+    {
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            node.lower[axis] = box.lower[axis];
+            node.upper[axis] = box.upper[axis];
+        }
+    }
+
+    // The nodes over refs[begin, end) are appended depth first. Every
+    // split gives the same result on one thread or several (partitions
+    // are stable, bins are merged in order), so the tree does not depend
+    // on the number of threads.
+    struct Builder
+    {
+        BVH::Quality quality;
+        double margin;
+        vector<Ref> refs;
+        vector<Ref> scratch;        // partitions go through it
+        vector<uint64_t> codes;     // of refs, while sorted by them
+
+        void sortByCode(unsigned threads);
+        void build(size_t begin, size_t end, unsigned depth, unsigned threads,
+                   vector<BVHNode> &nodes);
+
+        // where to split refs[begin, end), end makes a leaf
+        size_t split(size_t begin, size_t end, unsigned depth, unsigned threads);
+        size_t splitByCode(size_t begin, size_t end) const;
+        size_t splitBySAH(size_t begin, size_t end, unsigned threads);
+        size_t splitAtMedian(size_t begin, size_t end);
+
+        Bin centerBox(size_t begin, size_t end, unsigned threads) const;
+    };
+
+    void Builder::sortByCode(unsigned threads)
+    {
+        size_t const size = refs.size();
+        Bin box = centerBox(0, size, threads);
+        double scale[3];
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            double extent = box.upper[axis] - box.lower[axis];
+            scale[axis] = extent > 0 ? (1 << mortonBits) / extent : 0.0;
+        }
+
+        unsigned chunks = chunksFor(size, threads);
+        vector<Keyed> keys(size);
+        parallelChunks(0, size, chunks, [&](unsigned, size_t from, size_t to)
+        {
+            for (size_t idx = from; idx != to; ++idx)
+            {
+                uint64_t code = 0;
+                for (unsigned axis = 0; axis != 3; ++axis)
+                {
+                    double cell = (refs[idx].center(axis) - box.lower[axis])
+                                  * scale[axis];
+                    uint64_t quantized = min(cell, (1 << mortonBits) - 1.0);
+                    code |= spread(quantized) << (2 - axis);
+                }
+                keys[idx] = Keyed{code, static_cast<uint32_t>(idx)};
+            }
+        });
+
+        // least significant digit first radix sort: stable, so equal codes
+        // stay in primitive order
+        unsigned const buckets = 1 << radixBits;
+        vector<Keyed> sorted(size);
+        vector<size_t> offsets(chunks * buckets);
+        for (unsigned shift = 0; shift < 3 * mortonBits; shift += radixBits)
+        {
+            fill(offsets.begin(), offsets.end(), 0);
+            parallelChunks(0, size, chunks, [&](unsigned chunk, size_t from, size_t to)
+            {
+                size_t *counts = &offsets[chunk * buckets];
+                for (size_t idx = from; idx != to; ++idx)
+                    ++counts[keys[idx].code >> shift & (buckets - 1)];
+            });
+            size_t total = 0;
+            for (unsigned bucket = 0; bucket != buckets; ++bucket)
+                for (unsigned chunk = 0; chunk != chunks; ++chunk)
+                {
+                    size_t count = offsets[chunk * buckets + bucket];
+                    offsets[chunk * buckets + bucket] = total;
+                    total += count;
+                }
+            parallelChunks(0, size, chunks, [&](unsigned chunk, size_t from, size_t to)
+            {
+                size_t *next = &offsets[chunk * buckets];
+                for (size_t idx = from; idx != to; ++idx)
+                    sorted[next[keys[idx].code >> shift & (buckets - 1)]++] = keys[idx];
+            });
+            keys.swap(sorted);
+        }
+
+        codes.resize(size);
+        parallelChunks(0, size, chunks, [&](unsigned, size_t from, size_t to)
+        {
+            for (size_t idx = from; idx != to; ++idx)
+            {
+                scratch[idx] = refs[keys[idx].ref];
+                codes[idx] = keys[idx].code;
+            }
+        });
+        refs.swap(scratch);
+    }
+
+    void Builder::build(size_t begin, size_t end, unsigned depth,
+                        unsigned threads, vector<BVHNode> &nodes)
+    {
+        size_t nodeIdx = nodes.size();
+        nodes.push_back(BVHNode());
+
+        size_t mid = split(begin, end, depth, threads);
+        if (mid == end)
+        {
+            Bin box;
+            for (size_t idx = begin; idx != end; ++idx)
+                box.add(refs[idx]);
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                box.lower[axis] -= margin;
+                box.upper[axis] += margin;
+            }
+            setBox(nodes[nodeIdx], box);
+            nodes[nodeIdx].first = begin;
+            nodes[nodeIdx].count = end - begin;
+            return;
+        }
+
+        size_t second;
+        if (threads > 1 && end - begin >= parallelSize)
+        {
+            // both halves at the same time, the threads shared by size
+            unsigned leftThreads = threads * double(mid - begin) / (end - begin) + 0.5;
+            leftThreads = max(1U, min(leftThreads, threads - 1));
+            vector<BVHNode> left;
+            vector<BVHNode> right;
+            thread worker([&]
+            {
+                build(begin, mid, depth + 1, leftThreads, left);
+            });
+            build(mid, end, depth + 1, threads - leftThreads, right);
+            worker.join();
+
+            // child links are relative to the start of each half
+            for (vector<BVHNode> const *half : {&left, &right})
+            {
+                size_t offset = nodes.size();
+                for (BVHNode node : *half)
+                {
+                    if (node.count == 0)
+                        node.first += offset;
+                    nodes.push_back(node);
+                }
+            }
+            second = nodeIdx + 1 + left.size();
+        }
+        else
+        {
+            build(begin, mid, depth + 1, 1, nodes);
+            second = nodes.size();
+            build(mid, end, depth + 1, 1, nodes);
+        }
+
+        // the children are grown by the same margin, so their union is
+        BVHNode &node = nodes[nodeIdx];
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            node.lower[axis] = min(nodes[nodeIdx + 1].lower[axis],
+                                   nodes[second].lower[axis]);
+            node.upper[axis] = max(nodes[nodeIdx + 1].upper[axis],
+                                   nodes[second].upper[axis]);
+        }
+        node.first = second;
+        node.count = 0;
+    }
+
+    size_t Builder::split(size_t begin, size_t end, unsigned depth, unsigned threads)
+    {
+        if (end - begin <= BVH::leafSize || depth + 1 >= BVH::maxDepth)
+            return end;
+        // median splits keep the rest of a lopsided tree within maxDepth
+        if (depth >= BVH::maxDepth / 2)
+            return splitAtMedian(begin, end);
+        if (quality == BVH::Fast
+            || (quality == BVH::Balanced && end - begin > mortonSize))
+            return splitByCode(begin, end);
+        return splitBySAH(begin, end, threads);
+    }
+
+    size_t Builder::splitByCode(size_t begin, size_t end) const
+    {
+        uint64_t first = codes[begin];
+        uint64_t last = codes[end - 1];
+        if (first == last)
+            return begin + (end - begin) / 2;
+
+        // the codes agree above the highest bit in which first and last
+        // differ, split where that bit becomes one
+        uint64_t bit = 1;
+        for (uint64_t diff = (first ^ last) >> 1; diff != 0; diff >>= 1)
+            bit <<= 1;
+        uint64_t target = (first & ~(2 * bit - 1)) | bit;
+        return lower_bound(codes.begin() + begin, codes.begin() + end, target)
+               - codes.begin();
+    }
+
+    size_t Builder::splitBySAH(size_t begin, size_t end, unsigned threads)
+    {
+        Bin box = centerBox(begin, end, threads);
+        double scale[3];
+        bool flat = true;
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            double extent = box.upper[axis] - box.lower[axis];
+            scale[axis] = extent > 0 ? numBins / extent : 0.0;
+            flat = flat && extent <= 0;
+        }
+        if (flat)
+            return end;     // all centers coincide
+        auto binOf = [&](Ref const &ref, unsigned axis)
+        {
+            double offset = ref.center(axis) - box.lower[axis];
+            return min(numBins - 1, static_cast<unsigned>(offset * scale[axis]));
+        };
+
+        unsigned chunks = chunksFor(end - begin, threads);
+        vector<Bin> bins(chunks * 3 * numBins);
+        parallelChunks(begin, end, chunks, [&](unsigned chunk, size_t from, size_t to)
+        {
+            Bin *own = &bins[chunk * 3 * numBins];
+            for (size_t idx = from; idx != to; ++idx)
+                for (unsigned axis = 0; axis != 3; ++axis)
+                    own[axis * numBins + binOf(refs[idx], axis)].add(refs[idx]);
+        });
+        for (unsigned chunk = 1; chunk < chunks; ++chunk)
+            for (unsigned idx = 0; idx != 3 * numBins; ++idx)
+                bins[idx].add(bins[chunk * 3 * numBins + idx]);
+
+        // cheapest split between two bins: area times primitives of both
+        // sides
+        double bestCost = inf;
+        unsigned bestAxis = 0;
+        unsigned bestBin = 0;
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            if (scale[axis] == 0.0)
+                continue;
+            Bin const *axisBins = &bins[axis * numBins];
+            double rightArea[numBins];
+            size_t rightCount[numBins];
+            Bin side;
+            for (unsigned bin = numBins - 1; bin != 0; --bin)
+            {
+                side.add(axisBins[bin]);
+                rightArea[bin] = side.halfArea();
+                rightCount[bin] = side.count;
+            }
+            side = Bin();
+            for (unsigned bin = 1; bin != numBins; ++bin)
+            {
+                side.add(axisBins[bin - 1]);
+                if (side.count == 0 || rightCount[bin] == 0)
+                    continue;
+                double cost = side.halfArea() * side.count
+                              + rightArea[bin] * rightCount[bin];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = bin;
+                }
+            }
+        }
+        if (bestBin == 0)
+            return splitAtMedian(begin, end);
+        size_t numLeft = 0;
+        for (unsigned bin = 0; bin != bestBin; ++bin)
+            numLeft += bins[bestAxis * numBins + bin].count;
+
+        // stable partition through scratch: left of bestBin first. Each
+        // chunk needs the number of left primitives before it.
+        vector<size_t> lefts(chunks, 0);
+        parallelChunks(begin, end, chunks, [&](unsigned chunk, size_t from, size_t to)
+        {
+            for (size_t idx = from; idx != to; ++idx)
+                lefts[chunk] += binOf(refs[idx], bestAxis) < bestBin;
+        });
+        size_t before = 0;
+        for (size_t &left : lefts)
+        {
+            size_t count = left;
+            left = before;
+            before += count;
+        }
+        parallelChunks(begin, end, chunks, [&](unsigned chunk, size_t from, size_t to)
+        {
+            size_t left = begin + lefts[chunk];
+            size_t right = begin + numLeft + (from - begin - lefts[chunk]);
+            for (size_t idx = from; idx != to; ++idx)
+                scratch[binOf(refs[idx], bestAxis) < bestBin ? left++ : right++]
+                    = refs[idx];
+        });
+        parallelChunks(begin, end, chunks, [&](unsigned, size_t from, size_t to)
+        {
+            copy(scratch.begin() + from, scratch.begin() + to, refs.begin() + from);
+        });
+        return begin + numLeft;
+    }
+
+    size_t Builder::splitAtMedian(size_t begin, size_t end)
+    {
+        Bin box = centerBox(begin, end, 1);
+        double extent[3];
+        for (unsigned axis = 0; axis != 3; ++axis)
+            extent[axis] = box.upper[axis] - box.lower[axis];
+        unsigned axis = extent[0] >= extent[1] && extent[0] >= extent[2] ? 0
+                      : extent[1] >= extent[2] ? 1 : 2;
+        if (extent[axis] <= 0)
+            return end;
+
+        size_t mid = begin + (end - begin) / 2;
+        nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+                    [&](Ref const &a, Ref const &b)
+                    {
+                        return a.center(axis) < b.center(axis);
+                    });
+        return mid;
+    }
+
+    Bin Builder::centerBox(size_t begin, size_t end, unsigned threads) const
+    {
+        unsigned chunks = chunksFor(end - begin, threads);
+        vector<Bin> parts(chunks);
+        parallelChunks(begin, end, chunks, [&](unsigned chunk, size_t from, size_t to)
+        {
+            for (size_t idx = from; idx != to; ++idx)
+                parts[chunk].addCenter(refs[idx]);
+        });
+        for (unsigned chunk = 1; chunk < chunks; ++chunk)
+            parts[0].add(parts[chunk]);
+        return parts[0];
+    }
+}
+
+bool BVH::parseQuality(string const &name, Quality &quality)
+{
+    if (name == "fast")
+        quality = Fast;
+    else if (name == "balanced")
+        quality = Balanced;
+    else if (name == "high")
+        quality = High;
+    else
+        return false;
+    return true;
+}
+
+void BVH::build(vector<AABB> const &boxes, vector<BVHNode> &nodes,
+                vector<uint32_t> &order, Quality quality, unsigned threads)
+{
+    nodes.clear();
+    order.resize(boxes.size());
+    if (boxes.empty())
+        return;
+    if (threads == 0)
+        threads = max(1U, thread::hardware_concurrency());
+
+    size_t const size = boxes.size();
+    Builder builder{quality, 0.0};
+    builder.refs.resize(size);
+    builder.scratch.resize(size);
+    unsigned chunks = chunksFor(size, threads);
+    vector<Bin> parts(chunks);
+    parallelChunks(0, size, chunks, [&](unsigned chunk, size_t from, size_t to)
+    {
+        for (size_t idx = from; idx != to; ++idx)
+        {
+            Ref &ref = builder.refs[idx];
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                ref.lower[axis] = boxes[idx].lower.data[axis];
+                ref.upper[axis] = boxes[idx].upper.data[axis];
+            }
+            ref.prim = idx;
+            parts[chunk].add(ref);
+        }
+    });
+    for (unsigned chunk = 1; chunk < chunks; ++chunk)
+        parts[0].add(parts[chunk]);
+    // as Mesh grows its bounds
+    double diagonal = sqrt(pow(parts[0].upper[0] - parts[0].lower[0], 2)
+                           + pow(parts[0].upper[1] - parts[0].lower[1], 2)
+                           + pow(parts[0].upper[2] - parts[0].lower[2], 2));
+    builder.margin = 1e-6 * diagonal + 1e-9;
+
+    if (quality != High)
+        builder.sortByCode(threads);
+    nodes.reserve(2 * size / leafSize + 1);
+    builder.build(0, size, 0, threads, nodes);
+    for (size_t idx = 0; idx != size; ++idx)
+        order[idx] = builder.refs[idx].prim;
+}
+
+bool BVH::enters(BVHNode const &node, Ray const &ray, double tMax)
+{
+    double tmin = 0.0;
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        double origin = ray.O.data[axis];
+        double dir = ray.D.data[axis];
+        if (dir == 0.0)
+        {
+            if (origin < node.lower[axis] || origin > node.upper[axis])
+                return false;
+            continue;
+        }
+        double t1 = (node.lower[axis] - origin) / dir;
+        double t2 = (node.upper[axis] - origin) / dir;
+        tmin = max(tmin, min(t1, t2));
+        tMax = min(tMax, max(t1, t2));
+        if (tmin > tMax)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "aabb.h"
+#include "ray.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Node of a bounding volume hierarchy. Nodes are stored depth first: the
+// first child of an inner node directly follows it.
+struct BVHNode
+{
+    double lower[3];
+    double upper[3];
+    uint32_t first;     // leaf: first primitive, inner node: second child
+    uint32_t count;     // primitives of a leaf, 0 for inner nodes
+};
+
+// Bounding volume hierarchy over primitives given by their boxes. The
+// primitives of a leaf are consecutive: build() returns the order to
+// store them in.
+//
+// The build splits the hierarchy into subtrees that are built on their
+// own threads, and the work on the few large nodes near the root is
+// shared by all threads. The tree does not depend on the number of
+// threads.
+class BVH
+{
+    public:
+        static unsigned const leafSize = 4;
+        static unsigned const maxDepth = 64;
+
+        enum Quality
+        {
+            Fast,       // LBVH: split by Morton code only
+            Balanced,   // Morton code splits near the root, SAH below
+            High        // binned SAH everywhere
+        };
+
+        // parses "fast", "balanced" or "high"
+        static bool parseQuality(std::string const &name, Quality &quality);
+
+        // nodes over boxes; order[idx] is the primitive to store at idx.
+        // Node boxes are grown slightly, so rounding in the ray test
+        // cannot miss a primitive on the boundary. threads == 0 uses one
+        // thread per core.
+        static void build(std::vector<AABB> const &boxes,
+                          std::vector<BVHNode> &nodes,
+                          std::vector<uint32_t> &order,
+                          Quality quality = Balanced, unsigned threads = 0);
+
+        // calls test(idx) for the (stored) primitives of all leaves the ray
+        // enters before distance tMax, which test may lower
+        template <typename Test>
+        static void traverse(BVHNode const *nodes, size_t numNodes,
+                             Ray const &ray, double &tMax, Test const &test);
+
+        // does the ray enter the box of node before distance tMax?
+        static bool enters(BVHNode const &node, Ray const &ray, double tMax);
+};
+
+template <typename Test>
+void BVH::traverse(BVHNode const *nodes, size_t numNodes, Ray const &ray,
+                   double &tMax, Test const &test)
+{
+    if (numNodes == 0)
+        return;
+
+    uint32_t stack[maxDepth + 1];
+    unsigned size = 0;
+    stack[size++] = 0;
+    while (size != 0)
+    {
+        uint32_t idx = stack[--size];
+        BVHNode const &node = nodes[idx];
+        if (!enters(node, ray, tMax))
+            continue;
+        if (node.count != 0)
+        {
+            for (uint32_t prim = node.first; prim != node.first + node.count; ++prim)
+                test(prim);
+            continue;
+        }
+        stack[size++] = node.first;
+        stack[size++] = idx + 1;
+    }
+}
+
+#endif
@@ -0,0 +1,269 @@
+#include "clouddata.h"
+
+#include "mappedfile.h"
+#include "shapes/sphere.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    uint64_t const alignment = 64;
+    // the prefilter keeps spheres the line misses by rounding errors only
+    double const tolerance = 1e-9;
+
+    Point centerOf(CloudSphere const &sphere)
+    {
+        return Point(sphere.center[0], sphere.center[1], sphere.center[2]);
+    }
+
+    bool endsWith(string const &text, string const &suffix)
+    {
+        return text.size() >= suffix.size()
+               && equal(suffix.rbegin(), suffix.rend(), text.rbegin(),
+                        [](char a, char b) { return tolower(a) == b; });
+    }
+
+    void check(CloudSphere const &sphere, string const &where)
+    {
+        for (float value : {sphere.center[0], sphere.center[1],
+                            sphere.center[2], sphere.radius})
+            if (!isfinite(value))
+                throw runtime_error(where + ": the particle is not finite.");
+        if (!(sphere.radius > 0))
+            throw runtime_error(where + ": the radius must be positive (give"
+                                " the \"radius\" of particles without one).");
+    }
+
+    vector<CloudSphere> readCSV(string const &path, double radius)
+    {
+        ifstream in(path);
+        if (!in)
+            throw runtime_error("Could not open " + path + " for reading.");
+
+        vector<CloudSphere> spheres;
+        string line;
+        for (size_t lineNr = 1; getline(in, line); ++lineNr)
+        {
+            char const *pos = line.c_str();
+            while (isspace(static_cast<unsigned char>(*pos)))
+                ++pos;
+            if (*pos == '\0' || *pos == '#')
+                continue;       // blank line or comment
+
+            double values[4];
+            unsigned num = 0;
+            while (*pos != '\0')
+            {
+                char *end;
+                double value = strtod(pos, &end);
+                if (end == pos || num == 4)
+                    throw runtime_error(path + ':' + to_string(lineNr)
+                                        + ": expected x, y, z and an optional radius.");
+                values[num++] = value;
+                pos = end;
+                while (isspace(static_cast<unsigned char>(*pos)) || *pos == ',')
+                    ++pos;
+            }
+            if (num < 3)
+                throw runtime_error(path + ':' + to_string(lineNr)
+                                    + ": expected x, y, z and an optional radius.");
+
+            CloudSphere sphere;
+            for (unsigned axis = 0; axis != 3; ++axis)
+                sphere.center[axis] = values[axis];
+            sphere.radius = num == 4 ? values[3] : radius;
+            check(sphere, path + ':' + to_string(lineNr));
+            spheres.push_back(sphere);
+        }
+        return spheres;
+    }
+
+    vector<CloudSphere> readBinary(string const &path)
+    {
+        MappedFile file(path);      // throws if it cannot be read
+        if (file.size() % sizeof(CloudSphere) != 0)
+            throw runtime_error(path + " is not a list of 16 byte particles.");
+
+        vector<CloudSphere> spheres(file.size() / sizeof(CloudSphere));
+        if (!spheres.empty())
+            memcpy(spheres.data(), file.data(), file.size());
+        for (size_t idx = 0; idx != spheres.size(); ++idx)
+            check(spheres[idx], path + ", particle " + to_string(idx));
+        return spheres;
+    }
+}
+
+CloudData::CloudData(vector<CloudSphere> spheres, BVH::Quality quality)
+{
+    vector<AABB> boxes;
+    boxes.reserve(spheres.size());
+    for (CloudSphere const &sphere : spheres)
+    {
+        Point center = centerOf(sphere);
+        double radius = sphere.radius;
+        AABB box(center - Vector(radius, radius, radius),
+                 center + Vector(radius, radius, radius));
+        boxes.push_back(box);
+        d_bounds.extend(box);
+    }
+
+    // so rounding in the box test cannot reject a hit on its surface
+    if (!d_bounds.empty())
+    {
+        double margin = 1e-6 * (d_bounds.upper - d_bounds.lower).length() + 1e-9;
+        d_bounds = d_bounds.expanded(Vector(margin, margin, margin));
+    }
+
+    vector<BVHNode> binary;
+    vector<uint32_t> order;
+    BVH::build(boxes, binary, order, quality);
+    boxes = vector<AABB>();
+    d_spheres.reserve(spheres.size());
+    for (uint32_t idx : order)
+        d_spheres.push_back(spheres[idx]);
+    vector<WideNode> nodes;
+    WideBVH::collapse(binary, nodes);
+
+    // nodes start on a cache line, see MeshData
+    size_t bytes = nodes.size() * sizeof(WideNode);
+    d_ownNodes.resize(bytes + alignment);
+    void *start = d_ownNodes.data();
+    size_t space = d_ownNodes.size();
+    align(alignment, bytes, start, space);
+    if (bytes != 0)
+        memcpy(start, nodes.data(), bytes);
+    d_nodes = static_cast<WideNode const *>(start);
+    d_numNodes = nodes.size();
+}
+
+vector<CloudSphere> CloudData::read(string const &path, double radius)
+{
+    vector<CloudSphere> spheres = endsWith(path, ".csv") || endsWith(path, ".txt")
+                                  ? readCSV(path, radius) : readBinary(path);
+    if (spheres.empty())
+        throw runtime_error(path + " holds no particles.");
+    if (spheres.size() > numeric_limits<uint32_t>::max())
+        throw runtime_error(path + " holds too many particles.");
+    return spheres;
+}
+
+Hit CloudData::intersect(Ray const &ray) const
+{
+    // most rays miss the cloud entirely
+    if (!d_bounds.intersects(ray))
+        return Hit::NO_HIT();
+
+    double nearest = numeric_limits<double>::infinity();
+    uint64_t closest = d_spheres.size();
+    WideBVH::traverseLeaves(d_nodes, d_numNodes, ray, nearest,
+                            [&](uint32_t first, uint32_t count)
+    {
+        for (uint32_t group = first; group < first + count; group += 4)
+        {
+            unsigned mask = candidates(group, min(4u, first + count - group), ray);
+            for (unsigned sphere = 0; mask != 0; ++sphere, mask >>= 1)
+            {
+                if ((mask & 1) == 0)
+                    continue;
+                CloudSphere const &candidate = d_spheres[group + sphere];
+                double t = Sphere::distance(centerOf(candidate), candidate.radius, ray);
+                if (t < nearest)
+                {
+                    nearest = t;
+                    closest = group + sphere;
+                }
+            }
+        }
+    });
+    if (closest == d_spheres.size())
+        return Hit::NO_HIT();
+    Hit hit(nearest, Sphere::normal(centerOf(d_spheres[closest]), ray, nearest));
+    hit.primitive = closest;
+    return hit;
+}
+
+Hit CloudData::intersectSphere(Ray const &ray, uint64_t sphere) const
+{
+    if (sphere >= d_spheres.size())
+        return Hit::NO_HIT();
+    Point center = centerOf(d_spheres[sphere]);
+    double t = Sphere::distance(center, d_spheres[sphere].radius, ray);
+    if (isnan(t))
+        return Hit::NO_HIT();
+    Hit hit(t, Sphere::normal(center, ray, t));
+    hit.primitive = sphere;
+    return hit;
+}
+
+AABB CloudData::bounds() const
+{
+    return d_bounds;
+}
+
+uint64_t CloudData::numSpheres() const
+{
+    return d_spheres.size();
+}
+
+unsigned CloudData::candidates(uint32_t first, uint32_t count, Ray const &ray) const
+{
+    // With L = O - center, the line meets the sphere if
+    // (D.L)^2 - (D.D)(L.L - r^2) >= 0, compared with some slack
+    CloudSphere const *spheres = &d_spheres[first];
+    double const a = ray.D.dot(ray.D);
+#ifdef __SSE2__
+    // two spheres per register, missing ones repeat the last
+    __m128d const grow = _mm_set1_pd(1 + tolerance);
+    __m128d const shrink = _mm_set1_pd(a * (1 - tolerance));
+    unsigned mask = 0;
+    for (unsigned pair = 0; pair != 2; ++pair)
+    {
+        CloudSphere const &low = spheres[min(2 * pair, count - 1)];
+        CloudSphere const &high = spheres[min(2 * pair + 1, count - 1)];
+        __m128d radius = _mm_set_pd(high.radius, low.radius);
+        __m128d h = _mm_setzero_pd();
+        __m128d q = _mm_sub_pd(_mm_setzero_pd(), _mm_mul_pd(radius, radius));
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            __m128d L = _mm_sub_pd(_mm_set1_pd(ray.O.data[axis]),
+                                   _mm_set_pd(high.center[axis], low.center[axis]));
+            h = _mm_add_pd(h, _mm_mul_pd(_mm_set1_pd(ray.D.data[axis]), L));
+            q = _mm_add_pd(q, _mm_mul_pd(L, L));
+        }
+        __m128d meets = _mm_cmpge_pd(_mm_mul_pd(grow, _mm_mul_pd(h, h)),
+                                     _mm_mul_pd(shrink, q));
+        mask |= _mm_movemask_pd(meets) << 2 * pair;
+    }
+#else
+    unsigned mask = 0;
+    for (unsigned sphere = 0; sphere != count; ++sphere)
+    {
+        double radius = spheres[sphere].radius;
+        double h = 0.0;
+        double q = -radius * radius;
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            double L = ray.O.data[axis] - spheres[sphere].center[axis];
+            h += ray.D.data[axis] * L;
+            q += L * L;
+        }
+        if ((1 + tolerance) * h * h >= a * (1 - tolerance) * q)
+            mask |= 1 << sphere;
+    }
+#endif
+    return mask & ((1 << count) - 1);
+}
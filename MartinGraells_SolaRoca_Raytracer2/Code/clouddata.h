@@ -0,0 +1,59 @@
+#ifndef CLOUDDATA_H_
+#define CLOUDDATA_H_
+
+#include "aabb.h"
+#include "bvh.h"
+#include "widebvh.h"
+#include "hit.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// sphere of a CloudData, also the record of a binary particle file
+struct CloudSphere
+{
+    float center[3];
+    float radius;
+};
+
+static_assert(sizeof(CloudSphere) == 16, "a CloudSphere takes 16 bytes");
+
+// The spheres of a particle file, packed into 16 bytes each and stored in
+// the order of their BVH, which is collapsed into a WideBVH (about 5
+// bytes per sphere). The spheres of a leaf are tested together.
+class CloudData
+{
+    std::vector<CloudSphere> d_spheres;
+    std::vector<unsigned char> d_ownNodes;      // from a 64 byte boundary
+    WideNode const *d_nodes = nullptr;
+    uint64_t d_numNodes = 0;
+    AABB d_bounds;
+
+    public:
+        CloudData(std::vector<CloudSphere> spheres, BVH::Quality quality);
+        CloudData(CloudData const &) = delete;
+        CloudData &operator=(CloudData const &) = delete;
+
+        // Reads a particle file: a CSV file (.csv or .txt) of "x, y, z" or
+        // "x, y, z, r" lines, or a binary file of CloudSphere records
+        // (native float32). Particles without a radius get radius. Throws
+        // a runtime_error if the file cannot be read or is malformed.
+        static std::vector<CloudSphere> read(std::string const &path,
+                                             double radius);
+
+        // the nearest sphere hit, Hit::primitive tells which
+        Hit intersect(Ray const &ray) const;
+        // only the given sphere, see Object::intersectPrimitive()
+        Hit intersectSphere(Ray const &ray, uint64_t sphere) const;
+        AABB bounds() const;            // slightly grown
+        uint64_t numSpheres() const;
+
+    private:
+        // bit k set if the line of the ray comes close to sphere k of the
+        // count (up to 4) spheres from first; the hits of those are
+        // computed exactly
+        unsigned candidates(uint32_t first, uint32_t count, Ray const &ray) const;
+};
+
+#endif
@@ -0,0 +1,507 @@
+#include "clusteredmesh.h"
+
+#include "bvh.h"
+#include "mappedfile.h"
+#include "tracelog.h"
+#include "shapes/triangle.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+uint32_t const ClusteredMesh::version;
+unsigned const ClusteredMesh::clusterSize;
+
+namespace
+{
+    char const magic[8] = {'R', 'A', 'Y', 'C', 'M', 'E', 'S', 'H'};
+    uint32_t const byteOrderMark = 0x01020304;
+    uint64_t const pageSize = 4096;     // clusters start on a page
+    uint64_t const alignment = 64;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t numTriangles;
+        uint64_t numClusters;
+        uint64_t clustersOffset;        // the Cluster table
+        uint64_t numNodes;              // over the clusters
+        uint64_t nodesOffset;
+        double lower[3];
+        double upper[3];
+    };
+
+    // states of a cluster
+    unsigned char const unchecked = 0;  // BVH not validated yet
+    unsigned char const valid = 1;
+    unsigned char const resident = 2;   // valid, and in the LRU list
+    unsigned char const damaged = 3;
+
+    uint64_t aligned(uint64_t offset, uint64_t to)
+    {
+        return (offset + to - 1) / to * to;
+    }
+
+    // writes zeros up to the next multiple of to
+    void pad(ostream &out, uint64_t &offset, uint64_t to)
+    {
+        static char const zeros[pageSize] = {};
+        uint64_t next = aligned(offset, to);
+        out.write(zeros, next - offset);
+        offset = next;
+    }
+
+    template <typename Record>
+    void write(ostream &out, uint64_t &offset, vector<Record> const &records)
+    {
+        out.write(reinterpret_cast<char const *>(records.data()),
+                  records.size() * sizeof(Record));
+        offset += records.size() * sizeof(Record);
+    }
+
+    Point point(float const *coords)
+    {
+        return Point(coords[0], coords[1], coords[2]);
+    }
+
+    // 21 bits of value, two zero bits between each
+    uint64_t spread(uint64_t value)
+    {
+        value &= 0x1fffff;
+        value = (value | value << 32) & 0x1f00000000ffffull;
+        value = (value | value << 16) & 0x1f0000ff0000ffull;
+        value = (value | value << 8) & 0x100f00f00f00f00full;
+        value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+        value = (value | value << 2) & 0x1249249249249249ull;
+        return value;
+    }
+
+    // positions and triangles (fans of the faces) of an OBJ model, read
+    // as OBJLoader does
+    struct Model
+    {
+        vector<float> positions;        // x, y, z per vertex
+        vector<uint32_t> triangles;     // three positions per triangle
+
+        explicit Model(string const &filename);
+
+        size_t numTriangles() const
+        {
+            return triangles.size() / 3;
+        }
+    };
+
+    // a coordinate of a v line; stof would also take "nan", "inf" and
+    // trailing garbage
+    float coordinate(string const &token)
+    {
+        char *end;
+        float value = strtof(token.c_str(), &end);
+        if (end == token.c_str() || *end != '\0' || !isfinite(value))
+            throw runtime_error("the coordinate " + token
+                                + " is not a finite number");
+        return value;
+    }
+
+    Model::Model(string const &filename)
+    {
+        ifstream in(filename);
+        if (!in)
+            throw runtime_error("Could not open " + filename + " for reading.");
+
+        string line;
+        vector<uint32_t> face;
+        for (size_t lineNr = 1; getline(in, line); ++lineNr)
+        try
+        {
+            istringstream tokens(line);
+            string kind;
+            tokens >> kind;
+            if (kind == "v")
+            {
+                string coord;
+                for (unsigned axis = 0; axis != 3; ++axis)
+                {
+                    if (!(tokens >> coord))
+                        throw runtime_error("a vertex needs 3 coordinates");
+                    positions.push_back(coordinate(coord));
+                }
+                continue;
+            }
+            if (kind != "f")
+                continue;       // normals and texture coordinates are not used
+
+            face.clear();
+            string corner;
+            while (tokens >> corner)
+            {
+                // <position>[/<texture>[/<normal>]], negative: from the end
+                long idx = stol(corner.substr(0, corner.find('/')));
+                long numPositions = positions.size() / 3;
+                idx = idx < 0 ? numPositions + idx : idx - 1;
+                if (idx < 0 || idx >= numPositions)
+                    throw runtime_error("no such vertex");
+                face.push_back(idx);
+            }
+            for (size_t second = 1; second + 1 < face.size(); ++second)
+            {
+                triangles.push_back(face[0]);
+                triangles.push_back(face[second]);
+                triangles.push_back(face[second + 1]);
+            }
+        }
+        catch (exception const &ex)
+        {
+            throw runtime_error(filename + ':' + to_string(lineNr) + ": "
+                                + ex.what() + '.');
+        }
+        if (numTriangles() == 0)
+            throw runtime_error(filename + " has no triangles.");
+        if (numTriangles() > numeric_limits<uint32_t>::max())
+            throw runtime_error(filename + " has too many triangles.");
+    }
+
+    AABB boxOf(ClusterTriangle const &triangle)
+    {
+        AABB box;
+        for (unsigned corner = 0; corner != 3; ++corner)
+            box.extend(point(triangle.vertex[corner]));
+        return box;
+    }
+
+    // the triangles order[first, first + count) of model as a cluster,
+    // appended to out
+    Cluster writeCluster(ostream &out, uint64_t &offset, Model const &model,
+                         vector<uint32_t> const &order, size_t first,
+                         size_t count)
+    {
+        vector<ClusterTriangle> triangles(count);
+        vector<AABB> boxes(count);
+        AABB bounds;
+        for (size_t idx = 0; idx != count; ++idx)
+        {
+            ClusterTriangle &triangle = triangles[idx];
+            triangle.index = order[first + idx];
+            for (unsigned corner = 0; corner != 3; ++corner)
+            {
+                uint32_t position = model.triangles[3 * triangle.index + corner];
+                for (unsigned axis = 0; axis != 3; ++axis)
+                    triangle.vertex[corner][axis] = model.positions[3 * position + axis];
+            }
+            boxes[idx] = boxOf(triangle);
+            bounds.extend(boxes[idx]);
+        }
+
+        vector<BVHNode> binary;
+        vector<uint32_t> bvhOrder;
+        BVH::build(boxes, binary, bvhOrder, BVH::High);
+        vector<ClusterTriangle> sorted;
+        sorted.reserve(count);
+        for (uint32_t idx : bvhOrder)
+            sorted.push_back(triangles[idx]);
+        vector<WideNode> nodes;
+        WideBVH::collapse(binary, nodes);
+
+        // grown like the bounds of MeshData
+        double margin = 1e-6 * (bounds.upper - bounds.lower).length() + 1e-9;
+        bounds = bounds.expanded(Vector(margin, margin, margin));
+
+        Cluster cluster = {};
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            cluster.lower[axis] = bounds.lower.data[axis];
+            cluster.upper[axis] = bounds.upper.data[axis];
+        }
+        pad(out, offset, pageSize);
+        cluster.trianglesOffset = offset;
+        cluster.numTriangles = count;
+        write(out, offset, sorted);
+        pad(out, offset, alignment);
+        cluster.nodesOffset = offset;
+        cluster.numNodes = nodes.size();
+        write(out, offset, nodes);
+        return cluster;
+    }
+}
+
+ClusteredMesh::ClusteredMesh(string const &filename, size_t budget)
+:
+    d_file(make_shared<MappedFile const>(filename)),
+    d_budget(budget)
+{
+    uint64_t size = d_file->size();
+    Header const *header = reinterpret_cast<Header const *>(d_file->data());
+    if (size < sizeof(Header) || memcmp(header->magic, magic, sizeof(magic)) != 0
+        || header->version != version || header->byteOrder != byteOrderMark
+        || header->clustersOffset % alignment != 0 || header->nodesOffset % alignment != 0
+        || header->clustersOffset > size || header->nodesOffset > size
+        || header->numClusters > (size - header->clustersOffset) / sizeof(Cluster)
+        || header->numNodes > (size - header->nodesOffset) / sizeof(WideNode)
+        || header->numClusters == 0 || header->numNodes == 0)
+        throw runtime_error(filename + " is not a clustered mesh file.");
+
+    d_clusters = reinterpret_cast<Cluster const *>(d_file->data() + header->clustersOffset);
+    d_numClusters = header->numClusters;
+    d_nodes = reinterpret_cast<WideNode const *>(d_file->data() + header->nodesOffset);
+    d_numNodes = header->numNodes;
+    d_numTriangles = header->numTriangles;
+    d_bounds = AABB(Point(header->lower[0], header->lower[1], header->lower[2]),
+                    Point(header->upper[0], header->upper[1], header->upper[2]));
+    if (!WideBVH::valid(d_nodes, d_numNodes, d_numClusters))
+        throw runtime_error(filename + " is damaged.");
+
+    // the clusters are checked when they are first paged in, reading them
+    // all here would defeat the point
+    for (uint64_t idx = 0; idx != d_numClusters; ++idx)
+    {
+        Cluster const &cluster = d_clusters[idx];
+        if (cluster.trianglesOffset % pageSize != 0 || cluster.nodesOffset % alignment != 0
+            || cluster.trianglesOffset > size || cluster.nodesOffset > size
+            || cluster.numTriangles > (size - cluster.trianglesOffset) / sizeof(ClusterTriangle)
+            || cluster.numNodes > (size - cluster.nodesOffset) / sizeof(WideNode))
+            throw runtime_error(filename + " is damaged.");
+    }
+    d_position.resize(d_numClusters);
+    d_state.assign(d_numClusters, unchecked);
+
+    // faults only read the page they need
+    madvise(const_cast<char *>(d_file->data()), size, MADV_RANDOM);
+}
+
+bool ClusteredMesh::convert(string const &model, string const &filename)
+try
+{
+    TraceScope scope("convert mesh", model);
+    Model input(model);
+    size_t numTriangles = input.numTriangles();
+
+    // triangles along a Morton curve of their centers
+    AABB centers;
+    auto centerOf = [&](size_t idx)
+    {
+        Point sum;
+        for (unsigned corner = 0; corner != 3; ++corner)
+            sum += point(&input.positions[3 * input.triangles[3 * idx + corner]]);
+        return sum / 3;
+    };
+    for (size_t idx = 0; idx != numTriangles; ++idx)
+        centers.extend(centerOf(idx));
+    vector<pair<uint64_t, uint32_t>> keyed(numTriangles);
+    Vector extent = centers.upper - centers.lower;
+    for (size_t idx = 0; idx != numTriangles; ++idx)
+    {
+        Point center = centerOf(idx);
+        uint64_t code = 0;
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            double scaled = extent.data[axis] > 0
+                            ? (center.data[axis] - centers.lower.data[axis])
+                              / extent.data[axis] * 0x1fffff
+                            : 0.0;
+            code |= spread(static_cast<uint64_t>(scaled)) << (2 - axis);
+        }
+        keyed[idx] = make_pair(code, idx);
+    }
+    sort(keyed.begin(), keyed.end());
+    vector<uint32_t> order(numTriangles);
+    for (size_t idx = 0; idx != numTriangles; ++idx)
+        order[idx] = keyed[idx].second;
+    keyed = vector<pair<uint64_t, uint32_t>>();
+
+    // renamed into place, readers never see half a file
+    string tmpname = filename + ".tmp";
+    ofstream out(tmpname, ios::binary | ios::trunc);
+    if (!out)
+        throw runtime_error("Could not create " + tmpname + ".");
+    Header header = {};
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    uint64_t offset = sizeof(header);
+
+    vector<Cluster> clusters;
+    vector<AABB> boxes;
+    AABB bounds;
+    for (size_t first = 0; first < numTriangles; first += clusterSize)
+    {
+        size_t count = min<size_t>(clusterSize, numTriangles - first);
+        Cluster cluster = writeCluster(out, offset, input, order, first, count);
+        clusters.push_back(cluster);
+        boxes.push_back(AABB(Point(cluster.lower[0], cluster.lower[1], cluster.lower[2]),
+                             Point(cluster.upper[0], cluster.upper[1], cluster.upper[2])));
+        bounds.extend(boxes.back());
+    }
+
+    // the clusters are stored in the order of their BVH
+    vector<BVHNode> binary;
+    vector<uint32_t> clusterOrder;
+    BVH::build(boxes, binary, clusterOrder, BVH::High);
+    vector<Cluster> sorted;
+    for (uint32_t idx : clusterOrder)
+        sorted.push_back(clusters[idx]);
+    vector<WideNode> nodes;
+    WideBVH::collapse(binary, nodes);
+
+    pad(out, offset, alignment);
+    header.clustersOffset = offset;
+    header.numClusters = sorted.size();
+    write(out, offset, sorted);
+    pad(out, offset, alignment);
+    header.nodesOffset = offset;
+    header.numNodes = nodes.size();
+    write(out, offset, nodes);
+
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byteOrder = byteOrderMark;
+    header.numTriangles = numTriangles;
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        header.lower[axis] = bounds.lower.data[axis];
+        header.upper[axis] = bounds.upper.data[axis];
+    }
+    out.seekp(0);
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    out.close();
+    if (!out || rename(tmpname.c_str(), filename.c_str()) != 0)
+    {
+        remove(tmpname.c_str());
+        throw runtime_error("Could not write " + filename + ".");
+    }
+    cout << numTriangles << " triangles in " << clusters.size() << " clusters.\n";
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+Hit ClusteredMesh::intersect(Ray const &ray) const
+{
+    if (!d_bounds.intersects(ray))
+        return Hit::NO_HIT();
+
+    double nearest = numeric_limits<double>::infinity();
+    ClusterTriangle closest = {};
+    bool found = false;
+    WideBVH::traverse(d_nodes, d_numNodes, ray, nearest, [&](uint32_t clusterIdx)
+    {
+        if (!page(clusterIdx))
+            return;             // damaged, left out
+        Cluster const &cluster = d_clusters[clusterIdx];
+        ClusterTriangle const *triangles = reinterpret_cast<ClusterTriangle const *>(
+            d_file->data() + cluster.trianglesOffset);
+        WideNode const *nodes = reinterpret_cast<WideNode const *>(
+            d_file->data() + cluster.nodesOffset);
+        WideBVH::traverse(nodes, cluster.numNodes, ray, nearest, [&](uint32_t idx)
+        {
+            // copied, the cluster may be dropped from memory meanwhile
+            ClusterTriangle const &triangle = triangles[idx];
+            float const (*v)[3] = triangle.vertex;
+            double t = Triangle::distance(point(v[0]), point(v[1]), point(v[2]), ray);
+            if (t < nearest || (t == nearest && found && triangle.index < closest.index))
+            {
+                nearest = t;
+                closest = triangle;
+                found = true;
+            }
+        });
+    });
+    if (!found)
+        return Hit::NO_HIT();
+    float const (*v)[3] = closest.vertex;
+    return Hit(nearest, Triangle::normal(point(v[0]), point(v[1]), point(v[2]), ray));
+}
+
+AABB ClusteredMesh::bounds() const
+{
+    return d_bounds;
+}
+
+uint64_t ClusteredMesh::numTriangles() const
+{
+    return d_numTriangles;
+}
+
+uint64_t ClusteredMesh::numClusters() const
+{
+    return d_numClusters;
+}
+
+unsigned long ClusteredMesh::pageIns() const
+{
+    lock_guard<mutex> lock(d_mutex);
+    return d_pageIns;
+}
+
+bool ClusteredMesh::page(uint32_t idx) const
+{
+    lock_guard<mutex> lock(d_mutex);
+    unsigned char &state = d_state[idx];
+    if (state == resident)
+    {
+        d_recent.splice(d_recent.begin(), d_recent, d_position[idx]);
+        return true;
+    }
+    if (state == damaged)
+        return false;
+
+    Cluster const &cluster = d_clusters[idx];
+    advise(cluster, MADV_WILLNEED);
+    if (state == unchecked)
+    {
+        WideNode const *nodes = reinterpret_cast<WideNode const *>(
+            d_file->data() + cluster.nodesOffset);
+        if (!WideBVH::valid(nodes, cluster.numNodes, cluster.numTriangles))
+        {
+            state = damaged;
+            return false;
+        }
+    }
+    state = resident;
+    d_recent.push_front(idx);
+    d_position[idx] = d_recent.begin();
+    d_resident += bytesOf(cluster);
+    ++d_pageIns;
+
+    // the cluster just paged in always stays
+    while (d_resident > d_budget && d_recent.size() > 1)
+    {
+        uint32_t oldest = d_recent.back();
+        d_recent.pop_back();
+        d_state[oldest] = valid;
+        d_resident -= bytesOf(d_clusters[oldest]);
+        advise(d_clusters[oldest], MADV_DONTNEED);
+    }
+    return true;
+}
+
+size_t ClusteredMesh::bytesOf(Cluster const &cluster) const
+{
+    return cluster.nodesOffset + cluster.numNodes * sizeof(WideNode)
+           - cluster.trianglesOffset;
+}
+
+void ClusteredMesh::advise(Cluster const &cluster, int advice) const
+{
+    // the mapping is private and never written, dropped pages are read
+    // from the file again when they are used
+    static uint64_t const page = sysconf(_SC_PAGESIZE);
+    uint64_t from = cluster.trianglesOffset / page * page;
+    uint64_t to = aligned(cluster.trianglesOffset + bytesOf(cluster), page);
+    to = min<uint64_t>(to, aligned(d_file->size(), page));
+    madvise(const_cast<char *>(d_file->data()) + from, to - from, advice);
+}
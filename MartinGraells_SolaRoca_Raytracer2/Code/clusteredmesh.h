@@ -0,0 +1,96 @@
+#ifndef CLUSTEREDMESH_H_
+#define CLUSTEREDMESH_H_
+
+#include "aabb.h"
+#include "widebvh.h"
+#include "hit.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// triangle of a ClusteredMesh, in the space of the model
+struct ClusterTriangle
+{
+    float vertex[3][3];
+    uint32_t index;     // in the model, nearer triangles win ties by index
+};
+
+// chunk of a ClusteredMesh: spatially close triangles and their BVH
+struct Cluster
+{
+    double lower[3];
+    double upper[3];
+    uint64_t trianglesOffset;
+    uint64_t nodesOffset;
+    uint32_t numTriangles;
+    uint32_t numNodes;
+};
+
+// A mesh too large for memory, in a clustered mesh file (.rcm) that
+// convert() writes from an OBJ model: the triangles sorted along a Morton
+// curve and cut into clusters of a few hundred kB, each with its own
+// WideBVH, and a WideBVH over the clusters. The file is mapped; the
+// clusters rays reach are paged in, and the least recently used ones are
+// dropped from memory again (madvise) once the resident clusters exceed
+// the budget. A render of a mesh larger than the budget gets slower
+// instead of running out of memory.
+//
+// Layout (native byte order): header, clusters (each starting on a 4 kB
+// page: ClusterTriangle[], WideNode[] from a 64 byte boundary), then the
+// Cluster table and the WideNodes over it.
+class ClusteredMesh
+{
+    std::shared_ptr<MappedFile const> d_file;
+    Cluster const *d_clusters = nullptr;
+    uint64_t d_numClusters = 0;
+    WideNode const *d_nodes = nullptr;  // over the clusters
+    uint64_t d_numNodes = 0;
+    uint64_t d_numTriangles = 0;
+    AABB d_bounds;
+    size_t d_budget;                    // bytes
+
+    // resident clusters, most recently used first
+    mutable std::mutex d_mutex;
+    mutable std::list<uint32_t> d_recent;
+    mutable std::vector<std::list<uint32_t>::iterator> d_position;
+    mutable std::vector<unsigned char> d_state;     // see page()
+    mutable size_t d_resident = 0;                  // bytes
+    mutable unsigned long d_pageIns = 0;
+
+    public:
+        static uint32_t const version = 1;
+        static unsigned const clusterSize = 8192;      // triangles
+
+        // maps a clustered mesh file. Throws a runtime_error if it cannot
+        // be read or is damaged.
+        ClusteredMesh(std::string const &filename, size_t budget);
+        ClusteredMesh(ClusteredMesh const &) = delete;
+        ClusteredMesh &operator=(ClusteredMesh const &) = delete;
+
+        // writes the clustered mesh file of an OBJ model, keeping only the
+        // positions and triangle indices in memory. Reports errors and
+        // returns false.
+        static bool convert(std::string const &model, std::string const &filename);
+
+        // a ray in the space of the model
+        Hit intersect(Ray const &ray) const;
+        AABB bounds() const;            // slightly grown, model space
+        uint64_t numTriangles() const;
+        uint64_t numClusters() const;
+        unsigned long pageIns() const;  // clusters (re)loaded so far
+
+    private:
+        // makes cluster idx resident and the most recently used one,
+        // false if its BVH is damaged
+        bool page(uint32_t idx) const;
+        size_t bytesOf(Cluster const &cluster) const;
+        void advise(Cluster const &cluster, int advice) const;
+};
+
+#endif
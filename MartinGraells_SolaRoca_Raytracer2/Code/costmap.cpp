@@ -0,0 +1,100 @@
+#include "costmap.h"
+
+#include "image.h"
+#include "triple.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace std;
+
+namespace
+{
+    // stops of the false-color ramp, from cheap to expensive
+    Color const ramp[] =
+    {
+        Color(0.0, 0.0, 0.5),
+        Color(0.0, 0.0, 1.0),
+        Color(0.0, 1.0, 1.0),
+        Color(0.0, 1.0, 0.0),
+        Color(1.0, 1.0, 0.0),
+        Color(1.0, 0.0, 0.0)
+    };
+    unsigned const rampSize = sizeof(ramp) / sizeof(ramp[0]);
+
+    Color falseColor(double t)
+    {
+        t = fmin(fmax(t, 0.0), 1.0) * (rampSize - 1);
+        unsigned idx = min(static_cast<unsigned>(t), rampSize - 2);
+        double f = t - idx;
+        return (1 - f) * ramp[idx] + f * ramp[idx + 1];
+    }
+}
+
+CostMap::CostMap(unsigned width, unsigned height)
+:
+    d_cost(width * height, 0.0),
+    d_width(width),
+    d_height(height)
+{}
+
+double CostMap::operator()(unsigned x, unsigned y) const
+{
+    return d_cost.at(index(x, y));
+}
+
+double &CostMap::operator()(unsigned x, unsigned y)
+{
+    return d_cost.at(index(x, y));
+}
+
+unsigned CostMap::width() const
+{
+    return d_width;
+}
+
+unsigned CostMap::height() const
+{
+    return d_height;
+}
+
+double CostMap::max() const
+{
+    if (d_cost.empty())
+        return 0.0;
+    return *max_element(d_cost.begin(), d_cost.end());
+}
+
+double CostMap::total() const
+{
+    return accumulate(d_cost.begin(), d_cost.end(), 0.0);
+}
+
+double CostMap::percentile(double fraction) const
+{
+    if (d_cost.empty())
+        return 0.0;
+    vector<double> sorted(d_cost);
+    size_t nth = static_cast<size_t>(fraction * (sorted.size() - 1));
+    nth_element(sorted.begin(), sorted.begin() + nth, sorted.end());
+    return sorted[nth];
+}
+
+Image CostMap::toImage() const
+{
+    Image img(d_width, d_height);
+    double scale = percentile(0.99);
+    if (scale <= 0.0)
+        scale = 1.0;    // empty map: everything maps to the cheapest color
+
+    for (unsigned y = 0; y < d_height; ++y)
+        for (unsigned x = 0; x < d_width; ++x)
+            img(x, y) = falseColor((*this)(x, y) / scale);
+    return img;
+}
+
+void CostMap::write_png(string const &filename) const
+{
+    toImage().write_png(filename);
+}
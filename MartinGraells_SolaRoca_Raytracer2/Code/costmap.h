@@ -0,0 +1,45 @@
+#ifndef COSTMAP_H_
+#define COSTMAP_H_
+
+#include <string>
+#include <vector>
+
+class Image;
+
+// Per-pixel render cost (intersection tests or nanoseconds), written as a
+// false-color image next to the rendered picture.
+class CostMap
+{
+    std::vector<double> d_cost;
+    unsigned d_width;
+    unsigned d_height;
+
+    public:
+        CostMap(unsigned width = 0, unsigned height = 0);
+
+        // Usage: cost = map(x,y);
+        //        map(x,y) = cost;
+        double operator()(unsigned x, unsigned y) const;
+        double &operator()(unsigned x, unsigned y);
+
+        unsigned width() const;
+        unsigned height() const;
+
+        double max() const;
+        double total() const;
+        double percentile(double fraction) const;
+
+        // maps cost / percentile(0.99) onto a blue-cyan-green-yellow-red
+        // ramp, so a few outliers (e.g. preempted pixels) do not wash out
+        // the rest of the map
+        Image toImage() const;
+        void write_png(std::string const &filename) const;
+
+    private:
+        inline unsigned index(unsigned x, unsigned y) const
+        {
+            return y * d_width + x;
+        }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "hash.h"
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    uint64_t const offsetBasis = 14695981039346656037ULL;
+    uint64_t const prime = 1099511628211ULL;
+}
+
+Hash::Hash()
+:
+    d_state(offsetBasis)
+{}
+
+Hash &Hash::add(void const *data, size_t size)
+{
+    unsigned char const *bytes = static_cast<unsigned char const *>(data);
+    for (size_t idx = 0; idx != size; ++idx)
+    {
+        d_state ^= bytes[idx];
+        d_state *= prime;
+    }
+    return *this;
+}
+
+Hash &Hash::add(string const &str)
+{
+    add(static_cast<uint64_t>(str.size()));
+    return add(str.data(), str.size());
+}
+
+Hash &Hash::add(uint64_t value)
+{
+    return add(&value, sizeof(value));
+}
+
+Hash &Hash::add(double value)
+{
+    return add(&value, sizeof(value));
+}
+
+uint64_t Hash::value() const
+{
+    return d_state;
+}
+
+bool Hash::ofFile(string const &filename, uint64_t &hash)
+{
+    ifstream file(filename, ios::binary);
+    if (!file)
+        return false;
+
+    Hash h;
+    vector<char> buffer(1 << 16);
+    while (file)
+    {
+        file.read(buffer.data(), buffer.size());
+        h.add(buffer.data(), file.gcount());
+    }
+    hash = h.value();
+    return file.eof();
+}
+
+string Hash::hex(uint64_t hash)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx",
+             static_cast<unsigned long long>(hash));
+    return buffer;
+}
@@ -0,0 +1,30 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <cstdint>
+#include <string>
+
+// 64 bit FNV-1a hash, used to detect changed scenes and input files.
+// Not cryptographic.
+class Hash
+{
+    uint64_t d_state;
+
+    public:
+        Hash();
+
+        Hash &add(void const *data, size_t size);
+        Hash &add(std::string const &str);      // includes the length
+        Hash &add(uint64_t value);
+        Hash &add(double value);
+
+        uint64_t value() const;
+
+        // hash of the contents of a file, false if it cannot be read
+        static bool ofFile(std::string const &filename, uint64_t &hash);
+
+        // 16 lower case hex digits
+        static std::string hex(uint64_t hash);
+};
+
+#endif
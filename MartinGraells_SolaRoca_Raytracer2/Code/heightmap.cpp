@@ -0,0 +1,145 @@
+#include "heightmap.h"
+
+#include "mappedfile.h"
+#include "tracelog.h"
+
+#include "lode/lodepng.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+unsigned const HeightMap::firstStored;
+
+HeightMap::HeightMap(string const &path, unsigned width, unsigned height)
+{
+    if (width == 0 && height == 0)
+    {
+        TraceScope scope("decode height map", path);
+        vector<unsigned char> bytes;
+        unsigned error = lodepng::decode(bytes, width, height, path, LCT_GREY, 16);
+        if (error)
+            throw runtime_error("Could not read height map " + path + ": "
+                                + lodepng_error_text(error));
+        // 16-bit PNG samples are big endian
+        d_ownSamples.resize(size_t(width) * height);
+        for (size_t idx = 0; idx != d_ownSamples.size(); ++idx)
+            d_ownSamples[idx] = bytes[2 * idx] << 8 | bytes[2 * idx + 1];
+        d_samples = d_ownSamples.data();
+    }
+    else
+    {
+        d_file = make_shared<MappedFile const>(path);   // throws if missing
+        if (d_file->size() != uint64_t(width) * height * sizeof(uint16_t))
+            throw runtime_error("Height map " + path + " is not "
+                                + to_string(width) + " x " + to_string(height)
+                                + " 16-bit samples.");
+        d_samples = reinterpret_cast<uint16_t const *>(d_file->data());
+    }
+    if (width < 2 || height < 2)
+        throw runtime_error("Height map " + path + " needs 2 x 2 samples or more.");
+    d_width = width;
+    d_height = height;
+
+    TraceScope scope("build height pyramid", path);
+    buildPyramid();
+}
+
+unsigned HeightMap::width() const
+{
+    return d_width;
+}
+
+unsigned HeightMap::height() const
+{
+    return d_height;
+}
+
+unsigned HeightMap::cellsX() const
+{
+    return d_width - 1;
+}
+
+unsigned HeightMap::cellsY() const
+{
+    return d_height - 1;
+}
+
+unsigned HeightMap::levels() const
+{
+    return d_levels;
+}
+
+unsigned HeightMap::blocksX(unsigned level) const
+{
+    return ((cellsX() - 1) >> level) + 1;
+}
+
+unsigned HeightMap::blocksY(unsigned level) const
+{
+    return ((cellsY() - 1) >> level) + 1;
+}
+
+HeightMap::Range HeightMap::range(unsigned level, unsigned x, unsigned y) const
+{
+    if (level >= firstStored)
+        return d_ranges[level - firstStored][size_t(y) * blocksX(level) + x];
+    unsigned x1 = min(cellsX(), (x + 1) << level);
+    unsigned y1 = min(cellsY(), (y + 1) << level);
+    return scan(x << level, y << level, x1, y1);
+}
+
+HeightMap::Range HeightMap::scan(unsigned x0, unsigned y0, unsigned x1,
+                                 unsigned y1) const
+{
+    Range result = {sample(x0, y0), sample(x0, y0)};
+    for (unsigned y = y0; y <= y1; ++y)
+        for (unsigned x = x0; x <= x1; ++x)
+        {
+            uint16_t value = sample(x, y);
+            result.low = min(result.low, value);
+            result.high = max(result.high, value);
+        }
+    return result;
+}
+
+void HeightMap::buildPyramid()
+{
+    d_levels = 1;
+    while (blocksX(d_levels - 1) > 1 || blocksY(d_levels - 1) > 1)
+        ++d_levels;
+
+    for (unsigned level = firstStored; level < d_levels; ++level)
+    {
+        unsigned numX = blocksX(level);
+        unsigned numY = blocksY(level);
+        vector<Range> ranges(size_t(numX) * numY);
+        for (unsigned y = 0; y != numY; ++y)
+            for (unsigned x = 0; x != numX; ++x)
+            {
+                Range &block = ranges[size_t(y) * numX + x];
+                if (level == firstStored)
+                {
+                    // from the samples
+                    unsigned x1 = min(cellsX(), (x + 1) << level);
+                    unsigned y1 = min(cellsY(), (y + 1) << level);
+                    block = scan(x << level, y << level, x1, y1);
+                    continue;
+                }
+                // the (up to four) blocks of the level below
+                block = range(level - 1, 2 * x, 2 * y);
+                for (unsigned child = 1; child != 4; ++child)
+                {
+                    unsigned cx = 2 * x + (child & 1);
+                    unsigned cy = 2 * y + (child >> 1);
+                    if (cx >= blocksX(level - 1) || cy >= blocksY(level - 1))
+                        continue;
+                    Range below = range(level - 1, cx, cy);
+                    block.low = min(block.low, below.low);
+                    block.high = max(block.high, below.high);
+                }
+            }
+        d_ranges.push_back(move(ranges));
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef HEIGHTMAP_H_
+#define HEIGHTMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// The heights of a terrain: a grid of 16-bit samples, read from a PNG
+// (grey, decoded to 16 bits) or mapped from a raw file of native 16-bit
+// samples, row by row. A cell lies between four samples.
+//
+// For the cells there is a pyramid of height ranges: level l holds the
+// lowest and highest sample of blocks of 2^l x 2^l cells, up to a single
+// block on the top level. The finest levels are not stored but read from
+// the samples, which costs a few reads and saves most of the memory (the
+// pyramid adds a third of a byte per sample).
+class HeightMap
+{
+    public:
+        struct Range
+        {
+            uint16_t low;
+            uint16_t high;
+        };
+
+        // levels below this are read from the samples
+        static unsigned const firstStored = 2;
+
+    private:
+        std::shared_ptr<MappedFile const> d_file;   // if raw
+        std::vector<uint16_t> d_ownSamples;         // if decoded
+        uint16_t const *d_samples = nullptr;
+        unsigned d_width = 0;
+        unsigned d_height = 0;
+        unsigned d_levels = 0;
+        // d_ranges[level - firstStored]: the blocks, row by row
+        std::vector<std::vector<Range>> d_ranges;
+
+    public:
+        // Reads path, a PNG, or a raw file if width and height are given.
+        // Throws a runtime_error if it cannot be read, is too small (less
+        // than 2 x 2 samples) or a raw file has the wrong size.
+        HeightMap(std::string const &path, unsigned width = 0,
+                  unsigned height = 0);
+        HeightMap(HeightMap const &) = delete;
+        HeightMap &operator=(HeightMap const &) = delete;
+
+        unsigned width() const;         // samples per row
+        unsigned height() const;        // rows
+        unsigned cellsX() const;        // width() - 1
+        unsigned cellsY() const;        // height() - 1
+
+        // levels of the pyramid, the top one is levels() - 1
+        unsigned levels() const;
+        // blocks along each axis on level
+        unsigned blocksX(unsigned level) const;
+        unsigned blocksY(unsigned level) const;
+        Range range(unsigned level, unsigned x, unsigned y) const;
+
+        uint16_t sample(unsigned x, unsigned y) const;
+
+    private:
+        // range of the samples of the cells [x0, x1) x [y0, y1)
+        Range scan(unsigned x0, unsigned y0, unsigned x1, unsigned y1) const;
+        void buildPyramid();
+};
+
+inline uint16_t HeightMap::sample(unsigned x, unsigned y) const
+{
+    return d_samples[size_t(y) * d_width + x];
+}
+
+#endif
@@ -2,13 +2,21 @@
 #define HIT_H_
 
 #include "triple.h"
+#include <cstdint>
 #include <limits>
 
+class Material;
+
 class Hit
 {
     public:
         double t;   // distance of hit
         Vector N;   // Normal at hit
+        // material of the primitive hit, if it is not the material of the
+        // object (objects holding many primitives, see PackedPrimitives)
+        Material const *material = nullptr;
+        // which of them, see Object::intersectPrimitive()
+        uint64_t primitive = 0;
 
         Hit(double time, Vector const &normal)
         :
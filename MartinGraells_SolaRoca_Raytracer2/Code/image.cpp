@@ -1,11 +1,64 @@
 #include "image.h"
+#include "mappedfile.h"
+#include "pngwriter.h"
+#include "tracelog.h"
 
 #include "lode/lodepng.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <iostream>
 #include <fstream>
 
 using namespace std;
 
+namespace
+{
+    // from this size on PngWriter encodes the image on all cores
+    unsigned const parallelPngPixels = 2048 * 2048;
+
+    // the framebuffer is not clamped, 8 bit formats clamp to 1 on output
+    unsigned char toByte(double value)
+    {
+        return static_cast<unsigned char>(fmin(value, 1.0) * 255.0);
+    }
+
+    bool littleEndian()
+    {
+        uint16_t const one = 1;
+        return *reinterpret_cast<unsigned char const *>(&one) == 1;
+    }
+
+    // copies the float RGB values of the given rows to out
+    char *copyFloats(std::vector<Color> const &pixels, unsigned width,
+                     std::vector<unsigned> const &rows, char *out)
+    {
+        for (unsigned y : rows)
+        {
+            Color const *pixel = &pixels[y * width];
+            for (unsigned x = 0; x != width; ++x, ++pixel)
+            {
+                float const rgb[3] = {static_cast<float>(pixel->r),
+                                      static_cast<float>(pixel->g),
+                                      static_cast<float>(pixel->b)};
+                memcpy(out, rgb, sizeof(rgb));
+                out += sizeof(rgb);
+            }
+        }
+        return out;
+    }
+
+    std::vector<unsigned> rowOrder(unsigned height, bool bottomUp)
+    {
+        std::vector<unsigned> rows(height);
+        for (unsigned y = 0; y != height; ++y)
+            rows[y] = bottomUp ? height - 1 - y : y;
+        return rows;
+    }
+}
+
 Image::Image(unsigned width, unsigned height)
 :
     d_pixels(width * height),
@@ -64,21 +117,91 @@ Color const &Image::colorAt(float x, float y) const
 
 void Image::write_png(std::string const &filename) const
 {
-    vector<unsigned char> image;
-    image.reserve(size() * 4);  // reserves size (less allocations)
-    for (Color pixel : d_pixels)
+    TraceScope scope("encode PNG", filename);
+    if (size() >= parallelPngPixels)
+    {
+        if (!PngWriter::write(*this, filename))
+            cerr << "Could not write " << filename << '\n';
+        return;
+    }
+
+    vector<unsigned char> image(size() * 4);
+    auto byte = image.begin();
+    for (Color const &pixel : d_pixels)
     {
-        image.push_back(static_cast<unsigned char>(pixel.r * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.g * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.b * 255.0));
-        image.push_back(255);   // alpha is always 1
+        *byte++ = toByte(pixel.r);
+        *byte++ = toByte(pixel.g);
+        *byte++ = toByte(pixel.b);
+        *byte++ = 255;          // alpha is always 1
     }
 
     lodepng::encode(filename, image, d_width, d_height);
 }
 
+void Image::write_ppm(std::string const &filename) const
+{
+    TraceScope scope("write PPM", filename);
+    string header = "P6\n" + to_string(d_width) + ' ' + to_string(d_height)
+                    + "\n255\n";
+    MappedFile file(filename, header.size() + 3 * size());
+    char *out = copy(header.begin(), header.end(), file.data());
+    for (Color const &pixel : d_pixels)
+    {
+        *out++ = toByte(pixel.r);
+        *out++ = toByte(pixel.g);
+        *out++ = toByte(pixel.b);
+    }
+}
+
+void Image::write_pfm(std::string const &filename) const
+{
+    TraceScope scope("write PFM", filename);
+    // a negative scale marks little endian data
+    string header = "PF\n" + to_string(d_width) + ' ' + to_string(d_height)
+                    + (littleEndian() ? "\n-1.0\n" : "\n1.0\n");
+    MappedFile file(filename, header.size() + 3 * sizeof(float) * size());
+    char *out = copy(header.begin(), header.end(), file.data());
+    copyFloats(d_pixels, d_width, rowOrder(d_height, true), out);
+}
+
+void Image::write_raw(std::string const &filename) const
+{
+    TraceScope scope("write raw", filename);
+    MappedFile file(filename, 3 * sizeof(float) * size());
+    copyFloats(d_pixels, d_width, rowOrder(d_height, false), file.data());
+}
+
+bool Image::write(std::string const &filename, std::string const &format) const
+try
+{
+    string type = format;
+    if (type.empty())
+    {
+        size_t dot = filename.find_last_of('.');
+        if (dot != string::npos)
+            type = filename.substr(dot + 1);
+        transform(type.begin(), type.end(), type.begin(), ::tolower);
+    }
+
+    if (type == "ppm")
+        write_ppm(filename);
+    else if (type == "pfm")
+        write_pfm(filename);
+    else if (type == "raw")
+        write_raw(filename);
+    else
+        write_png(filename);
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
 void Image::read_png(std::string const &filename)
 {
+    TraceScope scope("decode PNG", filename);
     vector<unsigned char> image;
     lodepng::decode(image, d_width, d_height, filename);
     d_pixels.reserve(size());
@@ -37,6 +37,22 @@ class Image
         void write_png(std::string const &filename) const;
         void read_png(std::string const &filename);
 
+        // Uncompressed formats, written through a memory mapped file:
+        //  ppm: binary 8 bit RGB (P6), clamped like the PNG output
+        //  pfm: 32 bit float RGB, unclamped, rows from bottom to top
+        //  raw: 32 bit float RGB, unclamped, rows from top to bottom, no
+        //       header
+        // They throw a runtime_error if the file cannot be written.
+        void write_ppm(std::string const &filename) const;
+        void write_pfm(std::string const &filename) const;
+        void write_raw(std::string const &filename) const;
+
+        // writes in the given format ("png", "ppm", "pfm" or "raw"), or
+        // if format is empty, the format matching the extension (png if
+        // unknown). Returns false (after reporting) if writing failed.
+        bool write(std::string const &filename,
+                   std::string const &format = "") const;
+
     private:
         inline unsigned index(unsigned x, unsigned y) const
         {
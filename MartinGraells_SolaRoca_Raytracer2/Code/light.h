@@ -13,12 +13,25 @@ class Light
     public:
         Point const position;
         Color const color;
+        double const range;     // no light beyond, 0: unlimited
 
-        Light(Point const &pos, Color const &c)
+        Light(Point const &pos, Color const &c, double range = 0)
         :
             position(pos),
-            color(c)
+            color(c),
+            range(range)
         {}
+
+        // fraction of the light that reaches distance d: falls off
+        // smoothly to 0 at the range
+        double falloff(double d) const
+        {
+            if (range <= 0)
+                return 1.0;
+            double x = d / range;
+            double window = 1 - x * x * x * x;
+            return window <= 0 ? 0.0 : window * window;
+        }
 };
 
 #endif
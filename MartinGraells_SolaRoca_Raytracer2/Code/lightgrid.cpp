@@ -0,0 +1,108 @@
+#include "lightgrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+void LightGrid::build(vector<LightPtr> const &lights, vector<double> const &radii)
+{
+    d_bounds = AABB();
+    d_lists.clear();
+    d_everywhere.clear();
+
+    vector<unsigned> local;
+    for (unsigned idx = 0; idx != lights.size(); ++idx)
+    {
+        if (radii[idx] <= 0)
+            continue;
+        if (isinf(radii[idx]))
+        {
+            d_everywhere.push_back(idx);
+            continue;
+        }
+        Vector extent(radii[idx], radii[idx], radii[idx]);
+        d_bounds.extend(AABB(lights[idx]->position - extent,
+                             lights[idx]->position + extent));
+        local.push_back(idx);
+    }
+    if (local.empty())
+    {
+        d_cells[0] = d_cells[1] = d_cells[2] = 0;
+        return;
+    }
+
+    // about four cells per light, as cubic as the bounds allow
+    Vector size = d_bounds.upper - d_bounds.lower;
+    double volume = max(size.x, 1e-9) * max(size.y, 1e-9) * max(size.z, 1e-9);
+    double cell = cbrt(volume / (4.0 * local.size()));
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        d_cells[axis] = min(64u, max(1u, static_cast<unsigned>(
+                                             ceil(size.data[axis] / cell))));
+        d_cellSize.data[axis] = size.data[axis] / d_cells[axis];
+    }
+    d_lists.assign(d_cells[0] * d_cells[1] * d_cells[2], vector<unsigned>());
+
+    for (unsigned idx : local)
+    {
+        Point const &center = lights[idx]->position;
+        double radius = radii[idx];
+        unsigned from[3];
+        unsigned to[3];
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            auto cellOf = [&](double coord)
+            {
+                double pos = (coord - d_bounds.lower.data[axis]) / d_cellSize.data[axis];
+                return min(d_cells[axis] - 1, static_cast<unsigned>(fmax(pos, 0.0)));
+            };
+            from[axis] = cellOf(center.data[axis] - radius);
+            to[axis] = cellOf(center.data[axis] + radius);
+        }
+
+        for (unsigned z = from[2]; z <= to[2]; ++z)
+            for (unsigned y = from[1]; y <= to[1]; ++y)
+                for (unsigned x = from[0]; x <= to[0]; ++x)
+                {
+                    // only the cells the sphere touches
+                    Point lower = d_bounds.lower + Vector(x, y, z) * d_cellSize;
+                    Point upper = lower + d_cellSize;
+                    double d2 = 0;
+                    for (unsigned axis = 0; axis != 3; ++axis)
+                    {
+                        double c = center.data[axis];
+                        double gap = fmax(fmax(lower.data[axis] - c, c - upper.data[axis]), 0.0);
+                        d2 += gap * gap;
+                    }
+                    if (d2 <= radius * radius)
+                        d_lists[(z * d_cells[1] + y) * d_cells[0] + x].push_back(idx);
+                }
+    }
+}
+
+vector<unsigned> const &LightGrid::everywhere() const
+{
+    return d_everywhere;
+}
+
+vector<unsigned> const &LightGrid::near(Point const &point) const
+{
+    if (d_lists.empty())
+        return d_none;
+
+    unsigned cell[3];
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        double pos = (point.data[axis] - d_bounds.lower.data[axis]) / d_cellSize.data[axis];
+        if (!(pos >= 0) || pos > d_cells[axis])
+            return d_none;      // outside the reach of all these lights
+        cell[axis] = min(d_cells[axis] - 1, static_cast<unsigned>(pos));
+    }
+    return d_lists[(cell[2] * d_cells[1] + cell[1]) * d_cells[0] + cell[0]];
+}
+
+unsigned LightGrid::numCells() const
+{
+    return d_lists.size();
+}
@@ -0,0 +1,37 @@
+#ifndef LIGHTGRID_H_
+#define LIGHTGRID_H_
+
+#include "aabb.h"
+#include "light.h"
+
+#include <vector>
+
+// Uniform grid of per-cell light lists, so the lights that can reach a
+// point are found in constant time. Every light has a radius of influence
+// (infinite for lights without a range); a cell lists the lights whose
+// sphere of influence touches it. Lights with an infinite radius are
+// kept in one list that applies everywhere.
+class LightGrid
+{
+    AABB d_bounds;
+    unsigned d_cells[3] = {0, 0, 0};
+    Vector d_cellSize;
+    std::vector<std::vector<unsigned>> d_lists;     // light indices, sorted
+    std::vector<unsigned> d_everywhere;
+    std::vector<unsigned> const d_none;
+
+    public:
+        // radii[idx]: radius of influence of lights[idx], <= 0 to ignore
+        // the light
+        void build(std::vector<LightPtr> const &lights,
+                   std::vector<double> const &radii);
+
+        // lights with an infinite radius
+        std::vector<unsigned> const &everywhere() const;
+        // lights with a finite radius that may reach point
+        std::vector<unsigned> const &near(Point const &point) const;
+
+        unsigned numCells() const;
+};
+
+#endif
@@ -1,44 +1,554 @@
+#include "batch.h"
+#include "binaryscene.h"
+#include "clusteredmesh.h"
+#include "image.h"
 #include "raytracer.h"
+#include "server.h"
+#include "shard.h"
+#include "tracelog.h"
+#include "triple.h"
+#include "watcher.h"
 
+#include "json/json.h"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+
+#include <unistd.h>
 
 using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned long const maxTileCacheSize = 1ul << 20;  // MB, 1 TB
+
+    void usage(char const *program)
+    {
+        cerr << "Usage: " << program << " [options] in-file [out-file.png]\n"
+                "       " << program << " --serve | --listen <socket>\n"
+                "       " << program << " [--format <type>] --merge out-file shard-file...\n"
+                "       " << program << " [options] --batch in-file...\n"
+                "       " << program << " --convert in-file.json out-file.rsb\n"
+                "       " << program << " --convert model.obj out-file.rcm\n"
+                "Options:\n"
+                "  --eye <x>,<y>,<z>    position of the camera\n"
+                "  --diff <patch.json>  apply a scene diff, see README.md\n"
+                "  --size <w>x<h>       resolution of the frame\n"
+                "  --crop <x>,<y>,<w>,<h>\n"
+                "                       only render this part of the frame\n"
+                "  --crop-full          write the crop into a full size image\n"
+                "  --format <type>      png, ppm, pfm or raw (default: from\n"
+                "                       the extension of out-file)\n"
+                "  --progressive        render in passes of increasing quality\n"
+                "  --samples <n>        samples per pixel (progressive)\n"
+                "  --time-budget <s>    stop refining after s seconds\n"
+                "  --snapshot-every <s> write the image every s seconds\n"
+                "  --checkpoint-every <s>\n"
+                "                       save <out-file>.ckpt every s seconds\n"
+                "  --resume             continue from <out-file>.ckpt\n"
+                "  --trace <file.json>  write a chrome://tracing timeline\n"
+                "  --watch              re-render when in-file changes\n"
+                "  --stream             stream in-file instead of parsing it\n"
+                "                       whole (default for files of 64 MB+)\n"
+                "  --frames <a>-<b>     frames of an animated scene to render\n"
+                "  --shard <i>/<n>      render part i of n of the frame into\n"
+                "                       a shard file (out-file), see --merge\n"
+                "  --tile-cache <dir>   reuse tiles rendered before\n"
+                "  --tile-cache-size <MB>\n"
+                "                       size limit of the tile cache (256)\n"
+                "  --client <socket>    let the server at socket render\n"
+                "Server:\n"
+                "  --serve              read render requests from stdin\n"
+                "  --listen <socket>    read render requests from a Unix\n"
+                "                       domain socket\n";
+    }
+
+    // text as a whole number in [0, max], false if it is not one
+    bool parseNumber(char const *text, unsigned long max, unsigned long &value)
+    {
+        if (!isdigit(static_cast<unsigned char>(*text)))
+            return false;           // strtoul would accept -1
+        char *end;
+        errno = 0;
+        value = strtoul(text, &end, 10);
+        return errno == 0 && *end == '\0' && value <= max;
+    }
+
+    // text as a number of seconds >= 0, false if it is not one
+    bool parseSeconds(char const *text, double &value)
+    {
+        char *end;
+        value = strtod(text, &end);
+        return end != text && *end == '\0' && isfinite(value) && value >= 0.0;
+    }
+
+    // "x,y,w,h" of whole numbers, not empty; false if text is not one
+    bool parseCrop(char const *text, Region &crop)
+    {
+        unsigned long fields[4];
+        string rest = text;
+        for (unsigned idx = 0; idx != 4; ++idx)
+        {
+            size_t comma = rest.find(',');
+            if ((comma == string::npos) != (idx == 3)
+                || !parseNumber(rest.substr(0, comma).c_str(), UINT_MAX, fields[idx]))
+                return false;
+            rest.erase(0, comma == string::npos ? comma : comma + 1);
+        }
+        crop = Region(fields[0], fields[1], fields[2], fields[3]);
+        return !crop.empty();
+    }
+
+    string absolutePath(string const &path)
+    {
+        if (!path.empty() && path[0] == '/')
+            return path;
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) == nullptr)
+            return path;
+        return string(cwd) + '/' + path;
+    }
+
+    // renders by sending the settings to a RenderServer
+    int runClient(string const &socketPath, json request)
+    {
+        json reply;
+        if (!RenderServer::send(socketPath, request, reply))
+            return 1;
+        if (reply["ok"] != true)
+        {
+            cerr << "Error: " << reply["error"].get<string>() << '\n';
+            return 1;
+        }
+        cout << "Rendered " << reply["output"].get<string>() << " in "
+             << reply["seconds"]["total"] << "s.\n";
+        return 0;
+    }
+}
 
 int main(int argc, char *argv[])
 {
-    cout << "Introduction to Computer Graphics - Raytracer\n\n";
+    // split options from the positional arguments
+    vector<string> args;
+    unsigned width = 0;
+    unsigned height = 0;
+    Region crop;
+    bool cropFull = false;
+    string format;
+    bool progressive = false;
+    unsigned samples = 0;
+    double timeBudget = 0;
+    double snapshotInterval = 0;
+    double checkpointInterval = 0;
+    bool resume = false;
+    string tileCache;
+    unsigned long tileCacheSize = 256;  // MB
+    unsigned shardIndex = 0;
+    unsigned shardCount = 0;
+    bool merge = false;
+    bool convert = false;
+    bool batch = false;
+    unsigned firstFrame = 0;
+    unsigned lastFrame = 0;
+    bool hasFrames = false;
+    bool watch = false;
+    bool stream = false;
+    bool serve = false;
+    string listenSocket;
+    string clientSocket;
+    bool hasEye = false;
+    Point eye;
+    json diff;
+    bool hasDiff = false;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        string arg = argv[idx];
+        if (arg == "--trace" && idx + 1 < argc)
+            TraceLog::enable(argv[++idx]);
+        else if (arg == "--tile-cache" && idx + 1 < argc)
+            tileCache = argv[++idx];
+        else if (arg == "--tile-cache-size" && idx + 1 < argc)
+        {
+            if (!parseNumber(argv[++idx], maxTileCacheSize, tileCacheSize)
+                || tileCacheSize == 0)
+            {
+                cerr << "Invalid tile cache size: " << argv[idx] << " (1 to "
+                     << maxTileCacheSize << " MB)\n";
+                return 1;
+            }
+        }
+        else if (arg == "--shard" && idx + 1 < argc)
+        {
+            if (sscanf(argv[++idx], "%u/%u", &shardIndex, &shardCount) != 2
+                || shardIndex >= shardCount)
+            {
+                cerr << "Invalid shard: " << argv[idx] << '\n';
+                return 1;
+            }
+        }
+        else if (arg == "--merge")
+            merge = true;
+        else if (arg == "--convert")
+            convert = true;
+        else if (arg == "--batch")
+            batch = true;
+        else if (arg == "--frames" && idx + 1 < argc)
+        {
+            int fields = sscanf(argv[++idx], "%u-%u", &firstFrame, &lastFrame);
+            if (fields == 1)
+                lastFrame = firstFrame;
+            if (fields < 1 || lastFrame < firstFrame)
+            {
+                cerr << "Invalid frame range: " << argv[idx] << '\n';
+                return 1;
+            }
+            hasFrames = true;
+        }
+        else if (arg == "--watch")
+            watch = true;
+        else if (arg == "--stream")
+            stream = true;
+        else if (arg == "--serve")
+            serve = true;
+        else if (arg == "--listen" && idx + 1 < argc)
+            listenSocket = argv[++idx];
+        else if (arg == "--client" && idx + 1 < argc)
+            clientSocket = argv[++idx];
+        else if (arg == "--eye" && idx + 1 < argc)
+        {
+            if (sscanf(argv[++idx], "%lf,%lf,%lf", &eye.x, &eye.y, &eye.z) != 3)
+            {
+                cerr << "Invalid eye position: " << argv[idx] << '\n';
+                return 1;
+            }
+            hasEye = true;
+        }
+        else if (arg == "--diff" && idx + 1 < argc)
+        {
+            ifstream patch(argv[++idx]);
+            try
+            {
+                if (!patch)
+                    throw runtime_error("Could not open it for reading.");
+                patch >> diff;
+            }
+            catch (exception const &ex)
+            {
+                cerr << "Invalid diff " << argv[idx] << ": " << ex.what() << '\n';
+                return 1;
+            }
+            hasDiff = true;
+        }
+        else if (arg == "--size" && idx + 1 < argc)
+        {
+            if (sscanf(argv[++idx], "%ux%u", &width, &height) != 2
+                || width == 0 || height == 0)
+            {
+                cerr << "Invalid size: " << argv[idx] << '\n';
+                return 1;
+            }
+        }
+        else if (arg == "--crop" && idx + 1 < argc)
+        {
+            if (!parseCrop(argv[++idx], crop))
+            {
+                cerr << "Invalid crop window: " << argv[idx] << '\n';
+                return 1;
+            }
+        }
+        else if (arg == "--crop-full")
+            cropFull = true;
+        else if (arg == "--format" && idx + 1 < argc)
+        {
+            format = argv[++idx];
+            if (format != "png" && format != "ppm" && format != "pfm"
+                && format != "raw")
+            {
+                cerr << "Unknown format: " << format << '\n';
+                return 1;
+            }
+        }
+        else if (arg == "--progressive")
+            progressive = true;
+        else if (arg == "--samples" && idx + 1 < argc)
+        {
+            unsigned long value;
+            if (!parseNumber(argv[++idx], UINT_MAX, value))
+            {
+                cerr << "Invalid sample count: " << argv[idx] << '\n';
+                return 1;
+            }
+            samples = value;
+            progressive = true;
+        }
+        else if (arg == "--time-budget" && idx + 1 < argc)
+        {
+            if (!parseSeconds(argv[++idx], timeBudget))
+            {
+                cerr << "Invalid time budget: " << argv[idx] << '\n';
+                return 1;
+            }
+            progressive = true;
+        }
+        else if (arg == "--snapshot-every" && idx + 1 < argc)
+        {
+            if (!parseSeconds(argv[++idx], snapshotInterval))
+            {
+                cerr << "Invalid snapshot interval: " << argv[idx] << '\n';
+                return 1;
+            }
+            progressive = true;
+        }
+        else if (arg == "--checkpoint-every" && idx + 1 < argc)
+        {
+            if (!parseSeconds(argv[++idx], checkpointInterval))
+            {
+                cerr << "Invalid checkpoint interval: " << argv[idx] << '\n';
+                return 1;
+            }
+            progressive = true;
+        }
+        else if (arg == "--resume")
+        {
+            resume = true;
+            progressive = true;
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+        {
+            cerr << "Unknown option: " << arg << '\n';
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            args.push_back(arg);
+    }
 
-    if (argc < 2 || argc > 3)
+    // with --serve stdout only carries the replies
+    (serve ? cerr : cout) << "Introduction to Computer Graphics - Raytracer\n\n";
+
+    if (serve || !listenSocket.empty())
     {
-        cerr << "Usage: " << argv[0] << "in-file [out-file.png]\n";
-        return 1;
+        RenderServer server;
+        bool served = true;
+        if (serve)
+            server.serve(cin, cout);
+        else
+            served = server.listen(listenSocket);
+        if (!TraceLog::write())
+            cerr << "Error: could not write the trace file.\n";
+        return served ? 0 : 1;
     }
 
-    Raytracer raytracer;
+    if (convert)
+    {
+        if (args.size() != 2)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        cout << "Converting " << args[0] << " to " << args[1] << "...\n";
+        string const &in = args[0];
+        if (in.size() > 4 && in.compare(in.size() - 4, 4, ".obj") == 0)
+            return ClusteredMesh::convert(in, args[1]) ? 0 : 1;
+        return BinaryScene::convert(args[0], args[1]) ? 0 : 1;
+    }
 
-    // read the scene
-    if (!raytracer.readScene(argv[1]))
+    if (merge)
     {
-        cerr << "Error: reading scene from " << argv[1] <<
-            " failed - no output generated.\n";
+        if (args.size() < 2)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        Image img;
+        vector<string> shards(args.begin() + 1, args.end());
+        bool merged = Shard::merge(shards, img);
+        if (merged)
+        {
+            cout << "Writing " << shards.size() << " merged shards to "
+                 << args[0] << "...\n";
+            merged = img.write(args[0], format);
+        }
+        if (!TraceLog::write())
+            cerr << "Error: could not write the trace file.\n";
+        return merged ? 0 : 1;
+    }
+
+    if (batch)
+    {
+        if (args.empty())
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        if (progressive || shardCount != 0 || hasDiff || watch)
+        {
+            cerr << "--batch cannot be combined with --diff, --shard, "
+                    "--watch or progressive rendering.\n";
+            return 1;
+        }
+        Batch pipeline(args, format, [&](Raytracer &raytracer)
+        {
+            if (hasEye)
+                raytracer.setEye(eye);
+            if (width != 0)
+                raytracer.setResolution(width, height);
+            if (!crop.empty())
+                raytracer.setCrop(crop);
+            if (cropFull)
+                raytracer.setCropFullFrame(true);
+            if (!tileCache.empty())
+                raytracer.setTileCache(tileCache, uint64_t(tileCacheSize) << 20);
+        });
+        bool rendered = pipeline.run();
+        if (!TraceLog::write())
+            cerr << "Error: could not write the trace file.\n";
+        return rendered ? 0 : 1;
+    }
+
+    if (args.size() < 1 || args.size() > 2)
+    {
+        usage(argv[0]);
         return 1;
     }
 
+    if (!clientSocket.empty())
+    {
+        if (!tileCache.empty() || shardCount != 0 || hasFrames || watch || stream)
+        {
+            cerr << "--client cannot be combined with --tile-cache, --shard, "
+                    "--frames, --watch or --stream.\n";
+            return 1;
+        }
+        // the server may run in another directory
+        json request = {{"scene", absolutePath(args[0])}};
+        if (args.size() >= 2)
+            request["output"] = absolutePath(args[1]);
+        if (hasEye)
+            request["eye"] = {eye.x, eye.y, eye.z};
+        if (hasDiff)
+            request["diff"] = diff;
+        if (width != 0)
+            request["resolution"] = {width, height};
+        if (!crop.empty())
+            request["crop"] = {crop.x, crop.y, crop.width, crop.height};
+        if (cropFull)
+            request["crop_full"] = true;
+        if (!format.empty())
+            request["format"] = format;
+        if (progressive)
+            request["progressive"] = true;
+        if (samples != 0)
+            request["samples"] = samples;
+        if (timeBudget > 0)
+            request["time_budget"] = timeBudget;
+        if (snapshotInterval > 0)
+            request["snapshot_every"] = snapshotInterval;
+        if (checkpointInterval > 0)
+            request["checkpoint_every"] = checkpointInterval;
+        if (resume)
+            request["resume"] = true;
+        return runClient(clientSocket, request);
+    }
+
     // determine output name
     string ofname;
-    if (argc >= 3)
+    if (args.size() >= 2)
     {
-        ofname = argv[2];   // use the provided name
+        ofname = args[1];   // use the provided name
     }
     else
     {
-        ofname = argv[1];   // replace .json with .png
+        ofname = args[0];   // replace .json with .png (or the --format)
         ofname.erase(ofname.begin() + ofname.find_last_of('.'), ofname.end());
-        ofname += ".png";
+        if (shardCount != 0)
+            ofname += ".shard" + to_string(shardIndex);
+        else
+            ofname += format.empty() ? ".png" : "." + format;
+    }
+
+    if (watch)
+    {
+        if (!crop.empty() || cropFull || progressive || hasDiff)
+        {
+            cerr << "--watch always renders the whole frame, it cannot be "
+                    "combined with --crop, --diff or progressive rendering.\n";
+            return 1;
+        }
+        Watcher watcher(args[0], ofname, format, [&](Raytracer &raytracer)
+        {
+            if (hasEye)
+                raytracer.setEye(eye);
+            if (width != 0)
+                raytracer.setResolution(width, height);
+        });
+        bool watched = watcher.run();
+        if (!TraceLog::write())
+            cerr << "Error: could not write the trace file.\n";
+        return watched ? 0 : 1;
+    }
+
+    Raytracer raytracer;
+    if (stream)
+        raytracer.setStreamThreshold(0);
+
+    // read the scene
+    if (!(hasDiff ? raytracer.readScene(args[0], diff)
+                  : raytracer.readScene(args[0])))
+    {
+        cerr << "Error: reading scene from " << args[0] <<
+            " failed - no output generated.\n";
+        TraceLog::write();
+        return 1;
     }
 
-    raytracer.renderToFile(ofname);
+    // command line settings override the scene file
+    if (hasEye)
+        raytracer.setEye(eye);
+    if (width != 0)
+        raytracer.setResolution(width, height);
+    if (!crop.empty())
+        raytracer.setCrop(crop);
+    if (cropFull)
+        raytracer.setCropFullFrame(true);
+    if (!format.empty())
+        raytracer.setOutputFormat(format);
+    if (progressive)
+        raytracer.setProgressive(true);
+    if (samples != 0)
+        raytracer.setSampleTarget(samples);
+    if (timeBudget > 0)
+        raytracer.setTimeBudget(timeBudget);
+    if (snapshotInterval > 0)
+        raytracer.setSnapshotInterval(snapshotInterval);
+    if (checkpointInterval > 0)
+        raytracer.setCheckpointInterval(checkpointInterval);
+    if (resume)
+        raytracer.setResume(true);
+    if (!tileCache.empty())
+        raytracer.setTileCache(tileCache, uint64_t(tileCacheSize) << 20);
+    if (shardCount != 0)
+        raytracer.setShard(shardIndex, shardCount);
+    if (hasFrames)
+    {
+        if (!raytracer.isAnimated())
+            cout << "Note: --frames is ignored, the scene is not animated.\n";
+        raytracer.setFrameRange(firstFrame, lastFrame);
+    }
+
+    bool rendered = raytracer.renderToFile(ofname);
+
+    if (!TraceLog::write())
+        cerr << "Error: could not write the trace file.\n";
 
-    return 0;
+    return rendered ? 0 : 1;
 }
@@ -0,0 +1,100 @@
+#include "mappedfile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile(string const &filename, size_t size)
+:
+    d_size(size)
+{
+    d_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (d_fd < 0)
+        throw runtime_error("Could not create " + filename + ": "
+                            + strerror(errno));
+
+    // the blocks are allocated now: a sparse file would raise SIGBUS on
+    // a write through the mapping once the disk is full
+    int error = size == 0 ? EOPNOTSUPP : posix_fallocate(d_fd, 0, size);
+    if (error == EOPNOTSUPP)    // the file system cannot, sparse it is
+        error = ftruncate(d_fd, size) == 0 ? 0 : errno;
+    if (error != 0)
+    {
+        close(d_fd);
+        throw runtime_error("Could not resize " + filename + ": "
+                            + strerror(error));
+    }
+
+    if (size == 0)
+        return;     // nothing to map
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      d_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        int error = errno;
+        close(d_fd);
+        throw runtime_error("Could not map " + filename + ": "
+                            + strerror(error));
+    }
+    d_data = static_cast<char *>(data);
+}
+
+MappedFile::MappedFile(string const &filename)
+{
+    d_fd = open(filename.c_str(), O_RDONLY);
+    if (d_fd < 0)
+        throw runtime_error("Could not open " + filename + ": "
+                            + strerror(errno));
+
+    struct stat info;
+    if (fstat(d_fd, &info) != 0)
+    {
+        int error = errno;
+        close(d_fd);
+        throw runtime_error("Could not stat " + filename + ": "
+                            + strerror(error));
+    }
+    d_size = info.st_size;
+
+    if (d_size == 0)
+        return;
+    void *data = mmap(nullptr, d_size, PROT_READ, MAP_PRIVATE, d_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        int error = errno;
+        close(d_fd);
+        throw runtime_error("Could not map " + filename + ": "
+                            + strerror(error));
+    }
+    d_data = static_cast<char *>(data);
+}
+
+MappedFile::~MappedFile()
+{
+    if (d_data)
+        munmap(d_data, d_size);
+    if (d_fd >= 0)
+        close(d_fd);
+}
+
+char *MappedFile::data()
+{
+    return d_data;
+}
+
+char const *MappedFile::data() const
+{
+    return d_data;
+}
+
+size_t MappedFile::size() const
+{
+    return d_size;
+}
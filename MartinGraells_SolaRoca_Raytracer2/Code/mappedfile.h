@@ -0,0 +1,33 @@
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <cstddef>
+#include <string>
+
+// A file mapped into memory (POSIX mmap). Writes go straight into the page
+// cache, there is no intermediate buffer; reading only touches the pages
+// that are used. Throws a runtime_error if the file cannot be created,
+// opened or mapped.
+class MappedFile
+{
+    int d_fd = -1;
+    char *d_data = nullptr;
+    size_t d_size = 0;
+
+    public:
+        // creates (or truncates) filename with the given size, writable.
+        // The space is allocated up front, so a full disk throws here.
+        MappedFile(std::string const &filename, size_t size);
+        // maps an existing file, read only
+        explicit MappedFile(std::string const &filename);
+        ~MappedFile();
+
+        MappedFile(MappedFile const &) = delete;
+        MappedFile &operator=(MappedFile const &) = delete;
+
+        char *data();
+        char const *data() const;
+        size_t size() const;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include "meshdata.h"
+
+#include "hash.h"
+#include "mappedfile.h"
+#include "simplifier.h"
+#include "tracelog.h"
+#include "shapes/triangle.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+uint32_t const MeshData::version;
+unsigned const MeshData::maxLevels;
+size_t const MeshData::minLevelTriangles;
+
+namespace
+{
+    char const magic[8] = {'R', 'A', 'Y', 'M', 'E', 'S', 'H', '1'};
+    uint32_t const byteOrderMark = 0x01020304;
+    uint64_t const alignment = 64;
+
+    struct LevelRecord
+    {
+        double error;
+        uint64_t numTriangles;
+        uint64_t trianglesOffset;
+        uint64_t numNodes;
+        uint64_t nodesOffset;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        // the model the cache was built from
+        uint64_t modelSize;
+        int64_t modelSeconds;       // modification time
+        int64_t modelNanoseconds;
+        uint64_t modelHash;
+        double scale;
+        double translate[3];
+        uint32_t quality;           // BVH::Quality
+        uint32_t unused;
+        double lower[3];
+        double upper[3];
+        uint32_t numLevels;
+        uint32_t unused2;
+        LevelRecord levels[MeshData::maxLevels];
+    };
+
+    uint64_t aligned(uint64_t offset)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    Point point(double const *coords)
+    {
+        return Point(coords[0], coords[1], coords[2]);
+    }
+
+    bool stampOf(string const &model, struct stat &info)
+    {
+        return stat(model.c_str(), &info) == 0;
+    }
+}
+
+MeshData::MeshData(vector<Vertex> const &vertices, double scale,
+                   Point const &translate, BVH::Quality quality)
+:
+    d_quality(quality)
+{
+    vector<MeshTriangle> triangles;
+    triangles.reserve(vertices.size() / 3);
+    for (size_t idx = 0; idx + 2 < vertices.size(); idx += 3)
+    {
+        MeshTriangle triangle = {};
+        for (unsigned corner = 0; corner != 3; ++corner)
+        {
+            Vertex const &vertex = vertices[idx + corner];
+            Point p = Point(vertex.x, vertex.y, vertex.z) * scale + translate;
+            for (unsigned axis = 0; axis != 3; ++axis)
+                triangle.vertex[corner][axis] = p.data[axis];
+            d_bounds.extend(p);
+        }
+        triangle.index = triangles.size();
+        triangles.push_back(triangle);
+    }
+
+    // so rounding in the box test cannot reject a hit on its surface
+    if (!d_bounds.empty())
+    {
+        double margin = 1e-6 * (d_bounds.upper - d_bounds.lower).length() + 1e-9;
+        d_bounds = d_bounds.expanded(Vector(margin, margin, margin));
+    }
+
+    // the vectors move into d_own*, their storage stays in place
+    d_ownTriangles.reserve(maxLevels);
+    d_ownNodes.reserve(maxLevels);
+    addLevel(triangles, 0.0);
+    vector<Simplifier::Level> coarser;
+    {
+        TraceScope scope("simplify mesh");
+        coarser = Simplifier::levels(triangles, maxLevels - 1, minLevelTriangles);
+    }
+    for (Simplifier::Level const &level : coarser)
+        addLevel(level.triangles, level.error);
+}
+
+void MeshData::addLevel(vector<MeshTriangle> const &triangles, double error)
+{
+    vector<AABB> boxes;
+    boxes.reserve(triangles.size());
+    for (MeshTriangle const &triangle : triangles)
+    {
+        AABB box;
+        for (unsigned corner = 0; corner != 3; ++corner)
+            box.extend(point(triangle.vertex[corner]));
+        boxes.push_back(box);
+    }
+
+    vector<BVHNode> binary;
+    vector<uint32_t> order;
+    BVH::build(boxes, binary, order, d_quality);
+    vector<MeshTriangle> ordered;
+    ordered.reserve(triangles.size());
+    for (uint32_t idx : order)
+        ordered.push_back(triangles[idx]);
+    vector<WideNode> nodes;
+    WideBVH::collapse(binary, nodes);
+
+    // nodes start on a cache line, as they do in the cache file
+    size_t bytes = nodes.size() * sizeof(WideNode);
+    vector<unsigned char> storage(bytes + alignment);
+    void *start = storage.data();
+    size_t space = storage.size();
+    align(alignment, bytes, start, space);
+    if (bytes != 0)
+        memcpy(start, nodes.data(), bytes);
+
+    d_levels.push_back(Level{ordered.data(), static_cast<WideNode const *>(start),
+                             ordered.size(), nodes.size(), error});
+    d_ownTriangles.push_back(move(ordered));
+    d_ownNodes.push_back(move(storage));
+}
+
+MeshData::MeshData(shared_ptr<MappedFile const> const &file)
+:
+    d_file(file)
+{
+    Header const &header = *reinterpret_cast<Header const *>(file->data());
+    for (unsigned idx = 0; idx != header.numLevels; ++idx)
+    {
+        LevelRecord const &level = header.levels[idx];
+        d_levels.push_back(Level{
+            reinterpret_cast<MeshTriangle const *>(file->data() + level.trianglesOffset),
+            reinterpret_cast<WideNode const *>(file->data() + level.nodesOffset),
+            level.numTriangles, level.numNodes, level.error});
+    }
+    d_bounds = AABB(point(header.lower), point(header.upper));
+    d_quality = static_cast<BVH::Quality>(header.quality);
+}
+
+string MeshData::cacheName(string const &model, double scale,
+                           Point const &translate, BVH::Quality quality)
+{
+    Hash key;
+    key.add(scale).add(translate.x).add(translate.y).add(translate.z);
+    key.add(static_cast<uint64_t>(quality));
+    return model + '.' + Hash::hex(key.value()) + ".meshcache";
+}
+
+shared_ptr<MeshData const> MeshData::load(string const &model, double scale,
+                                          Point const &translate,
+                                          BVH::Quality quality)
+{
+    shared_ptr<MappedFile const> file;
+    try
+    {
+        file = make_shared<MappedFile const>(cacheName(model, scale, translate,
+                                                           quality));
+    }
+    catch (exception const &)
+    {
+        return nullptr;     // no cache yet
+    }
+
+    uint64_t size = file->size();
+    if (size < sizeof(Header))
+        return nullptr;
+    Header const &header = *reinterpret_cast<Header const *>(file->data());
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0
+        || header.version != version || header.byteOrder != byteOrderMark
+        || header.scale != scale || header.translate[0] != translate.x
+        || header.translate[1] != translate.y || header.translate[2] != translate.z
+        || header.quality != static_cast<uint32_t>(quality)
+        || header.numLevels == 0 || header.numLevels > maxLevels)
+        return nullptr;
+    for (unsigned idx = 0; idx != header.numLevels; ++idx)
+    {
+        LevelRecord const &level = header.levels[idx];
+        if (level.trianglesOffset % 8 != 0 || level.nodesOffset % alignment != 0
+            || level.trianglesOffset > size || level.nodesOffset > size
+            || level.numTriangles > (size - level.trianglesOffset) / sizeof(MeshTriangle)
+            || level.numNodes > (size - level.nodesOffset) / sizeof(WideNode)
+            || (level.numNodes == 0) != (level.numTriangles == 0)
+            || !(level.error >= 0.0))
+            return nullptr;
+    }
+
+    // an unchanged model only needs a stat, a touched one is hashed
+    struct stat info;
+    if (!stampOf(model, info))
+        return nullptr;
+    if (static_cast<uint64_t>(info.st_size) != header.modelSize
+        || info.st_mtim.tv_sec != header.modelSeconds
+        || info.st_mtim.tv_nsec != header.modelNanoseconds)
+    {
+        uint64_t hash;
+        if (!Hash::ofFile(model, hash) || hash != header.modelHash)
+            return nullptr;
+    }
+
+    // a damaged tree could send traversal out of the arrays, or too deep
+    // for its stack
+    for (unsigned idx = 0; idx != header.numLevels; ++idx)
+    {
+        LevelRecord const &level = header.levels[idx];
+        WideNode const *nodes = reinterpret_cast<WideNode const *>(file->data()
+                                                                   + level.nodesOffset);
+        if (!WideBVH::valid(nodes, level.numNodes, level.numTriangles))
+            return nullptr;
+    }
+    return shared_ptr<MeshData const>(new MeshData(file));
+}
+
+bool MeshData::save(string const &model, double scale, Point const &translate) const
+{
+    Header header = {};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byteOrder = byteOrderMark;
+
+    struct stat info;
+    if (!stampOf(model, info) || !Hash::ofFile(model, header.modelHash))
+        return false;
+    header.modelSize = info.st_size;
+    header.modelSeconds = info.st_mtim.tv_sec;
+    header.modelNanoseconds = info.st_mtim.tv_nsec;
+    header.scale = scale;
+    header.quality = d_quality;
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        header.translate[axis] = translate.data[axis];
+        header.lower[axis] = d_bounds.lower.data[axis];
+        header.upper[axis] = d_bounds.upper.data[axis];
+    }
+    header.numLevels = d_levels.size();
+    uint64_t offset = sizeof(Header);
+    for (unsigned idx = 0; idx != d_levels.size(); ++idx)
+    {
+        LevelRecord &level = header.levels[idx];
+        level.error = d_levels[idx].error;
+        level.numTriangles = d_levels[idx].numTriangles;
+        level.trianglesOffset = aligned(offset);
+        level.numNodes = d_levels[idx].numNodes;
+        level.nodesOffset = aligned(level.trianglesOffset
+                                    + level.numTriangles * sizeof(MeshTriangle));
+        offset = level.nodesOffset + level.numNodes * sizeof(WideNode);
+    }
+
+    // renamed into place, readers never see half a file
+    string filename = cacheName(model, scale, translate, d_quality);
+    string tmpname = filename + ".tmp";
+    ofstream out(tmpname, ios::binary | ios::trunc);
+    if (!out)
+        return false;
+    char const zeros[alignment] = {};
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    offset = sizeof(header);
+    for (unsigned idx = 0; idx != d_levels.size(); ++idx)
+    {
+        LevelRecord const &level = header.levels[idx];
+        out.write(zeros, level.trianglesOffset - offset);
+        out.write(reinterpret_cast<char const *>(d_levels[idx].triangles),
+                  level.numTriangles * sizeof(MeshTriangle));
+        out.write(zeros, level.nodesOffset - level.trianglesOffset
+                         - level.numTriangles * sizeof(MeshTriangle));
+        out.write(reinterpret_cast<char const *>(d_levels[idx].nodes),
+                  level.numNodes * sizeof(WideNode));
+        offset = level.nodesOffset + level.numNodes * sizeof(WideNode);
+    }
+    out.close();
+    if (!out || rename(tmpname.c_str(), filename.c_str()) != 0)
+    {
+        remove(tmpname.c_str());
+        return false;
+    }
+    return true;
+}
+
+Hit MeshData::intersect(Ray const &ray) const
+{
+    // most rays miss the mesh entirely
+    if (!d_bounds.intersects(ray))
+        return Hit::NO_HIT();
+
+    Level const &level = levelFor(ray);
+    double nearest = numeric_limits<double>::infinity();
+    MeshTriangle const *closest = nullptr;
+    WideBVH::traverse(level.nodes, level.numNodes, ray, nearest, [&](uint32_t idx)
+    {
+        MeshTriangle const &triangle = level.triangles[idx];
+        double const (*v)[3] = triangle.vertex;
+        double t = Triangle::distance(point(v[0]), point(v[1]), point(v[2]), ray);
+        if (t < nearest || (t == nearest && triangle.index < closest->index))
+        {
+            nearest = t;
+            closest = &triangle;
+        }
+    });
+    if (!closest)
+        return Hit::NO_HIT();
+    double const (*v)[3] = closest->vertex;
+    return Hit(nearest, Triangle::normal(point(v[0]), point(v[1]), point(v[2]), ray));
+}
+
+AABB MeshData::bounds() const
+{
+    return d_bounds;
+}
+
+uint64_t MeshData::numTriangles() const
+{
+    return d_levels[0].numTriangles;
+}
+
+unsigned MeshData::levels() const
+{
+    return d_levels.size();
+}
+
+MeshData::Level const &MeshData::levelFor(Ray const &ray) const
+{
+    if (ray.width == 0.0 && ray.spread == 0.0)
+        return d_levels[0];
+
+    // the footprint where the ray enters the bounds: the whole mesh is
+    // traced with the detail its nearest part needs
+    double entry = d_bounds.entry(ray);
+    double footprint = ray.width + ray.spread * entry;
+    unsigned idx = 0;
+    while (idx + 1 != d_levels.size() && d_levels[idx + 1].error <= footprint)
+        ++idx;
+    return d_levels[idx];
+}
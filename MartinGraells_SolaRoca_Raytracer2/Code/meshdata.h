@@ -0,0 +1,103 @@
+#ifndef MESHDATA_H_
+#define MESHDATA_H_
+
+#include "aabb.h"
+#include "bvh.h"
+#include "widebvh.h"
+#include "hit.h"
+#include "vertex.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// triangle of a MeshData in world space
+struct MeshTriangle
+{
+    double vertex[3][3];
+    uint32_t index;     // in the model, nearer triangles win ties by index
+    uint32_t unused;
+};
+
+// The triangles of a mesh, scaled and translated into the scene, with
+// their BVH (of the requested quality) collapsed into a WideBVH:
+// everything needed to trace it. Either built from the vertices of a
+// model, or used in place from a mesh cache file, which save() writes next
+// to the model. The cache file records the size, modification time and
+// content hash of the model, load() rejects it once the model changed.
+//
+// Besides the full mesh there are a few coarser levels of detail (see
+// Simplifier), each with its own WideBVH. intersect() traces a ray through
+// the coarsest level whose error still fits in the footprint of the ray
+// where it reaches the mesh (see Ray::width); rays without a footprint
+// always see the full mesh.
+//
+// Mesh cache layout (native byte order): Header, then per level
+// MeshTriangle[] and WideNode[], each starting at a multiple of 64 bytes.
+class MeshData
+{
+    // one level of detail
+    struct Level
+    {
+        MeshTriangle const *triangles;
+        WideNode const *nodes;
+        uint64_t numTriangles;
+        uint64_t numNodes;
+        double error;       // distance to the full mesh, world units
+    };
+
+    std::shared_ptr<MappedFile const> d_file;   // if loaded from a cache
+    // if built, per level: the triangles, and the nodes from a 64 byte
+    // boundary
+    std::vector<std::vector<MeshTriangle>> d_ownTriangles;
+    std::vector<std::vector<unsigned char>> d_ownNodes;
+    std::vector<Level> d_levels;                // finest first
+    AABB d_bounds;
+    BVH::Quality d_quality;
+
+    public:
+        static uint32_t const version = 4;
+        // levels of detail including the full mesh
+        static unsigned const maxLevels = 4;
+        // no level has fewer triangles than this
+        static size_t const minLevelTriangles = 64;
+
+        MeshData(std::vector<Vertex> const &vertices, double scale,
+                 Point const &translate, BVH::Quality quality);
+        MeshData(MeshData const &) = delete;
+        MeshData &operator=(MeshData const &) = delete;
+
+        // name of the cache file of a model with this scale, translation
+        // and BVH quality
+        static std::string cacheName(std::string const &model, double scale,
+                                     Point const &translate,
+                                     BVH::Quality quality);
+
+        // the cache file of model, nullptr if it is missing, damaged or
+        // stale
+        static std::shared_ptr<MeshData const> load(std::string const &model,
+                                                    double scale,
+                                                    Point const &translate,
+                                                    BVH::Quality quality);
+        // writes the cache file, false if it could not be written
+        bool save(std::string const &model, double scale,
+                  Point const &translate) const;
+
+        Hit intersect(Ray const &ray) const;
+        AABB bounds() const;            // slightly grown
+        uint64_t numTriangles() const;  // of the full mesh
+        unsigned levels() const;        // including the full mesh
+
+    private:
+        explicit MeshData(std::shared_ptr<MappedFile const> const &file);
+
+        // builds the BVH of a level and adds it
+        void addLevel(std::vector<MeshTriangle> const &triangles, double error);
+        // the level ray traces
+        Level const &levelFor(Ray const &ray) const;
+};
+
+#endif
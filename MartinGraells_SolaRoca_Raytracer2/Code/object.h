@@ -1,6 +1,7 @@
 #ifndef OBJECT_H_
 #define OBJECT_H_
 
+#include "aabb.h"
 #include "material.h"
 
 // not really needed here, but deriving classes may need them
@@ -19,7 +20,14 @@ class Object
         virtual ~Object() = default;
 
         virtual Hit intersect(Ray const &ray) = 0;
+        // intersects only the primitive that was hit by an earlier ray
+        // (Hit::primitive), for objects made of many primitives
+        virtual Hit intersectPrimitive(Ray const &ray, uint64_t primitive)
+        {
+            return intersect(ray);
+        }
         virtual std::vector<float> UVcoord(Vector v) = 0; //from a coord space, return the UV coord
+        virtual AABB bounds() const = 0; //box containing the whole shape
 };
 
 #endif
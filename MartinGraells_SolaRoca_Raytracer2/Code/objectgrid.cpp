@@ -0,0 +1,172 @@
+#include "objectgrid.h"
+
+#include <cmath>
+
+using namespace std;
+
+uint32_t const ObjectGrid::noChild;
+
+namespace
+{
+    double const density = 2.0;         // cells per object (uniform grid)
+    double const topDensity = 0.125;    // two-level: cells per object on top
+    size_t const crowded = 8;           // two-level: more objects get a grid
+    unsigned const maxCells = 1024;     // per axis
+}
+
+void ObjectGrid::build(vector<AABB> const &boxes, bool twoLevel)
+{
+    d_first.clear();
+    d_objects.clear();
+    d_child.clear();
+    d_children.clear();
+    d_unbounded.clear();
+
+    vector<uint32_t> members;
+    AABB bounds;
+    for (uint32_t idx = 0; idx != boxes.size(); ++idx)
+    {
+        if (boxes[idx].empty())
+            continue;           // cannot be hit
+        if (!boxes[idx].finite())
+        {
+            d_unbounded.push_back(idx);
+            continue;
+        }
+        members.push_back(idx);
+        bounds.extend(boxes[idx]);
+    }
+    if (members.empty())
+        return;
+
+    // objects are grown a little, so a hit found on the boundary of a
+    // cell (with rounding in the walk) belongs to the objects of both
+    d_margin = 1e-6 * (bounds.upper - bounds.lower).length() + 1e-9;
+    bounds = bounds.expanded(Vector(d_margin, d_margin, d_margin));
+    buildCells(boxes, members, bounds, twoLevel ? topDensity : density);
+    if (!twoLevel)
+        return;
+
+    size_t numCells = d_first.size() - 1;
+    d_child.assign(numCells, noChild);
+    for (size_t idx = 0; idx != numCells; ++idx)
+    {
+        if (d_first[idx + 1] - d_first[idx] <= crowded)
+            continue;
+        unsigned x = idx % d_cells[0];
+        unsigned y = idx / d_cells[0] % d_cells[1];
+        unsigned z = idx / d_cells[0] / d_cells[1];
+        Point lower = d_bounds.lower + Vector(x * d_cellSize[0], y * d_cellSize[1],
+                                              z * d_cellSize[2]);
+        Point upper = lower + Vector(d_cellSize[0], d_cellSize[1], d_cellSize[2]);
+
+        ObjectGrid child;
+        child.d_margin = d_margin;
+        child.buildCells(boxes, vector<uint32_t>(d_objects.begin() + d_first[idx],
+                                                 d_objects.begin() + d_first[idx + 1]),
+                         AABB(lower, upper), density);
+        d_child[idx] = d_children.size();
+        d_children.push_back(move(child));
+    }
+}
+
+vector<unsigned> const &ObjectGrid::unbounded() const
+{
+    return d_unbounded;
+}
+
+size_t ObjectGrid::numCells() const
+{
+    size_t cells = d_first.empty() ? 0 : d_first.size() - 1;
+    for (ObjectGrid const &child : d_children)
+        cells += child.numCells();
+    return cells;
+}
+
+size_t ObjectGrid::numReferences() const
+{
+    size_t references = d_objects.size();
+    for (ObjectGrid const &child : d_children)
+        references += child.numReferences();
+    return references;
+}
+
+void ObjectGrid::buildCells(vector<AABB> const &boxes, vector<uint32_t> const &members,
+                            AABB const &bounds, double density)
+{
+    d_bounds = bounds;
+
+    // cubic cells, about density per member. Axes thinner than a cell
+    // get a single one and leave the cells to the other axes.
+    Vector size = bounds.upper - bounds.lower;
+    bool thin[3] = {false, false, false};
+    double cell = 0.0;
+    for (unsigned pass = 0; pass != 3; ++pass)
+    {
+        double volume = 1.0;
+        unsigned dims = 0;
+        for (unsigned axis = 0; axis != 3; ++axis)
+            if (!thin[axis])
+            {
+                volume *= size.data[axis];
+                ++dims;
+            }
+        if (dims == 0)
+            break;
+        cell = pow(volume / (density * members.size()), 1.0 / dims);
+        bool changed = false;
+        for (unsigned axis = 0; axis != 3; ++axis)
+            if (!thin[axis] && size.data[axis] < cell)
+                thin[axis] = changed = true;
+        if (!changed)
+            break;
+    }
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        double cells = thin[axis] || !(cell > 0) ? 1.0 : ceil(size.data[axis] / cell);
+        d_cells[axis] = min(maxCells, max(1u, static_cast<unsigned>(min(cells, 1e9))));
+        d_cellSize[axis] = size.data[axis] / d_cells[axis];
+    }
+
+    // count the objects of every cell, then list them
+    size_t numCells = size_t(d_cells[0]) * d_cells[1] * d_cells[2];
+    d_first.assign(numCells + 1, 0);
+    auto forCells = [&](uint32_t member, auto const &apply)
+    {
+        AABB const &box = boxes[member];
+        unsigned from[3];
+        unsigned to[3];
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            from[axis] = cellOf(axis, box.lower.data[axis] - d_margin);
+            to[axis] = cellOf(axis, box.upper.data[axis] + d_margin);
+        }
+        for (unsigned z = from[2]; z <= to[2]; ++z)
+            for (unsigned y = from[1]; y <= to[1]; ++y)
+                for (unsigned x = from[0]; x <= to[0]; ++x)
+                    apply((size_t(z) * d_cells[1] + y) * d_cells[0] + x);
+    };
+    for (uint32_t member : members)
+        forCells(member, [&](size_t idx)
+        {
+            ++d_first[idx + 1];
+        });
+    for (size_t idx = 0; idx != numCells; ++idx)
+        d_first[idx + 1] += d_first[idx];
+
+    d_objects.resize(d_first[numCells]);
+    vector<uint32_t> next(d_first.begin(), d_first.end() - 1);
+    for (uint32_t member : members)
+        forCells(member, [&](size_t idx)
+        {
+            d_objects[next[idx]++] = member;
+        });
+}
+
+unsigned ObjectGrid::cellOf(unsigned axis, double coord) const
+{
+    double pos = (coord - d_bounds.lower.data[axis]) / d_cellSize[axis];
+    if (!(pos > 0))
+        return 0;       // also for a cell size of 0
+    return min(d_cells[axis] - 1, static_cast<unsigned>(min(pos, 4e9)));
+}
@@ -0,0 +1,169 @@
+#ifndef OBJECTGRID_H_
+#define OBJECTGRID_H_
+
+#include "aabb.h"
+#include "ray.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Grid over the objects of a scene, built with two passes over their
+// boxes. A cell lists the objects whose box touches it. Rays walk the
+// cells they cross in order (3D-DDA), so the walk can stop at the first
+// cell that ends behind the nearest hit found so far. An object is listed
+// in every cell it touches; callers skip the objects they already tested
+// for the same ray (mailboxing).
+//
+// The two-level grid is coarse, and its cells with many objects get a
+// finer grid of their own, which copes better with dense clusters in a
+// large, mostly empty scene.
+class ObjectGrid
+{
+    AABB d_bounds;
+    unsigned d_cells[3] = {0, 0, 0};
+    double d_cellSize[3] = {0.0, 0.0, 0.0};
+    double d_margin = 0.0;              // objects are grown by this
+    // cell c lists d_objects[d_first[c], d_first[c + 1])
+    std::vector<uint32_t> d_first;
+    std::vector<uint32_t> d_objects;
+    // two-level: per cell its grid in d_children, or noChild
+    std::vector<uint32_t> d_child;
+    std::vector<ObjectGrid> d_children;
+    std::vector<unsigned> d_unbounded;
+
+    public:
+        // boxes[idx]: bounds of object idx. Objects with empty boxes are
+        // left out, those with infinite boxes are listed in unbounded().
+        void build(std::vector<AABB> const &boxes, bool twoLevel);
+
+        // objects that are not in the grid, to be tested for every ray
+        std::vector<unsigned> const &unbounded() const;
+
+        size_t numCells() const;        // including those of finer grids
+        size_t numReferences() const;   // objects listed in the cells
+
+        // calls visit(objects, count, tExit) for the cells the ray crosses
+        // between distances tMin and tMax, nearest first, until visit
+        // returns true. The ray leaves the cell at tExit. Returns whether
+        // visit did.
+        template <typename Visit>
+        bool traverse(Ray const &ray, double tMin, double tMax,
+                      Visit const &visit) const;
+
+    private:
+        static uint32_t const noChild = ~0u;
+
+        // about density cells per member, lists the members of each cell
+        void buildCells(std::vector<AABB> const &boxes,
+                        std::vector<uint32_t> const &members,
+                        AABB const &bounds, double density);
+
+        // the cell along axis that holds coord, clamped to the grid
+        unsigned cellOf(unsigned axis, double coord) const;
+
+        // walks the cells between t0 and t1, the ray clipped to the bounds
+        template <typename Visit>
+        bool walk(Ray const &ray, double t0, double t1,
+                  Visit const &visit) const;
+};
+
+template <typename Visit>
+bool ObjectGrid::traverse(Ray const &ray, double tMin, double tMax,
+                          Visit const &visit) const
+{
+    if (d_first.empty())
+        return false;
+
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        double origin = ray.O.data[axis];
+        double dir = ray.D.data[axis];
+        double lower = d_bounds.lower.data[axis];
+        double upper = d_bounds.upper.data[axis];
+        if (dir == 0.0)
+        {
+            if (origin < lower || origin > upper)
+                return false;
+            continue;
+        }
+        double t1 = (lower - origin) / dir;
+        double t2 = (upper - origin) / dir;
+        tMin = std::max(tMin, std::min(t1, t2));
+        tMax = std::min(tMax, std::max(t1, t2));
+    }
+    if (!(tMin <= tMax))
+        return false;       // also if tMax is not a number
+    return walk(ray, tMin, tMax, visit);
+}
+
+template <typename Visit>
+bool ObjectGrid::walk(Ray const &ray, double t0, double t1,
+                      Visit const &visit) const
+{
+    double const inf = std::numeric_limits<double>::infinity();
+    Point start = ray.at(t0);
+    int cell[3];
+    int step[3];
+    int limit[3];           // first cell past the grid in the direction
+    double tNext[3];        // where the ray enters the next cell
+    double tDelta[3];       // distance across a cell
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        cell[axis] = cellOf(axis, start.data[axis]);
+        double origin = ray.O.data[axis];
+        double dir = ray.D.data[axis];
+        double lower = d_bounds.lower.data[axis];
+        double size = d_cellSize[axis];
+        if (dir > 0)
+        {
+            step[axis] = 1;
+            limit[axis] = d_cells[axis];
+            tNext[axis] = (lower + (cell[axis] + 1) * size - origin) / dir;
+            tDelta[axis] = size / dir;
+        }
+        else if (dir < 0)
+        {
+            step[axis] = -1;
+            limit[axis] = -1;
+            tNext[axis] = (lower + cell[axis] * size - origin) / dir;
+            tDelta[axis] = -size / dir;
+        }
+        else
+        {
+            step[axis] = 0;
+            limit[axis] = -1;
+            tNext[axis] = inf;
+            tDelta[axis] = inf;
+        }
+    }
+
+    double tEnter = t0;
+    while (true)
+    {
+        unsigned axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2)
+                                            : (tNext[1] < tNext[2] ? 1 : 2);
+        double tExit = std::min(tNext[axis], t1);
+        size_t idx = (size_t(cell[2]) * d_cells[1] + cell[1]) * d_cells[0] + cell[0];
+        if (!d_child.empty() && d_child[idx] != noChild)
+        {
+            if (d_children[d_child[idx]].walk(ray, tEnter, tExit, visit))
+                return true;
+        }
+        else if (d_first[idx] != d_first[idx + 1]
+                 && visit(&d_objects[d_first[idx]], d_first[idx + 1] - d_first[idx],
+                          tExit))
+            return true;
+
+        if (tNext[axis] >= t1)
+            return false;
+        cell[axis] += step[axis];
+        if (cell[axis] == limit[axis])
+            return false;
+        tEnter = tNext[axis];
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "objloader.h"
+#include "tracelog.h"
 
 // Pro C++ Tip: here you can specify other includes you may need
 // such as <iostream>
@@ -19,6 +20,7 @@ OBJLoader::OBJLoader(string const &filename)
 :
     d_hasTexCoords(false)
 {
+    TraceScope scope("load OBJ", filename);
     parseFile(filename);
 }
 
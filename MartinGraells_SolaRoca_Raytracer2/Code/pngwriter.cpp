@@ -0,0 +1,461 @@
+#include "pngwriter.h"
+
+#include "image.h"
+#include "tracelog.h"
+
+#include "lode/lodepng.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    size_t const stripeBytes = 1 << 18;     // raw bytes per stripe (about)
+
+    // --- deflate with the fixed Huffman codes ----------------------------
+
+    unsigned const lengthBase[29] =
+        {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+         59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    unsigned const lengthExtra[29] =
+        {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,
+         4, 5, 5, 5, 5, 0};
+    unsigned const distBase[30] =
+        {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+         513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+         24577};
+    unsigned const distExtra[30] =
+        {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+         10, 11, 11, 12, 12, 13, 13};
+
+    unsigned const windowSize = 32768;
+    unsigned const hashBits = 15;
+    unsigned const maxChain = 64;       // candidates tried per position
+    unsigned const minMatch = 3;
+    unsigned const maxMatch = 258;
+
+    // packs bits LSB first, as deflate requires
+    class BitWriter
+    {
+        vector<unsigned char> &d_out;
+        uint32_t d_bits = 0;
+        unsigned d_count = 0;
+
+        public:
+            explicit BitWriter(vector<unsigned char> &out)
+            :
+                d_out(out)
+            {}
+
+            void put(uint32_t bits, unsigned count)     // count <= 24
+            {
+                d_bits |= bits << d_count;
+                d_count += count;
+                while (d_count >= 8)
+                {
+                    d_out.push_back(d_bits & 0xff);
+                    d_bits >>= 8;
+                    d_count -= 8;
+                }
+            }
+
+            // Huffman codes are stored most significant bit first
+            void putCode(uint32_t code, unsigned length)
+            {
+                uint32_t reversed = 0;
+                for (unsigned idx = 0; idx != length; ++idx)
+                    reversed |= ((code >> idx) & 1) << (length - 1 - idx);
+                put(reversed, length);
+            }
+
+            void align()
+            {
+                if (d_count > 0)
+                    put(0, 8 - d_count);
+            }
+    };
+
+    void putSymbol(BitWriter &bits, unsigned symbol)
+    {
+        if (symbol < 144)
+            bits.putCode(0x30 + symbol, 8);
+        else if (symbol < 256)
+            bits.putCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+            bits.putCode(symbol - 256, 7);
+        else
+            bits.putCode(0xc0 + symbol - 280, 8);
+    }
+
+    void putMatch(BitWriter &bits, unsigned length, unsigned distance)
+    {
+        unsigned lcode = upper_bound(lengthBase, lengthBase + 29, length)
+                         - lengthBase - 1;
+        putSymbol(bits, 257 + lcode);
+        bits.put(length - lengthBase[lcode], lengthExtra[lcode]);
+
+        unsigned dcode = upper_bound(distBase, distBase + 30, distance)
+                         - distBase - 1;
+        bits.putCode(dcode, 5);
+        bits.put(distance - distBase[dcode], distExtra[dcode]);
+    }
+
+    // Appends one fixed Huffman block (BFINAL = 0) holding in, followed by
+    // an empty stored block, which byte aligns the stream (a sync flush).
+    void deflateStripe(vector<unsigned char> const &in,
+                       vector<unsigned char> &out)
+    {
+        BitWriter bits(out);
+        bits.put(0, 1);     // not the final block
+        bits.put(1, 2);     // fixed Huffman codes
+
+        size_t const size = in.size();
+        vector<int> head(1 << hashBits, -1);
+        vector<int> prev(windowSize, -1);
+        auto hash = [&](size_t pos)
+        {
+            return ((in[pos] << 10) ^ (in[pos + 1] << 5) ^ in[pos + 2])
+                   & ((1 << hashBits) - 1);
+        };
+        auto insert = [&](size_t pos)
+        {
+            if (pos + minMatch > size)
+                return;
+            unsigned h = hash(pos);
+            prev[pos % windowSize] = head[h];
+            head[h] = pos;
+        };
+
+        size_t pos = 0;
+        while (pos < size)
+        {
+            unsigned bestLength = 0;
+            unsigned bestDistance = 0;
+            if (pos + minMatch <= size)
+            {
+                unsigned limit = min<size_t>(maxMatch, size - pos);
+                int candidate = head[hash(pos)];
+                for (unsigned chain = 0; candidate >= 0 && chain != maxChain
+                     && pos - candidate <= windowSize; ++chain)
+                {
+                    if (in[candidate + bestLength] == in[pos + bestLength])
+                    {
+                        unsigned length = 0;
+                        while (length < limit
+                               && in[candidate + length] == in[pos + length])
+                            ++length;
+                        if (length > bestLength)
+                        {
+                            bestLength = length;
+                            bestDistance = pos - candidate;
+                            if (length == limit)
+                                break;
+                        }
+                    }
+                    candidate = prev[candidate % windowSize];
+                }
+            }
+
+            if (bestLength >= minMatch)
+            {
+                putMatch(bits, bestLength, bestDistance);
+                for (unsigned idx = 0; idx != bestLength; ++idx)
+                    insert(pos + idx);
+                pos += bestLength;
+            }
+            else
+            {
+                putSymbol(bits, in[pos]);
+                insert(pos);
+                ++pos;
+            }
+        }
+        putSymbol(bits, 256);   // end of block
+
+        bits.put(0, 3);         // empty stored block, not final
+        bits.align();
+        unsigned char const flush[] = {0x00, 0x00, 0xff, 0xff};
+        out.insert(out.end(), flush, flush + 4);
+    }
+
+    // --- checksums -------------------------------------------------------
+
+    uint32_t const adlerBase = 65521;
+
+    uint32_t adler32(vector<unsigned char> const &data)
+    {
+        uint32_t s1 = 1;
+        uint32_t s2 = 0;
+        size_t pos = 0;
+        while (pos != data.size())
+        {
+            // 5552 bytes can be summed before s2 may overflow
+            size_t end = min(data.size(), pos + 5552);
+            for (; pos != end; ++pos)
+            {
+                s1 += data[pos];
+                s2 += s1;
+            }
+            s1 %= adlerBase;
+            s2 %= adlerBase;
+        }
+        return (s2 << 16) | s1;
+    }
+
+    // adler32 of A followed by B, given their checksums and B's length
+    uint32_t adler32Combine(uint32_t adlerA, uint32_t adlerB, size_t lengthB)
+    {
+        uint32_t rem = lengthB % adlerBase;
+        uint32_t s1 = adlerA & 0xffff;
+        uint32_t s2 = (rem * s1) % adlerBase;
+        s1 += (adlerB & 0xffff) + adlerBase - 1;
+        s2 += (adlerA >> 16) + (adlerB >> 16) + adlerBase - rem;
+        if (s1 >= adlerBase)
+            s1 -= adlerBase;
+        if (s1 >= adlerBase)
+            s1 -= adlerBase;
+        if (s2 >= 2 * adlerBase)
+            s2 -= 2 * adlerBase;
+        if (s2 >= adlerBase)
+            s2 -= adlerBase;
+        return (s2 << 16) | s1;
+    }
+
+    void putBigEndian(vector<unsigned char> &out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((value >> shift) & 0xff);
+    }
+
+    // chunk holds the 4 byte chunk type followed by the chunk data
+    void writeChunk(ostream &out, vector<unsigned char> const &chunk)
+    {
+        vector<unsigned char> length;
+        putBigEndian(length, chunk.size() - 4);
+        vector<unsigned char> crc;
+        putBigEndian(crc, lodepng_crc32(chunk.data(), chunk.size()));
+
+        out.write(reinterpret_cast<char const *>(length.data()), 4);
+        out.write(reinterpret_cast<char const *>(chunk.data()), chunk.size());
+        out.write(reinterpret_cast<char const *>(crc.data()), 4);
+    }
+
+    // --- filtering -------------------------------------------------------
+
+    unsigned char toByte(double value)
+    {
+        if (!(value > 0.0))
+            return 0;
+        if (value >= 1.0)
+            return 255;
+        return static_cast<unsigned char>(value * 255.0);
+    }
+
+    void rowBytes(Image const &img, unsigned y, vector<unsigned char> &row)
+    {
+        for (unsigned x = 0; x != img.width(); ++x)
+        {
+            Color const &pixel = img(x, y);
+            row[3 * x] = toByte(pixel.r);
+            row[3 * x + 1] = toByte(pixel.g);
+            row[3 * x + 2] = toByte(pixel.b);
+        }
+    }
+
+    unsigned char paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a);
+        int pb = abs(p - b);
+        int pc = abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return a;
+        return pb <= pc ? b : c;
+    }
+
+    // Appends the filter type and the filtered row, choosing the filter
+    // with the smallest sum of absolute (signed) differences, like lodepng.
+    void filterRow(vector<unsigned char> const &row,
+                   vector<unsigned char> const &above,
+                   vector<unsigned char> &out)
+    {
+        size_t const size = row.size();
+        size_t const bpp = 3;
+        vector<unsigned char> filtered[5];
+        size_t best = 0;
+        size_t bestSum = ~size_t(0);
+        for (size_t type = 0; type != 5; ++type)
+        {
+            vector<unsigned char> &line = filtered[type];
+            line.resize(size);
+            size_t sum = 0;
+            for (size_t idx = 0; idx != size; ++idx)
+            {
+                int a = idx >= bpp ? row[idx - bpp] : 0;
+                int b = above[idx];
+                int c = idx >= bpp ? above[idx - bpp] : 0;
+                int predict = 0;
+                switch (type)
+                {
+                    case 1: predict = a; break;
+                    case 2: predict = b; break;
+                    case 3: predict = (a + b) / 2; break;
+                    case 4: predict = paeth(a, b, c); break;
+                }
+                line[idx] = static_cast<unsigned char>(row[idx] - predict);
+                sum += line[idx] < 128 ? line[idx] : 256 - line[idx];
+            }
+            if (sum < bestSum)
+            {
+                bestSum = sum;
+                best = type;
+            }
+        }
+        out.push_back(best);
+        out.insert(out.end(), filtered[best].begin(), filtered[best].end());
+    }
+
+    // --- stripes ---------------------------------------------------------
+
+    struct Stripe
+    {
+        vector<unsigned char> chunk;    // "IDAT" + compressed data
+        uint32_t adler = 1;             // of the uncompressed (filtered) data
+        size_t length = 0;
+        bool done = false;
+    };
+
+    void encodeStripe(Image const &img, unsigned first, unsigned last,
+                      Stripe &stripe)
+    {
+        size_t const rowSize = 3 * img.width();
+        vector<unsigned char> above(rowSize, 0);
+        vector<unsigned char> row(rowSize);
+        if (first > 0)
+            rowBytes(img, first - 1, above);
+
+        vector<unsigned char> raw;
+        raw.reserve((rowSize + 1) * (last - first));
+        for (unsigned y = first; y != last; ++y)
+        {
+            rowBytes(img, y, row);
+            filterRow(row, above, raw);
+            swap(row, above);
+        }
+
+        stripe.chunk = {'I', 'D', 'A', 'T'};
+        if (first == 0)
+        {
+            stripe.chunk.push_back(0x78);   // zlib: deflate, 32K window
+            stripe.chunk.push_back(0x01);
+        }
+        deflateStripe(raw, stripe.chunk);
+        stripe.adler = adler32(raw);
+        stripe.length = raw.size();
+    }
+}
+
+bool PngWriter::write(Image const &img, string const &filename,
+                      unsigned threads)
+{
+    ofstream out(filename, ios::binary);
+    if (!out)
+        return false;
+
+    unsigned const width = img.width();
+    unsigned const height = img.height();
+    unsigned const rowsPerStripe =
+        max<size_t>(1, stripeBytes / (3 * size_t(width) + 1));
+    unsigned const numStripes = (height + rowsPerStripe - 1) / rowsPerStripe;
+    if (threads == 0)
+        threads = max(1U, thread::hardware_concurrency());
+    threads = max(1U, min(threads, numStripes));
+    unsigned const inFlight = 2 * threads;  // stripes encoded ahead
+
+    // signature and header
+    unsigned char const signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+    out.write(reinterpret_cast<char const *>(signature), 8);
+    vector<unsigned char> header = {'I', 'H', 'D', 'R'};
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});   // 8 bit RGB
+    writeChunk(out, header);
+
+    vector<Stripe> stripes(numStripes);
+    mutex lock;
+    condition_variable changed;
+    unsigned next = 0;          // next stripe to encode
+    unsigned written = 0;       // stripes written to disk
+
+    auto worker = [&](unsigned id)
+    {
+        TraceLog::setThreadName("png worker " + to_string(id));
+        while (true)
+        {
+            unsigned idx;
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&]()
+                {
+                    return next == numStripes || next < written + inFlight;
+                });
+                if (next == numStripes)
+                    return;
+                idx = next++;
+            }
+
+            Stripe stripe;
+            {
+                TraceScope scope("encode stripe", idx);
+                unsigned first = idx * rowsPerStripe;
+                encodeStripe(img, first, min(height, first + rowsPerStripe),
+                             stripe);
+            }
+
+            lock_guard<mutex> guard(lock);
+            stripes[idx] = move(stripe);
+            stripes[idx].done = true;
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (unsigned id = 0; id != threads; ++id)
+        workers.emplace_back(worker, id + 1);
+
+    // write the stripes in order as they complete
+    uint32_t adler = 1;
+    for (unsigned idx = 0; idx != numStripes; ++idx)
+    {
+        Stripe stripe;
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&]() { return stripes[idx].done; });
+            stripe = move(stripes[idx]);
+            stripes[idx].chunk = vector<unsigned char>();   // release memory
+            written = idx + 1;
+            changed.notify_all();
+        }
+        writeChunk(out, stripe.chunk);
+        adler = adler32Combine(adler, stripe.adler, stripe.length);
+    }
+    for (thread &worker : workers)
+        worker.join();
+
+    // final empty block and checksum
+    vector<unsigned char> last = {'I', 'D', 'A', 'T', 0x03, 0x00};
+    putBigEndian(last, adler);
+    writeChunk(out, last);
+    writeChunk(out, vector<unsigned char>{'I', 'E', 'N', 'D'});
+
+    return static_cast<bool>(out.flush());
+}
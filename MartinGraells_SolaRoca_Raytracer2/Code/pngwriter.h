@@ -0,0 +1,26 @@
+#ifndef PNGWRITER_H_
+#define PNGWRITER_H_
+
+#include <string>
+
+class Image;
+
+// PNG encoder for large frames. The image is cut into horizontal stripes
+// that are converted to bytes, filtered and deflated independently on
+// several threads; every stripe ends with a sync flush so the compressed
+// stripes simply concatenate into one zlib stream. Stripes are written to
+// disk in order as soon as they are done, so at most a few stripes of
+// bytes are held in memory instead of a full RGBA copy of the frame.
+//
+// Compression uses LZ77 with the fixed Huffman codes, which is quicker
+// but compresses a little less than lodepng's dynamic codes.
+class PngWriter
+{
+    public:
+        // returns false if the file could not be written. threads == 0
+        // uses one thread per core.
+        static bool write(Image const &img, std::string const &filename,
+                          unsigned threads = 0);
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "progressive.h"
+
+#include "image.h"
+#include "scene.h"
+#include "tracelog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>       // rename
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+Progressive::Progressive(Scene &scene, Region const &region,
+                         unsigned samples, unsigned blockSize)
+:
+    d_scene(scene),
+    d_region(region),
+    d_samples(max(samples, 1U)),
+    d_grid(static_cast<unsigned>(ceil(sqrt(d_samples)))),
+    d_blockSize(1),
+    d_levels(1),
+    d_sum(region.width * region.height),
+    d_count(region.width * region.height, 0)
+{
+    // round the block size down to a power of two
+    while (d_blockSize * 2 <= blockSize)
+    {
+        d_blockSize *= 2;
+        ++d_levels;
+    }
+}
+
+bool Progressive::run(function<bool()> const &stop)
+{
+    while (!finished())
+    {
+        tracePass(d_region.y + d_row);
+        if (++d_row == d_region.height)
+        {
+            d_row = 0;
+            ++d_pass;
+        }
+        if (stop())
+            break;
+    }
+    return finished();
+}
+
+bool Progressive::finished() const
+{
+    return d_pass >= numPasses();
+}
+
+unsigned Progressive::pass() const
+{
+    return d_pass;
+}
+
+unsigned Progressive::numPasses() const
+{
+    // the last coarse pass already takes sample 0 of every pixel
+    return d_levels + d_samples - 1;
+}
+
+unsigned Progressive::samplesDone() const
+{
+    return d_pass < d_levels ? 0 : d_pass - d_levels + 1;
+}
+
+void Progressive::resolve(Image &img) const
+{
+    bool fullFrame = img.width() != d_region.width
+                     || img.height() != d_region.height;
+    unsigned offsetX = fullFrame ? 0 : d_region.x;
+    unsigned offsetY = fullFrame ? 0 : d_region.y;
+
+    for (unsigned y = d_region.y; y != d_region.y + d_region.height; ++y)
+    {
+        for (unsigned x = d_region.x; x != d_region.x + d_region.width; ++x)
+        {
+            // fall back to the finest coarse block that has a sample
+            unsigned idx = index(x, y);
+            for (unsigned block = 2; d_count[idx] == 0
+                                     && block <= d_blockSize; block *= 2)
+                idx = index(x - (x - d_region.x) % block,
+                            y - (y - d_region.y) % block);
+
+            Color col(0.0, 0.0, 0.0);
+            if (d_count[idx] != 0)
+                col = d_sum[idx] / d_count[idx];
+            img(x - offsetX, y - offsetY) = col;
+        }
+    }
+}
+
+namespace
+{
+    char const checkpointMagic[8] = {'R', 'A', 'Y', 'C', 'K', 'P', 'T', '1'};
+
+    template <typename Type>
+    void writeValue(ostream &out, Type const &value)
+    {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+
+    template <typename Type>
+    Type readValue(istream &in)
+    {
+        Type value;
+        in.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    }
+}
+
+bool Progressive::save(string const &filename, uint64_t sceneHash) const
+{
+    TraceScope scope("checkpoint", filename);
+
+    string tmpname = filename + ".tmp";
+    {
+        ofstream out(tmpname, ios::binary);
+        out.write(checkpointMagic, sizeof(checkpointMagic));
+        writeValue(out, sceneHash);
+        for (unsigned value : {d_region.x, d_region.y, d_region.width,
+                               d_region.height, d_samples, d_blockSize,
+                               d_pass, d_row})
+            writeValue(out, value);
+        out.write(reinterpret_cast<char const *>(d_sum.data()),
+                  d_sum.size() * sizeof(Color));
+        out.write(reinterpret_cast<char const *>(d_count.data()),
+                  d_count.size() * sizeof(unsigned));
+        if (!out.flush())
+            return false;
+    }
+    return rename(tmpname.c_str(), filename.c_str()) == 0;
+}
+
+void Progressive::load(string const &filename, uint64_t sceneHash)
+{
+    ifstream in(filename, ios::binary);
+    if (!in)
+        throw runtime_error("Could not open checkpoint " + filename + ".");
+
+    char magic[sizeof(checkpointMagic)];
+    in.read(magic, sizeof(magic));
+    if (!in || !equal(magic, magic + sizeof(magic), checkpointMagic))
+        throw runtime_error(filename + " is not a checkpoint.");
+    if (readValue<uint64_t>(in) != sceneHash)
+        throw runtime_error("The scene or its settings changed since "
+                            + filename + " was written.");
+
+    unsigned layout[6];
+    for (unsigned &value : layout)
+        value = readValue<unsigned>(in);
+    if (layout[0] != d_region.x || layout[1] != d_region.y
+        || layout[2] != d_region.width || layout[3] != d_region.height
+        || layout[4] != d_samples || layout[5] != d_blockSize)
+        throw runtime_error(filename + " was written for another crop "
+                            "window or sample count.");
+
+    unsigned pass = readValue<unsigned>(in);
+    unsigned row = readValue<unsigned>(in);
+    in.read(reinterpret_cast<char *>(d_sum.data()),
+            d_sum.size() * sizeof(Color));
+    in.read(reinterpret_cast<char *>(d_count.data()),
+            d_count.size() * sizeof(unsigned));
+    if (!in)
+        throw runtime_error(filename + " is truncated.");
+    d_pass = pass;
+    d_row = row;
+}
+
+void Progressive::tracePass(unsigned y)
+{
+    TraceScope scope("progressive row", y);
+
+    unsigned ry = y - d_region.y;
+    if (d_pass < d_levels)
+    {
+        // coarse: sample 0 of the top left pixel of every block
+        unsigned block = d_blockSize >> d_pass;
+        if (ry % block != 0)
+            return;
+        for (unsigned rx = 0; rx < d_region.width; rx += block)
+        {
+            unsigned idx = index(d_region.x + rx, y);
+            if (d_count[idx] != 0)
+                continue;   // sampled by a coarser pass
+            d_sum[idx] += d_scene.sample(d_region.x + rx, y, 0, d_grid);
+            d_count[idx] = 1;
+        }
+        return;
+    }
+
+    unsigned sample = samplesDone();
+    for (unsigned x = d_region.x; x != d_region.x + d_region.width; ++x)
+    {
+        unsigned idx = index(x, y);
+        d_sum[idx] += d_scene.sample(x, y, sample, d_grid);
+        ++d_count[idx];
+    }
+}
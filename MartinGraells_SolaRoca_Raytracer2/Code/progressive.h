@@ -0,0 +1,70 @@
+#ifndef PROGRESSIVE_H_
+#define PROGRESSIVE_H_
+
+#include "region.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class Image;
+class Scene;
+
+// Renders a region of the frame in passes, accumulating samples per pixel:
+//  - coarse passes trace one sample per block of blockSize, blockSize / 2,
+//    ... 1 pixels, so a (blocky) picture of the whole region exists early,
+//  - refinement passes then add sample 1, 2, ... to every pixel.
+// Sample i of a pixel is the same ray the regular renderer shoots, so once
+// all SuperSamplingFactor^2 samples are in, the result is identical.
+class Progressive
+{
+    Scene &d_scene;
+    Region d_region;
+    unsigned d_samples;         // target number of samples per pixel
+    unsigned d_grid;            // samples are taken on a grid x grid pattern
+    unsigned d_blockSize;       // power of two
+    unsigned d_levels;          // number of coarse passes
+
+    std::vector<Color> d_sum;   // per pixel of the region
+    std::vector<unsigned> d_count;
+
+    unsigned d_pass = 0;        // current pass
+    unsigned d_row = 0;         // next row (in the region) of that pass
+
+    public:
+        Progressive(Scene &scene, Region const &region, unsigned samples,
+                    unsigned blockSize = 8);
+
+        // traces rows until every pass is done (returns true) or until
+        // stop() returns true, which is checked after every row
+        bool run(std::function<bool()> const &stop);
+
+        bool finished() const;
+        unsigned pass() const;
+        unsigned numPasses() const;
+        unsigned samplesDone() const;       // samples every pixel has
+
+        // writes the current estimate, img is frame or region sized.
+        // Pixels without samples take the color of their coarse block.
+        void resolve(Image &img) const;
+
+        // Checkpoints: the accumulated samples and the position in the
+        // pass sequence, tagged with the hash of the scene. save() writes
+        // a temporary file and renames it, so a killed job never leaves a
+        // half written checkpoint. load() throws a runtime_error if the
+        // checkpoint belongs to another scene or region.
+        bool save(std::string const &filename, uint64_t sceneHash) const;
+        void load(std::string const &filename, uint64_t sceneHash);
+
+    private:
+        void tracePass(unsigned y);         // one row of the current pass
+
+        inline unsigned index(unsigned x, unsigned y) const
+        {
+            return (y - d_region.y) * d_region.width + (x - d_region.x);
+        }
+};
+
+#endif
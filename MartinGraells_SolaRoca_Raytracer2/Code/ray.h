@@ -8,6 +8,11 @@ class Ray
     public:
         Point O;        // origin
         Vector D;       // direction of the ray
+        // the footprint of the ray is width + t * spread across at
+        // distance t, detail smaller than that may be left out (levels of
+        // detail of meshes). Zero for exact rays.
+        double width = 0.0;
+        double spread = 0.0;
 
         Ray(Point const &from, Vector const &dir)
         :
@@ -1,5 +1,16 @@
 #include "raytracer.h"
+#include "animation.h"
+#include "binaryscene.h"
+#include "bvh.h"
+#include "costmap.h"
+#include "hash.h"
 #include "objloader.h"
+#include "progressive.h"
+#include "resourcecache.h"
+#include "scenestream.h"
+#include "shard.h"
+#include "tilecache.h"
+#include "tracelog.h"
 #include "image.h"
 #include "light.h"
 #include "material.h"
@@ -15,20 +26,232 @@
 #include "shapes/cylinder.h"
 #include "shapes/quad.h"
 #include "shapes/mesh.h"
+#include "shapes/pagedmesh.h"
+#include "shapes/spherecloud.h"
+#include "shapes/heightfield.h"
+#include "shapes/packed.h"
+#include "shapes/translated.h"
 // =============================================================================
 // -- End of shape includes ----------------------------------------------------
 // =============================================================================
 
 #include "json/json.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
 #include <exception>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <stdexcept>
+
+#include <sys/stat.h>
 
 using namespace std;        // no std:: required
 using json = nlohmann::json;
+using namespace std::chrono;
+
+namespace
+{
+    // does the printf style pattern of frameName() hold exactly one
+    // integer conversion (%d or %u, with an optional 0 flag and a width of
+    // at most 20) and otherwise only %% escapes?
+    bool validFramePattern(string const &pattern)
+    {
+        unsigned conversions = 0;
+        for (size_t pos = 0; pos < pattern.size(); ++pos)
+        {
+            if (pattern[pos] != '%')
+                continue;
+            if (++pos < pattern.size() && pattern[pos] == '%')
+                continue;
+            if (pos < pattern.size() && pattern[pos] == '0')
+                ++pos;
+            unsigned width = 0;
+            while (pos < pattern.size() && isdigit(static_cast<unsigned char>(pattern[pos])))
+            {
+                width = 10 * width + (pattern[pos++] - '0');
+                if (width > 20)
+                    return false;
+            }
+            if (pos == pattern.size() || (pattern[pos] != 'd' && pattern[pos] != 'u'))
+                return false;
+            ++conversions;
+        }
+        return conversions == 1;
+    }
+
+    // value as an integer of at least min, throws if it is not one
+    unsigned integerSetting(json const &value, string const &name,
+                            unsigned min)
+    {
+        if (!value.is_number_integer() || value < min || value > UINT_MAX)
+            throw runtime_error(name + " must be an integer of at least "
+                                + to_string(min) + ".");
+        return value;
+    }
+
+    // value as a number of seconds >= 0, throws if it is not one
+    double secondsSetting(json const &value, string const &name)
+    {
+        if (!value.is_number() || !(value.get<double>() >= 0.0))
+            throw runtime_error(name + " must be a number of seconds >= 0.");
+        return value;
+    }
+
+    // [x, y, width, height] of non-negative integers -> Region
+    Region parseRegion(json const &node)
+    {
+        if (!node.is_array() || node.size() != 4)
+            throw runtime_error("Crop must be [x, y, width, height].");
+        for (json const &value : node)
+            if (!value.is_number_integer() || value < 0 || value > UINT_MAX)
+                throw runtime_error("Crop must be four non-negative integers.");
+        return Region(node[0], node[1], node[2], node[3]);
+    }
+
+    // merges a {"index": patch} object into the array of a scene
+    void patchElements(json &elements, json const &patches)
+    {
+        size_t size = elements.size();
+        vector<size_t> removed;
+        for (auto patch = patches.begin(); patch != patches.end(); ++patch)
+        {
+            size_t idx = stoul(patch.key());
+            if (idx > size || (idx == size && patch.value().is_null()))
+                throw runtime_error("No element " + patch.key() + " to patch.");
+            if (idx == size)
+            {
+                // appended, like a merge patch onto a missing value
+                json element;
+                element.merge_patch(patch.value());
+                elements.push_back(element);
+            }
+            else if (patch.value().is_null())
+                removed.push_back(idx);
+            else
+                elements[idx].merge_patch(patch.value());
+        }
+
+        // back to front, so the indices stay valid
+        sort(removed.rbegin(), removed.rend());
+        for (size_t idx : removed)
+            elements.erase(idx);
+    }
+}
+
+namespace
+{
+    // The only thing that invalidates cached tiles when the renderer
+    // changes: must be bumped whenever a change alters any shaded pixel
+    // (2: no NaN weights when sampled lights add nothing).
+    char const renderVersion[] = "raytracer tiles 2";
+
+    // settings that do not change the pixels
+    bool outputSetting(string const &key)
+    {
+        return key == "comment" || key == "CostMap" || key == "CostBreakdown"
+               || key == "Progressive" || key == "Crop" || key == "CropFullFrame";
+    }
+
+    // drops output settings and writes every number as a double, so
+    // 1 and 1.0 hash the same
+    json canonical(json const &node)
+    {
+        if (node.is_number())
+            return node.get<double>();
+        if (node.is_array())
+        {
+            json result = json::array();
+            for (json const &element : node)
+                result.push_back(canonical(element));
+            return result;
+        }
+        if (!node.is_object())
+            return node;
+        json result = json::object();
+        for (auto it = node.begin(); it != node.end(); ++it)
+            if (!outputSetting(it.key()))
+                result[it.key()] = canonical(it.value());
+        return result;
+    }
 
-bool Raytracer::parseObjectNode(json const &node)
+    string fileDigest(string const &filename)
+    {
+        uint64_t hash;
+        size_t const length = filename.size();
+        if (length > 4 && filename.compare(length - 4, 4, ".rcm") == 0)
+        {
+            // clustered meshes may be larger than memory: their size,
+            // modification time and header instead of every byte, as the
+            // ResourceCache stamps them
+            struct stat info;
+            ifstream file(filename, ios::binary);
+            if (stat(filename.c_str(), &info) != 0 || !file)
+                return "missing";
+            vector<char> header(4096);      // the first page
+            file.read(header.data(), header.size());
+            Hash h;
+            h.add(static_cast<uint64_t>(info.st_size))
+             .add(static_cast<uint64_t>(info.st_mtim.tv_sec))
+             .add(static_cast<uint64_t>(info.st_mtim.tv_nsec))
+             .add(header.data(), file.gcount());
+            return "rcm-" + Hash::hex(h.value());
+        }
+        return Hash::ofFile(filename, hash) ? Hash::hex(hash) : "missing";
+    }
+
+    // object with the names of its model and texture replaced by the
+    // digests of the files, digests caches them by file name
+    json withFileDigests(json object, map<string, string> &digests)
+    {
+        auto digest = [&](string const &filename)
+        {
+            auto known = digests.find(filename);
+            if (known != digests.end())
+                return known->second;
+            return digests[filename] = fileDigest(filename);
+        };
+        if (object.find("model") != object.end())
+            object["model"] = digest(object["model"]);
+        auto material = object.find("material");
+        if (material != object.end() && material->find("texture") != material->end())
+            (*material)["texture"] = digest("../Scenes/"
+                                            + (*material)["texture"].get<string>());
+        return object;
+    }
+}
+
+json applySceneDiff(json scene, json const &diff)
+{
+    if (!diff.is_object())
+        throw runtime_error("A scene diff must be an object.");
+
+    json rest = diff;
+    for (char const *key : {"Objects", "Lights"})
+    {
+        auto patches = diff.find(key);
+        if (patches == diff.end() || !patches->is_object())
+            continue;
+        if (!scene[key].is_array())
+            throw runtime_error(string("The scene has no ") + key + " array.");
+        patchElements(scene[key], *patches);
+        rest.erase(key);
+    }
+    scene.merge_patch(rest);
+    return scene;
+}
+
+Raytracer::Raytracer(shared_ptr<ResourceCache> cache)
+:
+    cache(cache ? cache : make_shared<ResourceCache>())
+{}
+
+bool Raytracer::parseObjectNode(json const &node, unsigned idx)
 {
     ObjectPtr obj = nullptr;
 
@@ -76,10 +299,59 @@ bool Raytracer::parseObjectNode(json const &node)
     }else if(node["type"] == "mesh")
     {
         std::string url = node["model"];
-        OBJLoader objLoader(url);
         double scale = node["scale"];
         Point trans (node["translate"]);
-        obj = ObjectPtr(new Mesh(objLoader.vertex_data(),scale,trans));
+        if (scale == 0)
+            throw runtime_error("The scale of a mesh must not be 0.");
+        if (url.size() > 4 && url.compare(url.size() - 4, 4, ".rcm") == 0)
+        {
+            // out of core, in at most "memory" MB
+            double memory = 512;
+            if (node.find("memory") != node.end())
+                memory = node["memory"];
+            if (!(memory > 0))
+                throw runtime_error("The memory of a mesh must be positive.");
+            size_t budget = memory * 1024 * 1024;
+            obj = ObjectPtr(new PagedMesh(cache->clusteredMesh(url, budget),
+                                          scale, trans));
+        }
+        else
+        {
+            BVH::Quality quality = BVH::Balanced;
+            auto bvh = node.find("bvh");
+            if (bvh != node.end() && !BVH::parseQuality(bvh->get<string>(), quality))
+                throw runtime_error("BVH quality must be fast, balanced or high.");
+            obj = ObjectPtr(new Mesh(cache->mesh(url,scale,trans,quality)));
+        }
+    }else if(node["type"] == "spheres")
+    {
+        // particles in a file, the radius is for those without one
+        std::string url = node["model"];
+        double radius = 0.0;
+        if (node.find("radius") != node.end())
+            radius = node["radius"];
+        BVH::Quality quality = BVH::Balanced;
+        auto bvh = node.find("bvh");
+        if (bvh != node.end() && !BVH::parseQuality(bvh->get<string>(), quality))
+            throw runtime_error("BVH quality must be fast, balanced or high.");
+        obj = ObjectPtr(new SphereCloud(cache->cloud(url, radius, quality)));
+    }else if(node["type"] == "heightfield")
+    {
+        // a PNG, or raw samples of the given resolution
+        std::string url = node["model"];
+        Point pos(node["position"]);
+        Vector size(node["size"]);
+        if (!(size.x > 0 && size.y > 0 && size.z > 0))
+            throw runtime_error("The size of a heightfield must be positive.");
+        unsigned width = 0;
+        unsigned height = 0;
+        if (node.find("resolution") != node.end())
+        {
+            width = node["resolution"][0];
+            height = node["resolution"][1];
+        }
+        obj = ObjectPtr(new HeightField(cache->heightMap(url, width, height),
+                                        pos, size));
     }else{
         cerr << "Unknown object type: " << node["type"] << ".\n";
     }
@@ -93,7 +365,25 @@ bool Raytracer::parseObjectNode(json const &node)
 
     // Parse material and add object to the scene
     obj->material = parseMaterialNode(node["material"]);
+    string const &texture = obj->material.texture;
+    if (!texture.empty())
+        scene.addTexture(texture, cache->texture("../Scenes/" + texture));
+    if (animated)
+    {
+        vector<unsigned> const moving = animation->objects();
+        if (find(moving.begin(), moving.end(), idx) != moving.end())
+        {
+            // moved by ray offsets, see setFrame()
+            shared_ptr<Translated> translated(new Translated(obj));
+            movingObjects.push_back(make_pair(idx, translated));
+            obj = translated;
+        }
+    }
     scene.addObject(obj);
+    if (node.find("comment") != node.end())
+        objectNames.push_back(node["comment"]);
+    else
+        objectNames.push_back(node["type"]);
     return true;
 }
 
@@ -101,7 +391,11 @@ Light Raytracer::parseLightNode(json const &node) const
 {
     Point pos(node["position"]);
     Color col(node["color"]);
-    return Light(pos, col);
+    if (node.find("range") == node.end())
+        return Light(pos, col);
+    if (!node["range"].is_number() || node["range"] <= 0)
+        throw runtime_error("Light range must be a positive number.");
+    return Light(pos, col, node["range"]);
 }
 
 Material Raytracer::parseMaterialNode(json const &node) const
@@ -121,58 +415,793 @@ Material Raytracer::parseMaterialNode(json const &node) const
 bool Raytracer::readScene(string const &ifname)
 try
 {
-    // Read and parse input json file
-    ifstream infile(ifname);
-    if (!infile) throw runtime_error("Could not open input file for reading.");
-    json jsonscene;
-    infile >> jsonscene;
+    if (BinaryScene::isBinary(ifname))
+        return readBinaryScene(ifname);
+    struct stat info;
+    if (stat(ifname.c_str(), &info) == 0
+        && static_cast<uint64_t>(info.st_size) >= streamThreshold)
+        return readSceneStream(ifname);
 
+    TraceScope scope("parse scene", ifname);
+    sceneJson = cache->scene(ifname, sceneHash);
+    parseScene(*sceneJson);
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+bool Raytracer::readScene(string const &ifname, json const &diff)
+try
+{
+    if (BinaryScene::isBinary(ifname))
+        throw runtime_error("A diff cannot be applied to a binary scene.");
+    TraceScope scope("parse scene", ifname);
+    sceneJson = make_shared<json const>(
+        applySceneDiff(*cache->scene(ifname, sceneHash), diff));
+    sceneHash = Hash().add(sceneHash).add(diff.dump()).value();
+    parseScene(*sceneJson);
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+bool Raytracer::readSceneStream(string const &ifname)
+try
+{
+    TraceScope scope("stream scene", ifname);
+    SceneStream stream(ifname);
+    map<string, string> digests;    // of the models and textures used
+    unsigned objCount = 0;
+    json settings = stream.read([&](json const &node, unsigned idx)
+    {
+        withFileDigests(node, digests);
+        if (parseObjectNode(node, idx))
+            ++objCount;
+    });
+    if (settings.find("Animation") != settings.end())
+        throw runtime_error("Animated scenes cannot be streamed.");
+
+    sceneJson = make_shared<json const>(settings);
+    sceneHash = stream.hash();
+    // canonical objects would cost more than the parsing, the file itself
+    // (a change of a comment also misses the tile cache)
+    Hash objects;
+    objects.add(sceneHash);
+    for (auto const &digest : digests)
+        objects.add(digest.first).add(digest.second);
+    objectsHash = objects.value();
+    objectsInJson = false;
+    parseSettings(settings);
+    cout << "Parsed " << objCount << " objects.\n";
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+bool Raytracer::readBinaryScene(string const &ifname)
+try
+{
+    TraceScope scope("map scene", ifname);
+    BinaryScene binary(ifname);
+    json settings = json::parse(binary.text(BinaryScene::SETTINGS));
+    if (settings.find("Animation") != settings.end())
+        throw runtime_error("Binary scenes cannot be animated.");
+
+    unsigned objCount = 0;
+    unsigned objIdx = 0;
+    for (auto const &objectNode : json::parse(binary.text(BinaryScene::OBJECTS)))
+        if (parseObjectNode(objectNode, objIdx++))
+            ++objCount;
+
+    auto materials = make_shared<vector<Material>>();
+    PackedMaterial const *packed = binary.records<PackedMaterial>(BinaryScene::MATERIALS);
+    for (uint64_t idx = 0; idx != binary.count(BinaryScene::MATERIALS); ++idx)
+        materials->push_back(Material(Color(packed[idx].color[0], packed[idx].color[1],
+                                            packed[idx].color[2]),
+                                      packed[idx].ka, packed[idx].kd,
+                                      packed[idx].ks, packed[idx].n));
+    auto addPacked = [&](shared_ptr<PackedPrimitives> const &primitives,
+                         string const &name)
+    {
+        if (primitives->size() == 0)
+            return;
+        scene.addObject(primitives);
+        objectNames.push_back(to_string(primitives->size()) + " packed " + name);
+        objCount += primitives->size();
+    };
+    addPacked(make_shared<PackedSpheres>(binary, materials), "spheres");
+    addPacked(make_shared<PackedTriangles>(binary, materials), "triangles");
+    addPacked(make_shared<PackedQuads>(binary, materials), "quads");
+
+    // hashing the whole file would take longer than loading it, its
+    // size and modification time stand in for the contents
+    struct stat info;
+    if (stat(ifname.c_str(), &info) != 0)
+        throw runtime_error("Could not stat " + ifname + ".");
+    sceneHash = Hash().add(static_cast<uint64_t>(info.st_size))
+                      .add(static_cast<uint64_t>(info.st_mtim.tv_sec))
+                      .add(static_cast<uint64_t>(info.st_mtim.tv_nsec)).value();
+    objectsHash = sceneHash;
+    objectsInJson = false;
+    sceneJson = make_shared<json const>(settings);
+    parseSettings(settings);
+    cout << "Parsed " << objCount << " objects.\n";
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+void Raytracer::parseScene(json jsonscene)
+{
 // =============================================================================
 // -- Read your scene data in this section -------------------------------------
 // =============================================================================
 
+    parseSettings(jsonscene);
+
+    if (jsonscene.find("Animation") != jsonscene.end())
+    {
+        animation.reset(new Animation(jsonscene["Animation"],
+                                      jsonscene["Objects"].size()));
+        animated = true;
+        firstFrame = animation->first();
+        lastFrame = animation->last();
+    }
+
+    unsigned objCount = 0;
+    unsigned objIdx = 0;
+    for (auto const &objectNode : jsonscene["Objects"])
+        if (parseObjectNode(objectNode, objIdx++))
+            ++objCount;
+    if (animated)
+        setFrame(firstFrame);   // a still shows the first frame
+
+    cout << "Parsed " << objCount << " objects.\n";
+
+// =============================================================================
+// -- End of scene data reading ------------------------------------------------
+// =============================================================================
+}
+
+void Raytracer::parseSettings(json &jsonscene)
+{
     Point eye(jsonscene["Eye"]);
     scene.setEye(eye);
 
-    // TODO: add your other configuration settings here
+    if (jsonscene.find("Resolution") != jsonscene.end())
+    {
+        json const &res = jsonscene["Resolution"];
+        if (!res.is_array() || res.size() != 2 || res[0] <= 0 || res[1] <= 0)
+            throw runtime_error("Resolution must be [width, height].");
+        scene.setResolution(res[0], res[1]);
+    }
+    if (jsonscene.find("Crop") != jsonscene.end())
+        crop = parseRegion(jsonscene["Crop"]);
+    if (jsonscene["CropFullFrame"] == true)
+        cropFullFrame = true;
 
     for (auto const &lightNode : jsonscene["Lights"])
         scene.addLight(parseLightNode(lightNode));
 
-    unsigned objCount = 0;
-    for (auto const &objectNode : jsonscene["Objects"])
-        if (parseObjectNode(objectNode))
-            ++objCount;
-
     if(jsonscene["Shadows"] == true)
         scene.setShadows();
     if(jsonscene["MaxRecursionDepth"] != nullptr)
         scene.setMaxRecursionDepth(jsonscene["MaxRecursionDepth"]);
     if(jsonscene.find("SuperSamplingFactor") != jsonscene.end())
         scene.setSuperSamplingFactor(jsonscene["SuperSamplingFactor"]);
+    if(jsonscene.find("LightThreshold") != jsonscene.end())
+    {
+        json const &threshold = jsonscene["LightThreshold"];
+        if (!threshold.is_number() || !(threshold.get<double>() >= 0.0))
+            throw runtime_error("LightThreshold must be a number >= 0.");
+        scene.setLightThreshold(threshold);
+    }
+    if(jsonscene.find("LightSamples") != jsonscene.end())
+        scene.setLightSamples(integerSetting(jsonscene["LightSamples"],
+                                             "LightSamples", 0));
+    if(jsonscene.find("LevelOfDetail") != jsonscene.end())
+    {
+        // pixels, or an object with the pixels and the secondary factor
+        json const &node = jsonscene["LevelOfDetail"];
+        double pixels = node.is_object() ? node.value("Pixels", 1.0)
+                                         : node.get<double>();
+        double secondary = node.is_object() ? node.value("Secondary", 4.0)
+                                            : 4.0;
+        if (!(pixels >= 0.0) || !(secondary >= 1.0))
+            throw runtime_error("LevelOfDetail needs Pixels >= 0 and Secondary >= 1.");
+        scene.setLevelOfDetail(pixels, secondary);
+    }
+    if(jsonscene.find("Accelerator") != jsonscene.end())
+    {
+        if (jsonscene["Accelerator"] == "none")
+            scene.setAccelerator(Scene::ACCEL_NONE);
+        else if (jsonscene["Accelerator"] == "grid")
+            scene.setAccelerator(Scene::ACCEL_GRID);
+        else if (jsonscene["Accelerator"] == "twolevel")
+            scene.setAccelerator(Scene::ACCEL_TWO_LEVEL);
+        else
+            throw runtime_error("Accelerator must be \"none\", \"grid\" or \"twolevel\".");
+    }
+    if(jsonscene.find("Progressive") != jsonscene.end())
+    {
+        // true, or an object with the progressive settings
+        json const &node = jsonscene["Progressive"];
+        progressive = node != false;
+        if (node.is_object())
+        {
+            if (node.find("Samples") != node.end())
+                sampleTarget = integerSetting(node["Samples"], "Samples", 1);
+            if (node.find("BlockSize") != node.end())
+                blockSize = integerSetting(node["BlockSize"], "BlockSize", 1);
+            if (node.find("TimeBudget") != node.end())
+                timeBudget = secondsSetting(node["TimeBudget"], "TimeBudget");
+            if (node.find("SnapshotInterval") != node.end())
+                snapshotInterval = secondsSetting(node["SnapshotInterval"],
+                                                  "SnapshotInterval");
+            if (node.find("CheckpointInterval") != node.end())
+                checkpointInterval = secondsSetting(node["CheckpointInterval"],
+                                                    "CheckpointInterval");
+        }
+    }
+    if(jsonscene.find("CostMap") != jsonscene.end())
+    {
+        if (jsonscene["CostMap"] == "tests")
+            scene.setCostMetric(Scene::COST_TESTS);
+        else if (jsonscene["CostMap"] == "time")
+            scene.setCostMetric(Scene::COST_TIME);
+        else
+            throw runtime_error("CostMap must be \"tests\" or \"time\".");
+    }
+    if(jsonscene["CostBreakdown"] == true)
+    {
+        costBreakdown = true;
+        if (scene.getCostMetric() == Scene::COST_NONE)
+            scene.setCostMetric(Scene::COST_TESTS);
+    }
+}
 
+bool Raytracer::renderToFile(string const &ofname)
+{
+    if (shardCount != 0)
+        return renderShard(ofname);
+    if (animated)
+        return renderSequence(ofname);
 
-    cout << "Parsed " << objCount << " objects.\n";
+    Image img;
+    bool withCosts = scene.getCostMetric() != Scene::COST_NONE;
+    if (progressive)
+    {
+        Region region;
+        if (!prepareImage(img, region))
+            return false;
+        if (withCosts)
+            cout << "Note: no cost map is written in progressive mode.\n";
+        if (!renderProgressive(img, region, ofname))
+            return false;
+    }
+    else
+    {
+        CostMap costs;
+        if (!renderImage(img, withCosts ? &costs : nullptr))
+            return false;
+        cout << "Writing image to " << ofname << "...\n";
+        if (!img.write(ofname, outputFormat))
+            return false;
+        if (withCosts)
+            writeCostMap(costs, ofname);
+    }
 
-// =============================================================================
-// -- End of scene data reading ------------------------------------------------
-// =============================================================================
+    if (costBreakdown)
+        printCostBreakdown();
+    cout << "Done.\n";
+    return true;
+}
 
+bool Raytracer::renderImage(Image &img, CostMap *costs)
+{
+    Region region;
+    if (!prepareImage(img, region))
+        return false;
+
+    TraceScope scope("render");
+    if (costs)
+    {
+        *costs = CostMap(img.width(), img.height());
+        scene.render(img, region, costs);
+    }
+    else if (!tileCacheDir.empty())
+        renderTiles(img, {region});
+    else
+        scene.render(img, region);
     return true;
 }
-catch (exception const &ex)
+
+bool Raytracer::prepareImage(Image &img, Region &region) const
 {
-    cerr << ex.what() << '\n';
-    return false;
+    unsigned width = scene.getWidth();
+    unsigned height = scene.getHeight();
+    region = crop.empty() ? Region(0, 0, width, height) : crop;
+    if (!region.fits(width, height))
+    {
+        cerr << "Error: crop window " << region.x << ',' << region.y << ' '
+             << region.width << 'x' << region.height
+             << " does not fit in the " << width << 'x' << height
+             << " frame.\n";
+        return false;
+    }
+
+    bool fullFrame = crop.empty() || cropFullFrame;
+    img = Image(fullFrame ? width : region.width,
+                fullFrame ? height : region.height);
+    cout << "Tracing " << region.width << 'x' << region.height;
+    if (!crop.empty())
+        cout << " pixels at " << region.x << ',' << region.y << " of the "
+             << width << 'x' << height << " frame";
+    cout << "...\n";
+    return true;
 }
 
-void Raytracer::renderToFile(string const &ofname)
+bool Raytracer::renderSequence(string const &pattern)
 {
-    // TODO: the size may be a settings in your file
-    Image img(400, 400);
-    cout << "Tracing...\n";
-    scene.render(img);
-    cout << "Writing image to " << ofname << "...\n";
-    img.write_png(ofname);
+    if (progressive)
+    {
+        cerr << "Error: animations cannot be rendered progressively.\n";
+        return false;
+    }
+    if (pattern.find('%') != string::npos && !validFramePattern(pattern))
+    {
+        cerr << "Error: the output name " << pattern << " needs exactly one "
+                "%d or %u for the frame number (and %% for a % sign).\n";
+        return false;
+    }
+
+    cout << "Rendering frames " << firstFrame << " to " << lastFrame << ", "
+         << movingObjects.size() << " moving objects"
+         << (animation->movesEye() ? " and a moving camera" : "") << ".\n";
+    for (unsigned frame = firstFrame; frame <= lastFrame; ++frame)
+    {
+        TraceScope scope("frame", "", frame);
+        auto start = steady_clock::now();
+        setFrame(frame);
+
+        Image img;
+        string ofname = frameName(pattern, frame);
+        if (!renderImage(img))
+            return false;
+        cout << "Writing frame " << frame << " to " << ofname << "...\n";
+        if (!img.write(ofname, outputFormat))
+            return false;
+        cout << "Frame " << frame << " took "
+             << duration<double>(steady_clock::now() - start).count() << "s.\n";
+    }
+    cout << "Done.\n";
+    return true;
+}
+
+bool Raytracer::renderShard(string const &ofname)
+{
+    if (!crop.empty() || progressive)
+    {
+        cerr << "Error: shards cannot be combined with a crop window or "
+                "progressive rendering.\n";
+        return false;
+    }
+    if (animated)
+    {
+        // a shard file holds bands of a single frame
+        cerr << "Error: an animated scene cannot be rendered in shards.\n";
+        return false;
+    }
+
+    Shard shard(shardIndex, shardCount);
+    Image img(scene.getWidth(), scene.getHeight());
+    vector<Region> bands = shard.regions(img.width(), img.height());
+    cout << "Tracing shard " << shardIndex << '/' << shardCount << " ("
+         << bands.size() << " bands of " << Shard::bandHeight << " rows)...\n";
+    {
+        TraceScope scope("render", ofname);
+        if (tileCacheDir.empty())
+            for (Region const &band : bands)
+                scene.render(img, band);
+        else
+            renderTiles(img, bands);
+    }
+
+    cout << "Writing shard to " << ofname << "...\n";
+    if (!shard.save(ofname, img, contentHash()))
+    {
+        cerr << "Error: could not write " << ofname << '\n';
+        return false;
+    }
     cout << "Done.\n";
+    return true;
+}
+
+void Raytracer::renderTiles(Image &img, vector<Region> const &regions)
+{
+    TileCache tiles(tileCacheDir, tileCacheBytes);
+    uint64_t content = contentHash();
+    unsigned width = scene.getWidth();
+    unsigned height = scene.getHeight();
+    bool fullFrame = img.width() == width && img.height() == height;
+    unsigned offsetX = fullFrame ? 0 : regions.front().x;
+    unsigned offsetY = fullFrame ? 0 : regions.front().y;
+
+    // tiles are aligned to the frame; only whole tiles are cached, the
+    // ones cut by a crop window are always traced
+    unsigned const size = TileCache::tileSize;
+    unsigned partial = 0;
+    for (Region const &region : regions)
+        for (unsigned ty = region.y / size * size; ty < region.y + region.height; ty += size)
+            for (unsigned tx = region.x / size * size; tx < region.x + region.width; tx += size)
+            {
+                Region tile(tx, ty, min(size, width - tx), min(size, height - ty));
+                unsigned x0 = max(tx, region.x);
+                unsigned y0 = max(ty, region.y);
+                Region part(x0, y0,
+                            min(tile.x + tile.width, region.x + region.width) - x0,
+                            min(tile.y + tile.height, region.y + region.height) - y0);
+                Image pixels(part.width, part.height);
+
+                if (part.width != tile.width || part.height != tile.height)
+                {
+                    ++partial;
+                    scene.render(pixels, part);
+                }
+                else
+                {
+                    uint64_t key = Hash().add(content)
+                                         .add(static_cast<uint64_t>(tx))
+                                         .add(static_cast<uint64_t>(ty))
+                                         .value();
+                    if (!tiles.load(key, pixels))
+                    {
+                        scene.render(pixels, part);
+                        if (!tiles.store(key, pixels))
+                            cerr << "Error: could not write to the tile cache "
+                                 << tileCacheDir << '\n';
+                    }
+                }
+
+                for (unsigned y = 0; y != part.height; ++y)
+                    for (unsigned x = 0; x != part.width; ++x)
+                        img(part.x + x - offsetX, part.y + y - offsetY) = pixels(x, y);
+            }
+
+    tiles.evict();
+    cout << "Tile cache: " << tiles.hits() << " hits, " << tiles.misses()
+         << " misses";
+    if (partial != 0)
+        cout << ", " << partial << " partial tiles traced";
+    if (tiles.evicted() != 0)
+        cout << ", " << tiles.evicted() << " tiles evicted";
+    cout << ".\n";
+}
+
+bool Raytracer::renderProgressive(Image &img, Region const &region,
+                                  string const &ofname)
+{
+    unsigned samples = sampleTarget;
+    if (samples == 0)
+        samples = scene.getSuperSamplingFactor() * scene.getSuperSamplingFactor();
+    Progressive render(scene, region, samples, blockSize);
+
+    // the checkpoint is only valid for the same image: the same scene,
+    // camera, resolution, files and crop window
+    uint64_t renderHash = Hash().add(contentHash())
+                                .add(static_cast<uint64_t>(region.x))
+                                .add(static_cast<uint64_t>(region.y))
+                                .add(static_cast<uint64_t>(region.width))
+                                .add(static_cast<uint64_t>(region.height))
+                                .value();
+    string ckptname = ofname + ".ckpt";
+    if (resume)
+    {
+        if (ifstream(ckptname))
+        {
+            try
+            {
+                render.load(ckptname, renderHash);
+            }
+            catch (exception const &ex)
+            {
+                cerr << "Error: not resuming from " << ckptname << ": "
+                     << ex.what() << '\n';
+                return false;
+            }
+            cout << "Resuming from " << ckptname << " at pass "
+                 << render.pass() + 1 << '/' << render.numPasses() << ".\n";
+        }
+        else
+            cout << "No checkpoint " << ckptname << ", starting over.\n";
+    }
+
+    auto start = steady_clock::now();
+    auto lastSnapshot = start;
+    auto lastCheckpoint = start;
+    auto due = [](steady_clock::time_point since, double interval)
+    {
+        return interval > 0
+               && duration<double>(steady_clock::now() - since).count() >= interval;
+    };
+
+    bool outOfTime = false;
+    bool done = false;
+    while (!done && !outOfTime)
+    {
+        TraceScope scope("progressive", ofname);
+        done = render.run([&]()
+        {
+            outOfTime = due(start, timeBudget);
+            return outOfTime || due(lastSnapshot, snapshotInterval)
+                   || due(lastCheckpoint, checkpointInterval);
+        });
+
+        if (!done && due(lastCheckpoint, checkpointInterval))
+        {
+            if (!render.save(ckptname, renderHash))
+                cerr << "Error: could not write checkpoint " << ckptname << '\n';
+            lastCheckpoint = steady_clock::now();
+        }
+        if (!done && !outOfTime && due(lastSnapshot, snapshotInterval))
+        {
+            render.resolve(img);
+            cout << "Snapshot after "
+                 << duration<double>(steady_clock::now() - start).count()
+                 << "s (pass " << render.pass() + 1 << '/' << render.numPasses()
+                 << ", " << render.samplesDone() << " samples per pixel)\n";
+            img.write(ofname, outputFormat);
+            lastSnapshot = steady_clock::now();
+        }
+    }
+
+    if (outOfTime)
+    {
+        cout << "Time budget of " << timeBudget << "s used up in pass "
+             << render.pass() + 1 << '/' << render.numPasses() << " ("
+             << render.samplesDone() << " of " << samples
+             << " samples per pixel).\n";
+        if (checkpointInterval > 0 && !render.save(ckptname, renderHash))
+            cerr << "Error: could not write checkpoint " << ckptname << '\n';
+    }
+    else if (checkpointInterval > 0 || resume)
+        remove(ckptname.c_str());   // finished, nothing left to resume
+
+    render.resolve(img);
+    cout << "Writing image to " << ofname << "...\n";
+    return img.write(ofname, outputFormat);
+}
+
+void Raytracer::writeCostMap(CostMap const &costs, string const &ofname) const
+{
+    // out.png -> out_cost.png
+    string costname = ofname;
+    size_t dot = costname.find_last_of('.');
+    if (dot != string::npos && dot > costname.find_last_of('/') + 1)
+        costname.erase(dot);
+    costname += "_cost.png";
+    cout << "Writing cost map to " << costname << " (max "
+         << costs.max() << (scene.getCostMetric() == Scene::COST_TIME ?
+                            " ns" : " tests") << " per pixel)...\n";
+    costs.write_png(costname);
+}
+
+Scene &Raytracer::getScene()
+{
+    return scene;
+}
+
+shared_ptr<json const> Raytracer::getSceneJson() const
+{
+    return sceneJson;
+}
+
+void Raytracer::setEye(Triple const &position)
+{
+    scene.setEye(position);
+}
+
+void Raytracer::setResolution(unsigned width, unsigned height)
+{
+    scene.setResolution(width, height);
+}
+
+void Raytracer::setCrop(Region const &region)
+{
+    crop = region;
+}
+
+void Raytracer::setCropFullFrame(bool fullFrame)
+{
+    cropFullFrame = fullFrame;
+}
+
+void Raytracer::setOutputFormat(string const &format)
+{
+    outputFormat = format;
+}
+
+void Raytracer::setProgressive(bool enable)
+{
+    progressive = enable;
+}
+
+void Raytracer::setSampleTarget(unsigned samples)
+{
+    sampleTarget = samples;
+}
+
+void Raytracer::setTimeBudget(double seconds)
+{
+    timeBudget = seconds;
+}
+
+void Raytracer::setSnapshotInterval(double seconds)
+{
+    snapshotInterval = seconds;
+}
+
+void Raytracer::setCheckpointInterval(double seconds)
+{
+    checkpointInterval = seconds;
+}
+
+void Raytracer::setResume(bool enable)
+{
+    resume = enable;
+}
+
+void Raytracer::setStreamThreshold(uint64_t bytes)
+{
+    streamThreshold = bytes;
+}
+
+void Raytracer::setTileCache(string const &directory, uint64_t maxBytes)
+{
+    tileCacheDir = directory;
+    tileCacheBytes = maxBytes;
+}
+
+void Raytracer::setFrame(unsigned frame)
+{
+    if (!animated)
+        return;
+    currentFrame = frame;
+    if (animation->movesEye())
+        scene.setEye(animation->eye(frame));
+    for (auto &moving : movingObjects)
+        moving.second->setOffset(animation->offset(moving.first, frame));
+    if (!movingObjects.empty())
+        scene.objectsMoved();
+}
+
+void Raytracer::setFrameRange(unsigned first, unsigned last)
+{
+    firstFrame = first;
+    lastFrame = last;
+}
+
+bool Raytracer::isAnimated() const
+{
+    return animated;
+}
+
+string Raytracer::frameName(string const &pattern, unsigned frame)
+{
+    char number[32];
+    if (pattern.find('%') != string::npos)
+    {
+        // printf style, e.g. frames/shot%03d.png
+        if (!validFramePattern(pattern))
+            throw invalid_argument("Invalid frame name pattern: " + pattern);
+        vector<char> name(pattern.size() + sizeof(number));
+        snprintf(name.data(), name.size(), pattern.c_str(), frame);
+        return name.data();
+    }
+
+    // out.png -> out_0007.png
+    snprintf(number, sizeof(number), "_%04u", frame);
+    string name = pattern;
+    size_t dot = name.find_last_of('.');
+    if (dot == string::npos || dot < name.find_last_of('/') + 1)
+        dot = name.size();
+    return name.insert(dot, number);
+}
+
+void Raytracer::setShard(unsigned index, unsigned count)
+{
+    shardIndex = index;
+    shardCount = count;
+}
+
+uint64_t Raytracer::contentHash() const
+{
+    json content = canonical(*sceneJson);
+
+    // the camera and resolution may be overridden on the command line
+    Point eye = scene.getEye();
+    content["Eye"] = {eye.x, eye.y, eye.z};
+    content["Resolution"] = {static_cast<double>(scene.getWidth()),
+                             static_cast<double>(scene.getHeight())};
+    if (animated)
+        content["Frame"] = static_cast<double>(currentFrame);
+
+    // the files behind the names
+    map<string, string> digests;
+    if (!objectsInJson)
+        content["Objects"] = Hash::hex(objectsHash);
+    else
+        for (json &object : content["Objects"])
+            object = withFileDigests(object, digests);
+
+    return Hash().add(string(renderVersion)).add(content.dump()).value();
+}
+
+void Raytracer::printCostBreakdown() const
+{
+    vector<ObjectCost> const &costs = scene.getObjectCosts();
+    bool timed = scene.getCostMetric() == Scene::COST_TIME;
+
+    // most expensive objects first
+    vector<unsigned> order(costs.size());
+    for (unsigned idx = 0; idx != order.size(); ++idx)
+        order[idx] = idx;
+    sort(order.begin(), order.end(), [&](unsigned a, unsigned b)
+    {
+        return timed ? costs[a].nanoseconds > costs[b].nanoseconds
+                     : costs[a].tests > costs[b].tests;
+    });
+
+    unsigned long totalTests = 0;
+    double totalTime = 0.0;
+    for (ObjectCost const &cost : costs)
+    {
+        totalTests += cost.tests;
+        totalTime += cost.nanoseconds;
+    }
+
+    cout << "Cost per object:\n";
+    for (unsigned idx : order)
+    {
+        double share = timed ? costs[idx].nanoseconds / max(totalTime, 1.0)
+                             : static_cast<double>(costs[idx].tests) / max(totalTests, 1UL);
+        cout << "  " << setw(3) << idx << ' ' << left << setw(24)
+             << objectNames.at(idx) << right << setw(12) << costs[idx].tests
+             << " tests";
+        if (timed)
+            cout << setw(10) << fixed << setprecision(1)
+                 << costs[idx].nanoseconds / 1e6 << " ms";
+        cout << setw(7) << fixed << setprecision(1) << 100 * share << "%\n";
+        cout.unsetf(ios::floatfield);
+    }
+
+    ShadowStats const &shadows = scene.getShadowStats();
+    if (shadows.rays != 0)
+    {
+        cout << "Shadow rays: " << shadows.rays << ", " << shadows.blocked
+             << " blocked, " << shadows.cacheHits
+             << " by the cached occluder (" << fixed << setprecision(1)
+             << 100.0 * shadows.cacheHits / max(shadows.blocked, 1UL)
+             << "%), " << static_cast<double>(shadows.tests) / shadows.rays
+             << " tests per ray\n";
+        cout.unsetf(ios::floatfield);
+    }
+
+    ObjectGrid const &grid = scene.getObjectGrid();
+    if (grid.numCells() != 0)
+        cout << "Object grid: " << grid.numCells() << " cells, "
+             << grid.numReferences() << " object references, "
+             << grid.unbounded().size() << " unbounded objects\n";
 }
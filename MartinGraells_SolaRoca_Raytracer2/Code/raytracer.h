@@ -3,29 +3,159 @@
 
 #include "scene.h"
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 // Forward declerations
+class CostMap;
+class Image;
+class Animation;
 class Light;
 class Material;
+class ResourceCache;
+class Translated;
 
 #include "json/json_fwd.h"
 
 class Raytracer
 {
+    std::shared_ptr<ResourceCache> cache;   // scene files, models, textures
     Scene scene;
+    std::shared_ptr<nlohmann::json const> sceneJson;   // as parsed
+    std::vector<std::string> objectNames;   // for the cost breakdown
+    bool costBreakdown = false;
+    Region crop;                // empty: render the whole frame
+    bool cropFullFrame = false; // write the crop into a full size image
+    std::string outputFormat;   // empty: from the output extension
+
+    bool progressive = false;
+    unsigned sampleTarget = 0;      // 0: SuperSamplingFactor^2
+    unsigned blockSize = 8;         // of the first coarse pass
+    double timeBudget = 0;          // seconds, 0: no limit
+    double snapshotInterval = 0;    // seconds, 0: no snapshots
+    double checkpointInterval = 0;  // seconds, 0: no checkpoints
+    bool resume = false;            // continue from <output>.ckpt
+    uint64_t sceneHash = 0;         // of the scene file
+
+    unsigned shardIndex = 0;
+    unsigned shardCount = 0;        // 0: render the whole frame
+    // keyframed motion, see Animation
+    bool animated = false;
+    std::shared_ptr<Animation> animation;
+    std::vector<std::pair<unsigned, std::shared_ptr<Translated>>> movingObjects;
+    unsigned firstFrame = 0;
+    unsigned lastFrame = 0;
+    unsigned currentFrame = 0;
+
+    std::string tileCacheDir;       // empty: no tile cache
+    uint64_t tileCacheBytes = 0;
+
+    // scene files of this size and larger are streamed, see SceneStream
+    uint64_t streamThreshold = 64 << 20;
+    // false for streamed and binary scenes: objectsHash stands in for the
+    // Objects of sceneJson
+    bool objectsInJson = true;
+    uint64_t objectsHash = 0;
 
     public:
+        // without a cache the Raytracer uses a private one
+        explicit Raytracer(std::shared_ptr<ResourceCache> cache = nullptr);
 
+        // large scene files are streamed, see setStreamThreshold(), binary
+        // scenes are mapped, see BinaryScene
         bool readScene(std::string const &ifname);
-        void renderToFile(std::string const &ofname);
+        // reads the scene with a diff applied, see applySceneDiff()
+        bool readScene(std::string const &ifname, nlohmann::json const &diff);
+        // an animated scene is written as a series of frames, see
+        // frameName()
+        bool renderToFile(std::string const &ofname);
+
+        // renders the frame (or crop window) into img, without writing it;
+        // costs, if given, gets the size of img. Ignores the progressive
+        // and shard settings.
+        bool renderImage(Image &img, CostMap *costs = nullptr);
+
+        Scene &getScene();
+        // the scene file as parsed (with the diff applied), without the
+        // Objects if the scene was streamed or is binary
+        std::shared_ptr<nlohmann::json const> getSceneJson() const;
+
+        // overrides for the settings of the scene file
+        void setEye(Triple const &position);
+        void setResolution(unsigned width, unsigned height);
+        void setCrop(Region const &region);
+        // write the crop window into a full size image
+        void setCropFullFrame(bool fullFrame);
+        void setOutputFormat(std::string const &format);
+        void setProgressive(bool enable);
+        void setSampleTarget(unsigned samples);
+        void setTimeBudget(double seconds);
+        void setSnapshotInterval(double seconds);
+        void setCheckpointInterval(double seconds);
+        void setResume(bool enable);
+        void setTileCache(std::string const &directory, uint64_t maxBytes);
+        // readScene() streams files of at least bytes (0: all files)
+        // instead of parsing them whole. Streamed scenes cannot be animated
+        // and have no Objects in getSceneJson().
+        void setStreamThreshold(uint64_t bytes);
+        // moves the camera and objects of an animated scene to frame
+        void setFrame(unsigned frame);
+        // frames renderToFile() renders of an animated scene
+        void setFrameRange(unsigned first, unsigned last);
+        bool isAnimated() const;
+
+        // name of a frame of a sequence: printf style patterns get the
+        // frame number, otherwise out.png becomes out_0007.png. A pattern
+        // needs exactly one %d or %u (%% escapes a % sign), otherwise this
+        // throws an invalid_argument.
+        static std::string frameName(std::string const &pattern,
+                                     unsigned frame);
+
+        // renderToFile() renders only this Shard and writes a shard file
+        // (not for animated scenes)
+        void setShard(unsigned index, unsigned count);
+
+        // Hash of everything that determines the pixels: the scene without
+        // comments and output settings, the contents of the models and
+        // textures it uses, the camera and the resolution.
+        uint64_t contentHash() const;
 
     private:
 
-        bool parseObjectNode(nlohmann::json const &node);
+        bool readSceneStream(std::string const &ifname);
+        bool readBinaryScene(std::string const &ifname);
+        // by value: missing keys are looked up with operator[]
+        void parseScene(nlohmann::json jsonscene);
+        // everything but the objects and the animation
+        void parseSettings(nlohmann::json &jsonscene);
+        // idx: position in the Objects array of the scene file
+        bool parseObjectNode(nlohmann::json const &node, unsigned idx);
 
         Light parseLightNode(nlohmann::json const &node) const;
         Material parseMaterialNode(nlohmann::json const &node) const;
+
+        // sizes img for the frame or the crop window, false if the crop
+        // window does not fit in the frame
+        bool prepareImage(Image &img, Region &region) const;
+        // img has the size of the frame, or of the only region
+        void renderTiles(Image &img, std::vector<Region> const &regions);
+        bool renderShard(std::string const &ofname);
+        bool renderSequence(std::string const &pattern);
+        bool renderProgressive(Image &img, Region const &region,
+                               std::string const &ofname);
+        void writeCostMap(CostMap const &costs,
+                          std::string const &ofname) const;
+        void printCostBreakdown() const;
 };
 
+// Applies diff to a parsed scene as an RFC 7396 merge patch, except that
+// "Objects" and "Lights" may be patched per element with an object keyed
+// by index: {"Objects": {"2": {"radius": 50}, "5": null, "9": {...}}}
+// patches object 2, removes object 5 and appends object 9 (if the scene
+// has 9 objects). Throws a runtime_error on invalid indices.
+nlohmann::json applySceneDiff(nlohmann::json scene, nlohmann::json const &diff);
+
 #endif
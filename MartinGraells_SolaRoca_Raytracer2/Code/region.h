@@ -0,0 +1,40 @@
+#ifndef REGION_H_
+#define REGION_H_
+
+// Rectangle of pixels in the rendered frame, (x, y) is the top left corner
+class Region
+{
+    public:
+        unsigned x;
+        unsigned y;
+        unsigned width;
+        unsigned height;
+
+        Region(unsigned x = 0, unsigned y = 0,
+               unsigned width = 0, unsigned height = 0)
+        :
+            x(x),
+            y(y),
+            width(width),
+            height(height)
+        {}
+
+        bool empty() const
+        {
+            return width == 0 || height == 0;
+        }
+
+        bool contains(unsigned px, unsigned py) const
+        {
+            return px >= x && px < x + width && py >= y && py < y + height;
+        }
+
+        // true if this region lies completely within a w x h frame
+        bool fits(unsigned w, unsigned h) const
+        {
+            // x + width could wrap around
+            return x <= w && width <= w - x && y <= h && height <= h - y;
+        }
+};
+
+#endif
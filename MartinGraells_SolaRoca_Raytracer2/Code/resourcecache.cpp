@@ -0,0 +1,243 @@
+#include "resourcecache.h"
+
+#include "clouddata.h"
+#include "clusteredmesh.h"
+#include "hash.h"
+#include "heightmap.h"
+#include "image.h"
+#include "meshdata.h"
+#include "objloader.h"
+#include "tracelog.h"
+
+#include "json/json.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+bool ResourceCache::Stamp::operator==(Stamp const &other) const
+{
+    return mtime.tv_sec == other.mtime.tv_sec
+           && mtime.tv_nsec == other.mtime.tv_nsec && size == other.size;
+}
+
+shared_ptr<json const> ResourceCache::scene(string const &path,
+                                            uint64_t &hash)
+{
+    Stamp current;
+    if (!stamp(path, current))
+        throw runtime_error("Could not open " + path + " for reading.");
+
+    auto entry = d_scenes.find(path);
+    if (entry != d_scenes.end() && entry->second.stamp == current)
+    {
+        ++d_hits;
+        hash = d_sceneHashes[path];
+        return entry->second.value;
+    }
+
+    ++d_misses;
+    ifstream infile(path);
+    if (!infile)
+        throw runtime_error("Could not open " + path + " for reading.");
+    string text((istreambuf_iterator<char>(infile)), istreambuf_iterator<char>());
+    shared_ptr<json const> parsed(new json(json::parse(text)));
+
+    hash = Hash().add(text).value();
+    d_sceneHashes[path] = hash;
+    d_scenes[path] = Entry<json>{current, parsed};
+    return parsed;
+}
+
+shared_ptr<vector<Vertex> const> ResourceCache::model(string const &path)
+{
+    Stamp current;
+    bool exists = stamp(path, current);
+
+    auto entry = d_models.find(path);
+    if (exists && entry != d_models.end() && entry->second.stamp == current)
+    {
+        ++d_hits;
+        return entry->second.value;
+    }
+
+    ++d_misses;
+    OBJLoader loader(path);     // reports a missing file itself
+    shared_ptr<vector<Vertex> const> vertices(
+        new vector<Vertex>(loader.vertex_data()));
+    if (exists)
+        d_models[path] = Entry<vector<Vertex>>{current, vertices};
+    return vertices;
+}
+
+shared_ptr<MeshData const> ResourceCache::mesh(string const &path, double scale,
+                                               Point const &translate,
+                                               BVH::Quality quality)
+{
+    Stamp current;
+    bool exists = stamp(path, current);
+
+    string key = MeshData::cacheName(path, scale, translate, quality);
+    auto entry = d_meshes.find(key);
+    if (exists && entry != d_meshes.end() && entry->second.stamp == current)
+    {
+        ++d_hits;
+        return entry->second.value;
+    }
+
+    ++d_misses;
+    shared_ptr<MeshData const> data;
+    {
+        TraceScope scope("map mesh cache", key);
+        data = MeshData::load(path, scale, translate, quality);
+    }
+    if (!data)
+    {
+        TraceScope scope("build mesh", path);
+        OBJLoader loader(path);     // reports a missing file itself
+        data = make_shared<MeshData const>(loader.vertex_data(), scale,
+                                             translate, quality);
+        if (exists && !data->save(path, scale, translate))
+            cerr << "Could not write the mesh cache " << key << ".\n";
+    }
+    if (exists)
+        d_meshes[key] = Entry<MeshData>{current, data};
+    return data;
+}
+
+shared_ptr<ClusteredMesh const> ResourceCache::clusteredMesh(string const &path,
+                                                             size_t budget)
+{
+    Stamp current;
+    bool exists = stamp(path, current);
+
+    string key = path + '.' + to_string(budget);
+    auto entry = d_clusteredMeshes.find(key);
+    if (exists && entry != d_clusteredMeshes.end() && entry->second.stamp == current)
+    {
+        ++d_hits;
+        return entry->second.value;
+    }
+
+    ++d_misses;
+    TraceScope scope("map clustered mesh", path);
+    shared_ptr<ClusteredMesh const> data = make_shared<ClusteredMesh const>(path, budget);
+    if (exists)
+        d_clusteredMeshes[key] = Entry<ClusteredMesh>{current, data};
+    return data;
+}
+
+shared_ptr<CloudData const> ResourceCache::cloud(string const &path,
+                                                 double radius,
+                                                 BVH::Quality quality)
+{
+    Stamp current;
+    bool exists = stamp(path, current);
+
+    Hash hash;
+    hash.add(radius).add(static_cast<uint64_t>(quality));
+    string key = path + '.' + Hash::hex(hash.value());
+    auto entry = d_clouds.find(key);
+    if (exists && entry != d_clouds.end() && entry->second.stamp == current)
+    {
+        ++d_hits;
+        return entry->second.value;
+    }
+
+    ++d_misses;
+    TraceScope scope("build sphere cloud", path);
+    shared_ptr<CloudData const> data = make_shared<CloudData const>(
+        CloudData::read(path, radius), quality);
+    if (exists)
+        d_clouds[key] = Entry<CloudData>{current, data};
+    return data;
+}
+
+shared_ptr<HeightMap const> ResourceCache::heightMap(string const &path,
+                                                     unsigned width,
+                                                     unsigned height)
+{
+    Stamp current;
+    bool exists = stamp(path, current);
+
+    string key = path + '.' + to_string(width) + 'x' + to_string(height);
+    auto entry = d_heightMaps.find(key);
+    if (exists && entry != d_heightMaps.end() && entry->second.stamp == current)
+    {
+        ++d_hits;
+        return entry->second.value;
+    }
+
+    ++d_misses;
+    shared_ptr<HeightMap const> map = make_shared<HeightMap const>(path, width,
+                                                                   height);
+    if (exists)
+        d_heightMaps[key] = Entry<HeightMap>{current, map};
+    return map;
+}
+
+shared_ptr<Image const> ResourceCache::texture(string const &path)
+{
+    Stamp current;
+    bool exists = stamp(path, current);
+
+    auto entry = d_textures.find(path);
+    if (exists && entry != d_textures.end() && entry->second.stamp == current)
+    {
+        ++d_hits;
+        return entry->second.value;
+    }
+
+    ++d_misses;
+    shared_ptr<Image const> image(new Image(path));
+    if (image->width() == 0)
+        throw runtime_error("Could not read texture " + path + '.');
+    if (exists)
+        d_textures[path] = Entry<Image>{current, image};
+    return image;
+}
+
+void ResourceCache::clear()
+{
+    d_scenes.clear();
+    d_sceneHashes.clear();
+    d_models.clear();
+    d_meshes.clear();
+    d_clusteredMeshes.clear();
+    d_clouds.clear();
+    d_heightMaps.clear();
+    d_textures.clear();
+}
+
+unsigned long ResourceCache::hits() const
+{
+    return d_hits;
+}
+
+unsigned long ResourceCache::misses() const
+{
+    return d_misses;
+}
+
+size_t ResourceCache::size() const
+{
+    return d_scenes.size() + d_models.size() + d_meshes.size()
+           + d_clusteredMeshes.size() + d_clouds.size() + d_heightMaps.size()
+           + d_textures.size();
+}
+
+bool ResourceCache::stamp(string const &path, Stamp &result)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return false;
+    result.mtime = info.st_mtim;
+    result.size = info.st_size;
+    return true;
+}
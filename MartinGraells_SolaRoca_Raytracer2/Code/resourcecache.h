@@ -0,0 +1,110 @@
+#ifndef RESOURCECACHE_H_
+#define RESOURCECACHE_H_
+
+#include "bvh.h"
+#include "triple.h"
+#include "vertex.h"
+
+#include "json/json_fwd.h"
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class CloudData;
+class ClusteredMesh;
+class HeightMap;
+class Image;
+class MeshData;
+
+// Keeps parsed scene files, OBJ models and textures in memory, so a
+// long running process (see RenderServer) only reads every input once.
+// An entry is reloaded when the modification time or size of its file
+// changes. A Raytracer without a shared cache uses a private one, so a
+// texture used by several materials is still only decoded once.
+class ResourceCache
+{
+    struct Stamp
+    {
+        timespec mtime;
+        off_t size;
+
+        bool operator==(Stamp const &other) const;
+    };
+
+    template <typename Value>
+    struct Entry
+    {
+        Stamp stamp;
+        std::shared_ptr<Value const> value;
+    };
+
+    std::map<std::string, Entry<nlohmann::json>> d_scenes;
+    std::map<std::string, uint64_t> d_sceneHashes;
+    std::map<std::string, Entry<std::vector<Vertex>>> d_models;
+    // by mesh cache file name (model, scale and translation)
+    std::map<std::string, Entry<MeshData>> d_meshes;
+    // by particle file, default radius and BVH quality
+    std::map<std::string, Entry<CloudData>> d_clouds;
+    // by clustered mesh file and memory budget
+    std::map<std::string, Entry<ClusteredMesh>> d_clusteredMeshes;
+    // by height map file and its size (raw files)
+    std::map<std::string, Entry<HeightMap>> d_heightMaps;
+    std::map<std::string, Entry<Image>> d_textures;
+
+    unsigned long d_hits = 0;
+    unsigned long d_misses = 0;
+
+    public:
+        // Parsed scene file and the hash of its text. Throws a
+        // runtime_error if the file cannot be read or parsed.
+        std::shared_ptr<nlohmann::json const> scene(std::string const &path,
+                                                    uint64_t &hash);
+
+        // vertex data of an OBJ file, see OBJLoader::vertex_data()
+        std::shared_ptr<std::vector<Vertex> const> model(std::string const &path);
+
+        // triangles and BVH of an OBJ model placed in the scene. Mapped
+        // from the mesh cache file next to the model if it is up to date,
+        // otherwise built and written to it for the next run (see
+        // MeshData).
+        std::shared_ptr<MeshData const> mesh(std::string const &path,
+                                             double scale,
+                                             Point const &translate,
+                                             BVH::Quality quality);
+
+        // a clustered mesh file (see ClusteredMesh) with its own memory
+        // budget. Throws a runtime_error if it cannot be mapped.
+        std::shared_ptr<ClusteredMesh const> clusteredMesh(std::string const &path,
+                                                           size_t budget);
+
+        // spheres of a particle file (see CloudData::read()) with their
+        // BVH. Throws a runtime_error if the file cannot be read.
+        std::shared_ptr<CloudData const> cloud(std::string const &path,
+                                               double radius,
+                                               BVH::Quality quality);
+
+        // samples and height pyramid of a terrain, see HeightMap. Throws
+        // a runtime_error if the file cannot be read.
+        std::shared_ptr<HeightMap const> heightMap(std::string const &path,
+                                                   unsigned width,
+                                                   unsigned height);
+
+        // throws a runtime_error if the PNG cannot be read
+        std::shared_ptr<Image const> texture(std::string const &path);
+
+        void clear();
+
+        unsigned long hits() const;
+        unsigned long misses() const;
+        size_t size() const;            // number of cached files
+
+    private:
+        // false if the file does not exist
+        static bool stamp(std::string const &path, Stamp &result);
+};
+
+#endif
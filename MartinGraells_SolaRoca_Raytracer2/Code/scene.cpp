@@ -1,45 +1,84 @@
 #include "scene.h"
 
+#include "costmap.h"
 #include "hit.h"
 #include "material.h"
 #include "ray.h"
+#include "tracelog.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <limits>
+#include <memory>
 #include <iostream>
 
 
 using namespace std;
+using namespace std::chrono;
 
-Color Scene::trace(Ray const &ray, bool shadows,int reflection)
+unsigned const Scene::noOccluder;
+
+Color Scene::trace(Ray const &ray, bool shadows,int reflection, Footprint *footprint)
 {
     // Find hit object and distance
     Hit min_hit(numeric_limits<double>::infinity(), Vector());
     ObjectPtr obj = nullptr;
-    for (unsigned idx = 0; idx != objects.size(); ++idx)
+    unsigned objIdx = 0;
+    // the nearest hit, ties go to the first object as in a plain loop
+    auto consider = [&](unsigned idx)
     {
-        Hit hit(objects[idx]->intersect(ray));
-        if (hit.t < min_hit.t)
+        Hit hit(intersect(idx, ray));
+        if (hit.t < min_hit.t || (hit.t == min_hit.t && obj && idx < objIdx))
         {
             min_hit = hit;
             obj = objects[idx];
+            objIdx = idx;
         }
+    };
+    if (accelerator == ACCEL_NONE)
+        for (unsigned idx = 0; idx != objects.size(); ++idx)
+            consider(idx);
+    else
+    {
+        if (!objectGridValid)
+            buildObjectGrid();
+        uint32_t stamp = nextStamp();
+        for (unsigned idx : objectGrid.unbounded())
+            consider(idx);
+        objectGrid.traverse(ray, 0.0, min_hit.t,
+                            [&](uint32_t const *list, size_t count, double tExit)
+        {
+            for (size_t pos = 0; pos != count; ++pos)
+                if (mailbox[list[pos]] != stamp)
+                {
+                    mailbox[list[pos]] = stamp;
+                    consider(list[pos]);
+                }
+            // later cells only hold hits behind this one
+            return min_hit.t < tExit;
+        });
     }
 
     // No hit? Return background color.
     if (!obj) return Color(0.0, 0.0, 0.0);
 
-    Material material = obj->material;          //the hit objects material
+    Material const &material = min_hit.material ? *min_hit.material
+                                                : obj->material;  //the hit objects material
     Point hit = ray.at(min_hit.t);                 //the hit point
     Vector N = min_hit.N;                          //the normal at hit point
     Vector V = -ray.D;                             //the view vector
+    if (footprint)
+    {
+        footprint->hits.extend(hit);
+        if (reflection > 0 && material.ks > 0)
+            footprint->reflects = true;
+    }
     Color materialColor = material.color;
     if(material.texture != string("")){
-      if(!textures.count(material.texture)){
-        Image texture(string("../Scenes/") + material.texture); //texture
-        textures[material.texture] = texture;
-      }
-      Image const &texture = textures[material.texture];
+      if(!textures.count(material.texture)) //not preloaded by the Raytracer
+        textures[material.texture] = make_shared<Image>(string("../Scenes/") + material.texture);
+      Image const &texture = *textures[material.texture];
       vector<float> UVcoord = obj->UVcoord(hit); //coord in UV space of the hit point
       materialColor = texture.colorAt(UVcoord.at(0),UVcoord.at(1)); //color of texture at UV
     }
@@ -63,65 +102,418 @@ Color Scene::trace(Ray const &ray, bool shadows,int reflection)
     ****************************************************/
 
 
+    // secondary rays start out as wide as this ray is here, and accept
+    // lodSecondary times the detail loss
+    double secondaryWidth = lodSecondary * (ray.width + min_hit.t * ray.spread);
+
     Color Ia = materialColor*material.ka;
     Color Id(0.0,0.0,0.0) ;Color Is(0.0,0.0,0.0) ;
-    bool blocked = false; //by default there are no shadows
-    uint i;
+    bool lit = false;   //does any light reach the hit point
+    auto shade = [&](unsigned lightIdx, double weight){
+        Light const &light = *lights[lightIdx];
+        Vector L = (light.position - hit).normalized();
+        if(shadows && blocked(objIdx, min_hit, lightIdx, L, secondaryWidth))
+            return;
+        lit = true;
+        Vector R = vectorReflect(L,N);
+        Id += weight*materialColor*light.color*material.kd*max(0.0,L.dot(N));
+        Is += weight*pow(max(0.0,R.dot(V)),material.n)*material.ks*light.color;
+    };
+    if (!lightGridValid)
+        buildLightGrid();
+    if (lightsCulled)
+        for (LightSample const &sample : pickLights(hit))
+            shade(sample.index, sample.weight);
+    else
+        for (unsigned idx = 0; idx != lights.size(); ++idx)
+            shade(idx, 1.0);
+
+    // the reflection does not depend on the light, trace it once
     Color reflectedColor(0.0,0.0,0.0);
-    for(i=0; i < lights.size(); i++){
-        Vector L = (lights[i]->position - hit).normalized();
-        if(shadows){
-            blocked = false; //we clean the previous value to false
-            Ray lightRay(lights[i]->position,-L);
-            Hit min_hit(obj->intersect(lightRay));
-            for (unsigned idx = 0; idx != objects.size() && !blocked; ++idx)
-            {
-                Hit hit2(objects[idx]->intersect(lightRay));
-                if (hit2.t < min_hit.t) //if there is an object between the light and the original light
-                {
-                    blocked = true;
-                }
-            }
-        }
-        if(!blocked){
-            Vector R = vectorReflect(L,N);
-            Ray r(hit + 0.1*vectorReflect(V,N) ,vectorReflect(V,N));
-            if(reflection>0 && material.ks > 0) {
-               reflectedColor = trace(r,true,reflection-1);
-               //printf("reflectedColor: (%f,%f,%f), reflection step: %i \n",reflectedColor.r,reflectedColor.g,reflectedColor.b,reflection);
-            }
-            Id += materialColor*lights[i]->color*material.kd*max(0.0,L.dot(N));
-            Is += pow(max(0.0,R.dot(V)),material.n)*material.ks*lights[i]->color;
-        }
+    if(lit && reflection>0 && material.ks > 0) {
+        Ray r(hit + 0.1*vectorReflect(V,N) ,vectorReflect(V,N));
+        r.width = secondaryWidth;
+        r.spread = lodSecondary * ray.spread;
+        reflectedColor = trace(r,true,reflection-1);
     }
     Color color = Id + Is + Ia + material.ks*reflectedColor;
 
     return color;
 }
 
+bool Scene::blocked(unsigned objIdx, Hit const &hit, unsigned lightIdx,
+                    Vector const &L, double width)
+{
+    Ray lightRay(lights[lightIdx]->position,-L);
+    lightRay.width = width;
+    Hit min_hit(intersect(objIdx, lightRay, &hit));
+    ++shadowStats.rays;
+    ++shadowStats.tests;
+
+    // objects of many primitives can block their own light, so the
+    // cached occluder may be objIdx itself
+    unsigned &cached = lastOccluder[lightIdx];
+    if (cached != noOccluder)
+    {
+        ++shadowStats.tests;
+        if (intersect(cached, lightRay).t < min_hit.t)
+        {
+            ++shadowStats.blocked;
+            ++shadowStats.cacheHits;
+            return true;
+        }
+    }
+
+    auto blocks = [&](unsigned idx)
+    {
+        ++shadowStats.tests;
+        Hit hit2(intersect(idx, lightRay));
+        if (hit2.t < min_hit.t) //if there is an object between the light and the original light
+        {
+            ++shadowStats.blocked;
+            cached = idx;
+            return true;
+        }
+        return false;
+    };
+    if (accelerator == ACCEL_NONE)
+    {
+        for (unsigned idx = 0; idx != objects.size(); ++idx)
+            if (idx != cached && blocks(idx))   // cached was tested above
+                return true;
+        return false;
+    }
+
+    if (!objectGridValid)
+        buildObjectGrid();
+    uint32_t stamp = nextStamp();
+    if (cached != noOccluder)
+        mailbox[cached] = stamp;
+    for (unsigned idx : objectGrid.unbounded())
+        if (idx != cached && blocks(idx))
+            return true;
+    return objectGrid.traverse(lightRay, 0.0, min_hit.t,
+                               [&](uint32_t const *list, size_t count, double)
+    {
+        for (size_t pos = 0; pos != count; ++pos)
+            if (mailbox[list[pos]] != stamp)
+            {
+                mailbox[list[pos]] = stamp;
+                if (blocks(list[pos]))
+                    return true;
+            }
+        return false;
+    });
+}
+
+vector<LightSample> Scene::pickLights(Point const &point)
+{
+    // lights without a range, merged in order with the ranged lights that
+    // may reach point, keeping the order (and rounding) of shading them all
+    vector<unsigned> const &everywhere = lightGrid.everywhere();
+    vector<unsigned> const &near = lightGrid.near(point);
+    vector<LightSample> picked;
+    picked.reserve(everywhere.size() + near.size());
+    double threshold = lightThreshold;
+    auto consider = [&](unsigned idx)
+    {
+        Light const &light = *lights[idx];
+        double weight = light.falloff((light.position - point).length());
+        Color const &c = light.color;
+        if (weight > 0 && weight * fmax(c.r, fmax(c.g, c.b)) >= threshold)
+            picked.push_back(LightSample{idx, weight});
+    };
+    size_t a = 0;
+    size_t b = 0;
+    while (a != everywhere.size() || b != near.size())
+    {
+        if (b == near.size() || (a != everywhere.size() && everywhere[a] < near[b]))
+            consider(everywhere[a++]);
+        else
+            consider(near[b++]);
+    }
+
+    if (lightSamples == 0 || picked.size() <= lightSamples)
+        return picked;
+
+    // choose lightSamples of them (with replacement), each with the
+    // probability p of its share of the estimated light, weighted by
+    // 1 / (lightSamples * p) so the expected sum is the full shading
+    vector<double> cdf(picked.size());
+    double total = 0.0;
+    for (size_t idx = 0; idx != picked.size(); ++idx)
+    {
+        Color const &c = lights[picked[idx].index]->color;
+        total += picked[idx].weight * fmax(c.r, fmax(c.g, c.b));
+        cdf[idx] = total;
+    }
+    // nothing to go by (black lights): shading them all costs the shadow
+    // rays, but adds the same nothing without dividing by zero
+    if (!(total > 0.0))
+        return picked;
+    vector<LightSample> chosen;
+    chosen.reserve(lightSamples);
+    for (unsigned count = 0; count != lightSamples; ++count)
+    {
+        double u = nextRandom() * total;
+        size_t idx = upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        idx = min(idx, picked.size() - 1);
+        // u rounded up to total: the last light that adds something
+        while (cdf[idx] == (idx == 0 ? 0.0 : cdf[idx - 1]))
+            --idx;
+        double p = (cdf[idx] - (idx == 0 ? 0.0 : cdf[idx - 1])) / total;
+        chosen.push_back(LightSample{picked[idx].index,
+                                     picked[idx].weight / (lightSamples * p)});
+    }
+    return chosen;
+}
+
+void Scene::buildLightGrid()
+{
+    // radius beyond which a light adds less than the threshold:
+    // color * (1 - (d / range)^4)^2 < threshold; a threshold below 0
+    // would make the radius NaN, which the grid cannot bin
+    double threshold = fmax(lightThreshold, 0.0);
+    vector<double> radii(lights.size(), numeric_limits<double>::infinity());
+    bool ranged = false;
+    for (unsigned idx = 0; idx != lights.size(); ++idx)
+    {
+        Light const &light = *lights[idx];
+        if (light.range <= 0)
+            continue;
+        ranged = true;
+        Color const &c = light.color;
+        double brightest = fmax(c.r, fmax(c.g, c.b));
+        radii[idx] = brightest <= threshold ? 0.0
+                   : light.range * pow(1 - sqrt(threshold / brightest), 0.25);
+    }
+    lightGrid.build(lights, radii);
+    lightsCulled = ranged || lightSamples > 0;
+    lightGridValid = true;
+}
 
-void Scene::render(Image &img)
+void Scene::seedLights(unsigned x, unsigned y, unsigned index)
 {
-    unsigned w = img.width();
-    unsigned h = img.height();
+    lightRandom = (static_cast<uint64_t>(y) << 40) ^ (static_cast<uint64_t>(x) << 20) ^ index;
+}
+
+double Scene::nextRandom()
+{
+    // splitmix64
+    uint64_t z = (lightRandom += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+void Scene::render(Image &img, CostMap *costs)
+{
+    render(img, Region(0, 0, width, height), costs);
+}
+
+void Scene::render(Image &img, Region const &region, CostMap *costs,
+                   vector<Footprint> *footprints)
+{
+    // img either holds the whole frame or just the region
+    bool fullFrame = img.width() == width && img.height() == height;
+    unsigned offsetX = fullFrame ? 0 : region.x;
+    unsigned offsetY = fullFrame ? 0 : region.y;
+    objectCosts.assign(objects.size(), ObjectCost());
+    shadowStats = ShadowStats();
+    if (footprints)
+        footprints->resize(width * height);
+    for (unsigned y = region.y; y < region.y + region.height; ++y)
+    {
+        TraceScope scope("render row", y);
+        for (unsigned x = region.x; x < region.x + region.width; ++x)
+        {
+          unsigned long testsBefore = intersectionTests;
+          auto start = steady_clock::now();
+          Footprint *footprint = nullptr;
+          if (footprints)
+          {
+            footprint = &(*footprints)[y * width + x];
+            *footprint = Footprint();
+          }
+          img(x - offsetX, y - offsetY) = renderPixel(x, y, footprint);
+          if (costs && costMetric == COST_TESTS)
+            (*costs)(x - offsetX, y - offsetY) = intersectionTests - testsBefore;
+          else if (costs && costMetric == COST_TIME)
+            (*costs)(x - offsetX, y - offsetY) = duration<double, nano>(steady_clock::now() - start).count();
+        }
+    }
+}
+
+void Scene::render(Image &img, vector<unsigned> const &pixels,
+                   vector<Footprint> &footprints)
+{
+    TraceScope scope("render pixels", "", pixels.size());
+    footprints.resize(width * height);
+    for (unsigned idx : pixels)
+    {
+        footprints[idx] = Footprint();
+        img(idx % width, idx / width) = renderPixel(idx % width, idx / width,
+                                                    &footprints[idx]);
+    }
+}
+
+Color Scene::renderPixel(unsigned x, unsigned y, Footprint *footprint)
+{
+    unsigned h = height;
     float interval = 1.f /(superSamplingFactor+1); //space between rays
-    for (unsigned y = 0; y < h; ++y)
+    Color col(0.0,0.0,0.0);
+    for(unsigned k = 1; k <= superSamplingFactor; k++){
+      for(unsigned g = 1; g <= superSamplingFactor; g++){
+        Ray ray(primaryRay(x + g*interval, h - 1 - y + k*interval));
+        seedLights(x, y, (k - 1) * superSamplingFactor + g - 1);
+        col += trace(ray,shadows,maxRecursionDepth,footprint);
+      }
+    }
+    return col/(pow(superSamplingFactor,2)); //average of the rays for one pixel
+}
+
+vector<unsigned> Scene::affectedPixels(vector<AABB> const &boxes, bool geometry,
+                                       vector<Footprint> const &footprints) const
+{
+    vector<bool> affected(width * height, false);
+
+    // seen directly
+    for (AABB const &box : boxes)
+    {
+        Region region = screenBounds(box);
+        for (unsigned y = region.y; y < region.y + region.height; ++y)
+            for (unsigned x = region.x; x < region.x + region.width; ++x)
+                affected[y * width + x] = true;
+    }
+
+    // reflections can show any object, so any change
+    if (!boxes.empty() && maxRecursionDepth > 0)
+        for (unsigned idx = 0; idx != footprints.size(); ++idx)
+            if (footprints[idx].reflects)
+                affected[idx] = true;
+
+    // shadows: a box can only block the light of points whose shadow ray
+    // passes through it. Growing the box by the half size of the hit
+    // points of a pixel and testing the ray from their center covers the
+    // rays of all its samples.
+    if (shadows && geometry)
     {
-        for (unsigned x = 0; x < w; ++x)
+        Vector const epsilon(1e-3, 1e-3, 1e-3);
+        for (unsigned idx = 0; idx != footprints.size(); ++idx)
         {
-          Color col(0.0,0.0,0.0);
-          for(unsigned k = 1; k <= superSamplingFactor; k++){
-            for(unsigned g = 1; g <= superSamplingFactor; g++){
-              Point pixel(x + g*interval, h - 1 - y + k*interval, 0);
-              Ray ray(eye, (pixel - eye).normalized());
-              col += trace(ray,shadows,maxRecursionDepth);
+            AABB const &hits = footprints[idx].hits;
+            if (affected[idx] || hits.empty())
+                continue;
+            Vector margin = (hits.upper - hits.lower) / 2 + epsilon;
+            Point center = hits.center();
+            for (unsigned box = 0; box != boxes.size() && !affected[idx]; ++box)
+            {
+                AABB grown = boxes[box].expanded(margin);
+                for (LightPtr const &light : lights)
+                    if (grown.overlapsSegment(center, light->position))
+                    {
+                        affected[idx] = true;
+                        break;
+                    }
             }
-          }
-          col = col/(pow(superSamplingFactor,2)); //average of the rays for one pixel
-          col.clamp();
-          img(x, y) = col;
         }
     }
+
+    vector<unsigned> pixels;
+    for (unsigned idx = 0; idx != affected.size(); ++idx)
+        if (affected[idx])
+            pixels.push_back(idx);
+    return pixels;
+}
+
+Region Scene::screenBounds(AABB const &box) const
+{
+    Region frame(0, 0, width, height);
+    if (box.empty())
+        return Region();
+    if (!box.finite())
+        return frame;
+
+    // project the corners through the eye onto the image plane (z = 0),
+    // inverting primaryRay()
+    double scale = viewWidth / width;
+    double offsetY = (viewWidth - height * scale) / 2;
+    double minX = numeric_limits<double>::infinity();
+    double minY = minX;
+    double maxX = -minX;
+    double maxY = -minX;
+    for (unsigned idx = 0; idx != 8; ++idx)
+    {
+        Point corner = box.corner(idx);
+        double dz = corner.z - eye.z;
+        if (dz * -eye.z <= 0)
+            return frame;           // beside or behind the eye
+        double t = -eye.z / dz;
+        double px = (eye.x + t * (corner.x - eye.x)) / scale;
+        double py = (eye.y + t * (corner.y - eye.y) - offsetY) / scale;
+        minX = fmin(minX, px);
+        maxX = fmax(maxX, px);
+        minY = fmin(minY, py);
+        maxY = fmax(maxY, py);
+    }
+
+    // column x samples px in [x, x + 1), row y samples py in
+    // [height - 1 - y, height - y); one pixel margin for rounding
+    double x0 = fmax(floor(minX) - 1, 0.0);
+    double x1 = fmin(floor(maxX) + 1, width - 1.0);
+    double y0 = fmax(height - 2.0 - floor(maxY), 0.0);
+    double y1 = fmin(height - floor(minY), height - 1.0);
+    if (x0 > x1 || y0 > y1)
+        return Region();
+    return Region(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+Color Scene::sample(unsigned x, unsigned y, unsigned index, unsigned grid)
+{
+    // same sample positions as render() for grid == superSamplingFactor
+    float interval = 1.f / (grid + 1);
+    unsigned g = index % grid + 1;
+    unsigned k = index / grid + 1;
+    seedLights(x, y, index);
+    return trace(primaryRay(x + g*interval, height - 1 - y + k*interval),
+                 shadows, maxRecursionDepth);
+}
+
+// The image plane (z = 0) always spans viewWidth world units horizontally,
+// so the resolution only changes the sampling density, not the framing.
+Ray Scene::primaryRay(double px, double py) const
+{
+    double scale = viewWidth / width;               // world units per pixel
+    double offsetY = (viewWidth - height * scale) / 2;  // centers the view
+    Point pixel(px * scale, py * scale + offsetY, 0);
+    Vector toPixel = pixel - eye;
+    Ray ray(eye, toPixel.normalized());
+    // a pixel spans scale at the distance of the image plane
+    ray.spread = lodPixels * scale / toPixel.length();
+    return ray;
+}
+
+Hit Scene::intersect(unsigned idx, Ray const &ray, Hit const *primitiveOf)
+{
+    auto test = [&]()
+    {
+        return primitiveOf ? objects[idx]->intersectPrimitive(ray, primitiveOf->primitive)
+                           : objects[idx]->intersect(ray);
+    };
+    if (costMetric == COST_NONE)
+        return test();
+
+    ++intersectionTests;
+    ObjectCost &cost = objectCosts[idx];
+    ++cost.tests;
+    if (costMetric != COST_TIME)
+        return test();
+
+    auto start = steady_clock::now();
+    Hit hit(test());
+    cost.nanoseconds += duration<double, nano>(steady_clock::now() - start).count();
+    return hit;
 }
 
 void Scene::setShadows(){
@@ -136,6 +528,70 @@ void Scene::setSuperSamplingFactor(int factor){
     superSamplingFactor = factor; 
 }
 
+void Scene::setResolution(unsigned w, unsigned h)
+{
+    width = w;
+    height = h;
+}
+
+void Scene::setCostMetric(CostMetric metric)
+{
+    costMetric = metric;
+}
+
+void Scene::setAccelerator(Accelerator accel)
+{
+    accelerator = accel;
+    objectGridValid = false;
+}
+
+void Scene::objectsMoved()
+{
+    objectGridValid = false;
+}
+
+void Scene::buildObjectGrid()
+{
+    TraceScope scope("build object grid", "", objects.size());
+    vector<AABB> boxes;
+    boxes.reserve(objects.size());
+    for (ObjectPtr const &object : objects)
+        boxes.push_back(object->bounds());
+    objectGrid.build(boxes, accelerator == ACCEL_TWO_LEVEL);
+    mailbox.assign(objects.size(), 0);
+    mailboxStamp = 0;
+    objectGridValid = true;
+}
+
+uint32_t Scene::nextStamp()
+{
+    if (++mailboxStamp == 0)
+    {
+        // wrapped around, forget all stamps
+        fill(mailbox.begin(), mailbox.end(), 0);
+        mailboxStamp = 1;
+    }
+    return mailboxStamp;
+}
+
+void Scene::setLightThreshold(double threshold)
+{
+    lightThreshold = threshold;
+    lightGridValid = false;
+}
+
+void Scene::setLightSamples(unsigned count)
+{
+    lightSamples = count;
+    lightGridValid = false;
+}
+
+void Scene::setLevelOfDetail(double pixels, double secondary)
+{
+    lodPixels = pixels;
+    lodSecondary = secondary;
+}
+
 //Returns the reflection of v with respect to N, normalized
 Vector Scene::vectorReflect(Vector v,Vector N){
     return (2*(N.dot(v))*N-v).normalized();
@@ -146,11 +602,15 @@ Vector Scene::vectorReflect(Vector v,Vector N){
 void Scene::addObject(ObjectPtr obj)
 {
     objects.push_back(obj);
+    objectCosts.push_back(ObjectCost());
+    objectGridValid = false;
 }
 
 void Scene::addLight(Light const &light)
 {
     lights.push_back(LightPtr(new Light(light)));
+    lastOccluder.push_back(noOccluder);
+    lightGridValid = false;
 }
 
 void Scene::setEye(Triple const &position)
@@ -158,6 +618,16 @@ void Scene::setEye(Triple const &position)
     eye = position;
 }
 
+void Scene::addTexture(string const &name, shared_ptr<Image const> const &texture)
+{
+    textures[name] = texture;
+}
+
+AABB Scene::getObjectBounds(unsigned idx) const
+{
+    return objects.at(idx)->bounds();
+}
+
 unsigned Scene::getNumObject()
 {
     return objects.size();
@@ -167,3 +637,43 @@ unsigned Scene::getNumLights()
 {
     return lights.size();
 }
+
+Point Scene::getEye() const
+{
+    return eye;
+}
+
+unsigned Scene::getSuperSamplingFactor() const
+{
+    return superSamplingFactor;
+}
+
+unsigned Scene::getWidth() const
+{
+    return width;
+}
+
+unsigned Scene::getHeight() const
+{
+    return height;
+}
+
+ShadowStats const &Scene::getShadowStats() const
+{
+    return shadowStats;
+}
+
+Scene::CostMetric Scene::getCostMetric() const
+{
+    return costMetric;
+}
+
+ObjectGrid const &Scene::getObjectGrid() const
+{
+    return objectGrid;
+}
+
+vector<ObjectCost> const &Scene::getObjectCosts() const
+{
+    return objectCosts;
+}
@@ -1,49 +1,222 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "aabb.h"
 #include "light.h"
+#include "lightgrid.h"
 #include "object.h"
+#include "objectgrid.h"
 #include "triple.h"
 #include "image.h"
+#include "region.h"
 
 
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 // Forward declerations
 class Ray;
 class Image;
+class CostMap;
+
+// intersection cost accumulated for a single object
+struct ObjectCost
+{
+    unsigned long tests = 0;
+    double nanoseconds = 0.0;   // only measured for Scene::COST_TIME
+};
+
+// shadow rays cast since the last render, and how often the object that
+// last blocked the same light blocked them again
+struct ShadowStats
+{
+    unsigned long rays = 0;
+    unsigned long blocked = 0;
+    unsigned long cacheHits = 0;    // blocked by the cached occluder
+    unsigned long tests = 0;        // intersection tests of shadow rays
+};
+
+// what the samples of one pixel hit, recorded by render() to find the
+// pixels an edit of the scene can change (see Scene::affectedPixels)
+struct Footprint
+{
+    AABB hits;              // primary hit points, empty if all samples missed
+    bool reflects = false;  // a sample hit a reflective surface
+};
+
+// a light chosen to shade a hit point, weight scales its contribution
+struct LightSample
+{
+    unsigned index;
+    double weight;
+};
 
 class Scene
 {
     std::vector<ObjectPtr> objects;
     std::vector<LightPtr> lights;   // no ptr needed, but kept for consistency
     Point eye;
-    std::map<std::string,Image> textures; //array of textures to onl load once per object
+    // textures by material name, shared with the ResourceCache that loaded them
+    std::map<std::string, std::shared_ptr<Image const>> textures;
 
     public:
 
-        // trace a ray into the scene and return the color
-        Color trace(Ray const &ray, bool shadows = false, int reflection = 0);
+        // what a CostMap records for every pixel
+        enum CostMetric
+        {
+            COST_NONE,
+            COST_TESTS,     // object intersection tests
+            COST_TIME       // nanoseconds
+        };
 
-        // render the scene to the given image
-        void render(Image &img);
+        // how the objects a ray may hit are found
+        enum Accelerator
+        {
+            ACCEL_NONE,         // every object is tested
+            ACCEL_GRID,         // uniform grid
+            ACCEL_TWO_LEVEL     // grid with finer grids in crowded cells
+        };
+
+        // trace a ray into the scene and return the color, adding the hit
+        // to footprint if given
+        Color trace(Ray const &ray, bool shadows = false, int reflection = 0,
+                    Footprint *footprint = nullptr);
+
+        // sample index (of grid x grid samples) of frame pixel (x, y)
+        Color sample(unsigned x, unsigned y, unsigned index, unsigned grid);
+
+        // render the whole frame to the given image, optionally recording
+        // the cost of every pixel (img and costs must have the frame size)
+        void render(Image &img, CostMap *costs = nullptr);
+
+        // render only the pixels of region, img (and costs) either have
+        // the size of the frame or exactly the size of the region
+        void render(Image &img, Region const &region,
+                    CostMap *costs = nullptr,
+                    std::vector<Footprint> *footprints = nullptr);
+
+        // re-render only the given pixels (y * width + x) of the frame
+        // sized img, updating their footprints
+        void render(Image &img, std::vector<unsigned> const &pixels,
+                    std::vector<Footprint> &footprints);
+
+        // Pixels whose color may change when the objects inside the boxes
+        // change, given the footprints of the last render. Covers objects
+        // seen directly, shadows they cast (only if geometry is true, a
+        // change of material casts the same shadows) and reflections.
+        // Conservative: may return pixels that turn out the same.
+        std::vector<unsigned> affectedPixels(std::vector<AABB> const &boxes,
+                                             bool geometry,
+                                             std::vector<Footprint> const &footprints) const;
+
+        // pixels that can see (part of) box, the whole frame if the box is
+        // not entirely in front of the eye
+        Region screenBounds(AABB const &box) const;
 
         void setShadows();
         void setMaxRecursionDepth(int depth);
         void setSuperSamplingFactor(int factor);
+        void setResolution(unsigned width, unsigned height);
+        void setCostMetric(CostMetric metric);
+        void setAccelerator(Accelerator accelerator);
+        // the bounds of objects changed (the next frame of an animation),
+        // the grid is rebuilt before the next ray
+        void objectsMoved();
+
+        // lights contributing less than threshold (of the brightest color
+        // component) at a point are skipped. Only lights with a range fall
+        // off, so only those are ever skipped.
+        void setLightThreshold(double threshold);
+        // shade every hit with at most count lights, picked at random
+        // with a probability proportional to their contribution; 0 uses
+        // all lights
+        void setLightSamples(unsigned count);
+        // meshes may leave out detail smaller than pixels pixels (on the
+        // image plane) from primary rays, and secondary times as much from
+        // reflection and shadow rays, which are seen second hand; see
+        // MeshData. 0 always traces the full meshes.
+        void setLevelOfDetail(double pixels, double secondary);
 
         void addObject(ObjectPtr obj);
         void addLight(Light const &light);
         void setEye(Triple const &position);
+        void addTexture(std::string const &name,
+                        std::shared_ptr<Image const> const &texture);
 
+        AABB getObjectBounds(unsigned idx) const;
         unsigned getNumObject();
         unsigned getNumLights();
+        Point getEye() const;
+        unsigned getSuperSamplingFactor() const;
+        unsigned getWidth() const;
+        unsigned getHeight() const;
+        CostMetric getCostMetric() const;
+        // the grid over the objects, built for the last render
+        ObjectGrid const &getObjectGrid() const;
+
+        // per object costs, in the order the objects were added
+        std::vector<ObjectCost> const &getObjectCosts() const;
+        ShadowStats const &getShadowStats() const;
 
     private:
         Vector vectorReflect(Vector v,Vector N);
+        // counts the test, primitiveOf: only intersect the primitive hit
+        // there, see Object::intersectPrimitive()
+        Hit intersect(unsigned idx, Ray const &ray, Hit const *primitiveOf = nullptr);
+
+        // ray from the eye through (px, py), in pixels from the bottom left
+        // corner of the frame
+        Ray primaryRay(double px, double py) const;
+        Color renderPixel(unsigned x, unsigned y, Footprint *footprint);
+
+        // is light lightIdx (direction L from the point hit on object
+        // objIdx) blocked? Tests the object that blocked this light last
+        // before all others: neighbouring points mostly share their blocker.
+        // width: footprint of the shadow ray (see Ray::width)
+        bool blocked(unsigned objIdx, Hit const &hit, unsigned lightIdx,
+                     Vector const &L, double width);
+        // lights to shade point with, only used if lightsCulled
+        std::vector<LightSample> pickLights(Point const &point);
+        void buildLightGrid();
+        void buildObjectGrid();
+        // a mailbox stamp no object holds yet
+        std::uint32_t nextStamp();
+        // restarts the random light choice, so every sample of the frame
+        // gets the same lights however the frame is rendered
+        void seedLights(unsigned x, unsigned y, unsigned index);
+        double nextRandom();    // in [0, 1)
         bool shadows = false;
         int maxRecursionDepth = 0;
         unsigned superSamplingFactor = 1;
+        unsigned width = 400;               // resolution of the frame
+        unsigned height = 400;
+        static constexpr double viewWidth = 400;    // of the image plane
+        CostMetric costMetric = COST_NONE;
+        double lightThreshold = 0.0;
+        unsigned lightSamples = 0;
+        double lodPixels = 0.0;
+        double lodSecondary = 4.0;
+        LightGrid lightGrid;
+        bool lightGridValid = false;
+        bool lightsCulled = false;      // not simply all lights for every hit
+        std::uint64_t lightRandom = 0;
+        unsigned long intersectionTests = 0;
+        std::vector<ObjectCost> objectCosts;
+        // per light the object that blocked it last, noOccluder if none. A
+        // Scene is rendered by one thread at a time, so this is per thread.
+        std::vector<unsigned> lastOccluder;
+        static unsigned const noOccluder = ~0u;
+        ShadowStats shadowStats;
+        Accelerator accelerator = ACCEL_NONE;
+        ObjectGrid objectGrid;
+        bool objectGridValid = false;
+        // per object the stamp of the last ray that tested it, so objects
+        // in several cells are tested once per ray
+        std::vector<std::uint32_t> mailbox;
+        std::uint32_t mailboxStamp = 0;
 };
 
 #endif
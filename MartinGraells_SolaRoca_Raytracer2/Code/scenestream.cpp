@@ -0,0 +1,185 @@
+#include "scenestream.h"
+
+#include "json/json.h"
+
+#include <cctype>
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+SceneStream::SceneStream(string const &filename)
+:
+    d_in(filename, ios::binary),
+    d_filename(filename),
+    d_buffer(1 << 16)
+{
+    if (!d_in)
+        throw runtime_error("Could not open " + filename + " for reading.");
+
+    // Hash::add(string) starts with the length
+    d_in.seekg(0, ios::end);
+    d_hash.add(static_cast<uint64_t>(d_in.tellg()));
+    d_in.seekg(0);
+}
+
+json SceneStream::read(ObjectHandler const &onObject)
+{
+    json members = json::object();
+    skipSpace();
+    expect('{');
+    skipSpace();
+    if (peek() == '}')
+        get();
+    else
+        while (true)
+        {
+            skipSpace();
+            if (peek() != '"')
+                fail("member name expected");
+            string key = parseValue();
+            skipSpace();
+            expect(':');
+            skipSpace();
+
+            if (key == "Objects" && peek() == '[')
+            {
+                get();
+                skipSpace();
+                unsigned idx = 0;
+                if (peek() == ']')
+                    get();
+                else
+                    while (true)
+                    {
+                        onObject(parseValue(), idx++);
+                        skipSpace();
+                        int ch = get();
+                        if (ch == ']')
+                            break;
+                        if (ch != ',')
+                            fail("',' or ']' expected");
+                    }
+            }
+            else
+                members[key] = parseValue();
+
+            skipSpace();
+            int ch = get();
+            if (ch == '}')
+                break;
+            if (ch != ',')
+                fail("',' or '}' expected");
+        }
+
+    skipSpace();
+    if (peek() != EOF)
+        fail("text after the scene");
+    return members;
+}
+
+uint64_t SceneStream::hash() const
+{
+    return d_hash.value();
+}
+
+int SceneStream::peek()
+{
+    if (d_pos == d_end)
+    {
+        d_offset += d_end;
+        d_in.read(d_buffer.data(), d_buffer.size());
+        d_end = d_in.gcount();
+        d_pos = 0;
+        d_hash.add(d_buffer.data(), d_end);
+        if (d_end == 0)
+            return EOF;
+    }
+    return static_cast<unsigned char>(d_buffer[d_pos]);
+}
+
+int SceneStream::get()
+{
+    int ch = peek();
+    if (ch != EOF)
+        ++d_pos;
+    return ch;
+}
+
+void SceneStream::skipSpace()
+{
+    while (isspace(peek()))
+        get();
+}
+
+void SceneStream::expect(char ch)
+{
+    if (get() != ch)
+        fail(string("'") + ch + "' expected");
+}
+
+string SceneStream::value()
+{
+    // find the end of the value: strings may contain any character,
+    // arrays and objects end at the matching bracket
+    skipSpace();
+    string text;
+    unsigned depth = 0;
+    bool inString = false;
+    while (true)
+    {
+        int ch = peek();
+        if (ch == EOF)
+            fail("unexpected end of file");
+        if (inString)
+        {
+            text += static_cast<char>(get());
+            if (ch == '\\')
+            {
+                if (peek() == EOF)
+                    fail("unexpected end of file");
+                text += static_cast<char>(get());
+            }
+            else if (ch == '"')
+            {
+                inString = false;
+                if (depth == 0)
+                    return text;
+            }
+            continue;
+        }
+
+        if (depth == 0 && (ch == ',' || ch == '}' || ch == ']' || isspace(ch)))
+        {
+            if (text.empty())
+                fail("value expected");
+            return text;
+        }
+        text += static_cast<char>(get());
+        if (ch == '"')
+            inString = true;
+        else if (ch == '{' || ch == '[')
+            ++depth;
+        else if ((ch == '}' || ch == ']') && --depth == 0)
+            return text;
+    }
+}
+
+json SceneStream::parseValue()
+{
+    string text = value();
+    try
+    {
+        return json::parse(text);
+    }
+    catch (exception const &ex)
+    {
+        fail(ex.what());
+    }
+}
+
+void SceneStream::fail(string const &what) const
+{
+    throw runtime_error(d_filename + ", offset " + to_string(d_offset + d_pos)
+                        + ": " + what);
+}
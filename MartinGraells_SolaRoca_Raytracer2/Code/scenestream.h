@@ -0,0 +1,54 @@
+#ifndef SCENESTREAM_H_
+#define SCENESTREAM_H_
+
+#include "hash.h"
+
+#include "json/json_fwd.h"
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Reads a scene file without building a DOM of its "Objects" array: the
+// file is scanned in chunks, every element of "Objects" is parsed on its
+// own, handed to a callback and dropped. Memory use follows the objects
+// that are created, not the size of the file. The other top level members
+// are small and are returned as a json object.
+class SceneStream
+{
+    std::ifstream d_in;
+    std::string d_filename;
+    std::vector<char> d_buffer;
+    size_t d_pos = 0;
+    size_t d_end = 0;
+    uint64_t d_offset = 0;      // of d_buffer[0] in the file
+    Hash d_hash;
+
+    public:
+        typedef std::function<void(nlohmann::json const &node, unsigned idx)>
+            ObjectHandler;
+
+        // throws a runtime_error if the file cannot be opened
+        explicit SceneStream(std::string const &filename);
+
+        // calls onObject for every element of "Objects", in order, and
+        // returns the other members. Throws a runtime_error on syntax errors.
+        nlohmann::json read(ObjectHandler const &onObject);
+
+        // of the file read, equal to Hash().add(contents)
+        uint64_t hash() const;
+
+    private:
+        int peek();
+        int get();
+        void skipSpace();
+        void expect(char ch);
+        // the text of the next value
+        std::string value();
+        nlohmann::json parseValue();
+        [[noreturn]] void fail(std::string const &what) const;
+};
+
+#endif
@@ -0,0 +1,353 @@
+#include "server.h"
+
+#include "raytracer.h"
+#include "region.h"
+#include "resourcecache.h"
+#include "tracelog.h"
+#include "triple.h"
+
+#include "json/json.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using json = nlohmann::json;
+using namespace std::chrono;
+
+namespace
+{
+    // Line based IO on a socket. Keeps the bytes after the last newline
+    // for the next call.
+    class LineSocket
+    {
+        int d_fd;
+        string d_buffer;
+
+        public:
+            explicit LineSocket(int fd)
+            :
+                d_fd(fd)
+            {}
+
+            ~LineSocket()
+            {
+                close(d_fd);
+            }
+
+            // false at the end of the connection
+            bool readLine(string &line)
+            {
+                size_t newline;
+                while ((newline = d_buffer.find('\n')) == string::npos)
+                {
+                    char chunk[4096];
+                    ssize_t count = ::read(d_fd, chunk, sizeof(chunk));
+                    if (count < 0 && errno == EINTR)
+                        continue;
+                    if (count <= 0)
+                        return false;
+                    d_buffer.append(chunk, count);
+                }
+                line = d_buffer.substr(0, newline);
+                d_buffer.erase(0, newline + 1);
+                return true;
+            }
+
+            bool writeLine(string const &line)
+            {
+                string data = line + '\n';
+                size_t done = 0;
+                while (done < data.size())
+                {
+                    ssize_t count = ::write(d_fd, data.data() + done,
+                                            data.size() - done);
+                    if (count < 0 && errno == EINTR)
+                        continue;
+                    if (count <= 0)
+                        return false;
+                    done += count;
+                }
+                return true;
+            }
+    };
+
+    sockaddr_un socketAddress(string const &path)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            throw runtime_error("Socket path too long: " + path);
+        strcpy(address.sun_path, path.c_str());
+        return address;
+    }
+
+    double secondsSince(steady_clock::time_point start)
+    {
+        return duration<double>(steady_clock::now() - start).count();
+    }
+}
+
+RenderServer::RenderServer()
+:
+    d_cache(make_shared<ResourceCache>())
+{}
+
+void RenderServer::serve(istream &in, ostream &out)
+{
+    // out may be cout, keep the render messages out of the replies
+    ostream replies(out.rdbuf());
+    streambuf *coutBuffer = cout.rdbuf(cerr.rdbuf());
+
+    string line;
+    while (!d_quit && getline(in, line))
+    {
+        if (line.empty())
+            continue;
+        replies << handle(line) << endl;
+    }
+
+    cout.rdbuf(coutBuffer);
+}
+
+bool RenderServer::listen(string const &socketPath)
+try
+{
+    sockaddr_un address = socketAddress(socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw runtime_error(string("socket: ") + strerror(errno));
+    LineSocket server(fd);
+
+    // a socket left behind by an earlier server is replaced, anything
+    // else (a mistyped output file) is left alone
+    struct stat info;
+    if (lstat(socketPath.c_str(), &info) == 0)
+    {
+        if (!S_ISSOCK(info.st_mode))
+            throw runtime_error("Could not listen on " + socketPath
+                                + ": path exists and is not a socket");
+        unlink(socketPath.c_str());
+    }
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(fd, 8) != 0)
+        throw runtime_error("Could not listen on " + socketPath + ": "
+                            + strerror(errno));
+    struct stat created;
+    bool stamped = lstat(socketPath.c_str(), &created) == 0;
+
+    signal(SIGPIPE, SIG_IGN);       // a client that hangs up is not fatal
+    cout << "Listening on " << socketPath << "...\n";
+
+    while (!d_quit)
+    {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(string("accept: ") + strerror(errno));
+        }
+
+        LineSocket connection(client);
+        string line;
+        while (!d_quit && connection.readLine(line))
+            if (!line.empty() && !connection.writeLine(handle(line)))
+                break;
+    }
+
+    // only the socket bound above, not one another server replaced it with
+    if (stamped && lstat(socketPath.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)
+        && info.st_dev == created.st_dev && info.st_ino == created.st_ino)
+        unlink(socketPath.c_str());
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+string RenderServer::handle(string const &line)
+{
+    json reply;
+    try
+    {
+        json request = json::parse(line);
+        if (!request.is_object())
+            throw runtime_error("A request must be a JSON object.");
+
+        auto command = request.find("command");
+        if (command == request.end())
+            reply = render(request);
+        else if (*command == "stats")
+            reply = stats();
+        else if (*command == "quit")
+        {
+            d_quit = true;
+            reply = {{"ok", true}};
+        }
+        else
+            throw runtime_error("Unknown command: " + command->dump());
+    }
+    catch (exception const &ex)
+    {
+        reply = {{"ok", false}, {"error", ex.what()}};
+    }
+    return reply.dump();
+}
+
+bool RenderServer::send(string const &socketPath, json const &request,
+                        json &reply)
+try
+{
+    sockaddr_un address = socketAddress(socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw runtime_error(string("socket: ") + strerror(errno));
+    LineSocket connection(fd);
+
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        throw runtime_error("Could not connect to " + socketPath + ": "
+                            + strerror(errno));
+
+    string line;
+    if (!connection.writeLine(request.dump()) || !connection.readLine(line))
+        throw runtime_error("The server at " + socketPath + " hung up.");
+    reply = json::parse(line);
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+json RenderServer::render(json const &request)
+{
+    auto start = steady_clock::now();
+    ++d_requests;
+
+    auto scene = request.find("scene");
+    if (scene == request.end() || !scene->is_string())
+        throw runtime_error("A render request needs a \"scene\".");
+    string ifname = *scene;
+    TraceScope scope("request", ifname, d_requests);
+
+    // settings are checked before the (slow) load
+    string format;
+    if (request.find("format") != request.end())
+    {
+        format = request["format"];
+        if (format != "png" && format != "ppm" && format != "pfm"
+            && format != "raw")
+            throw runtime_error("Unknown format: " + format);
+    }
+
+    string ofname;
+    if (request.find("output") != request.end())
+        ofname = request["output"];
+    else
+    {
+        // like the command line: scene.json -> scene.png
+        ofname = ifname;
+        size_t dot = ofname.find_last_of('.');
+        if (dot != string::npos)
+            ofname.erase(dot);
+        ofname += format.empty() ? ".png" : "." + format;
+    }
+
+    Raytracer raytracer(d_cache);
+    bool loaded = request.find("diff") != request.end() ?
+                  raytracer.readScene(ifname, request["diff"]) :
+                  raytracer.readScene(ifname);
+    if (!loaded)
+        throw runtime_error("Reading the scene from " + ifname + " failed.");
+    double loadTime = secondsSince(start);
+
+    if (request.find("eye") != request.end())
+        raytracer.setEye(Point(request["eye"]));
+    if (request.find("resolution") != request.end())
+    {
+        json const &res = request["resolution"];
+        if (!res.is_array() || res.size() != 2 || res[0] <= 0 || res[1] <= 0)
+            throw runtime_error("resolution must be [width, height].");
+        raytracer.setResolution(res[0], res[1]);
+    }
+    if (request.find("crop") != request.end())
+    {
+        json const &crop = request["crop"];
+        if (!crop.is_array() || crop.size() != 4)
+            throw runtime_error("crop must be [x, y, width, height].");
+        for (json const &value : crop)
+            if (!value.is_number_integer() || value < 0 || value > UINT_MAX)
+                throw runtime_error("crop must be four non-negative integers.");
+        raytracer.setCrop(Region(crop[0], crop[1], crop[2], crop[3]));
+    }
+    if (request.value("crop_full", false))
+        raytracer.setCropFullFrame(true);
+    if (!format.empty())
+        raytracer.setOutputFormat(format);
+    if (request.value("progressive", false))
+        raytracer.setProgressive(true);
+    if (request.find("samples") != request.end())
+    {
+        json const &samples = request["samples"];
+        if (!samples.is_number_integer() || samples < 0 || samples > UINT_MAX)
+            throw runtime_error("samples must be a non-negative integer.");
+        raytracer.setProgressive(true);
+        raytracer.setSampleTarget(samples);
+    }
+    // the progressive settings of the command line, in seconds
+    auto seconds = [&](char const *key, void (Raytracer::*set)(double))
+    {
+        auto value = request.find(key);
+        if (value == request.end())
+            return;
+        if (!value->is_number() || !(value->get<double>() >= 0.0))
+            throw runtime_error(string(key) + " must be a number of seconds.");
+        raytracer.setProgressive(true);
+        (raytracer.*set)(*value);
+    };
+    seconds("time_budget", &Raytracer::setTimeBudget);
+    seconds("snapshot_every", &Raytracer::setSnapshotInterval);
+    seconds("checkpoint_every", &Raytracer::setCheckpointInterval);
+    if (request.value("resume", false))
+    {
+        raytracer.setProgressive(true);
+        raytracer.setResume(true);
+    }
+
+    if (!raytracer.renderToFile(ofname))
+        throw runtime_error("Rendering " + ofname + " failed.");
+
+    return
+    {
+        {"ok", true},
+        {"output", ofname},
+        {"seconds", {{"load", loadTime}, {"total", secondsSince(start)}}}
+    };
+}
+
+json RenderServer::stats() const
+{
+    return
+    {
+        {"ok", true},
+        {"requests", d_requests},
+        {"cached_files", d_cache->size()},
+        {"cache_hits", d_cache->hits()},
+        {"cache_misses", d_cache->misses()}
+    };
+}
@@ -0,0 +1,57 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "json/json_fwd.h"
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+class ResourceCache;
+
+// Long running render process. Requests are single-line JSON objects,
+// every request gets a single-line JSON reply:
+//
+//   {"scene": "scene01.json", "output": "out.png", "diff": {...},
+//    "eye": [x, y, z], "resolution": [w, h], "crop": [x, y, w, h],
+//    "crop_full": true, "format": "pfm", "samples": n}
+//      -> {"ok": true, "output": "out.png", "seconds": {...}}
+//      or {"ok": false, "error": "..."}
+//   {"command": "stats"}   -> cache statistics
+//   {"command": "quit"}    -> stops the server
+//
+// Only "scene" is required. Scene files, models and textures stay in a
+// ResourceCache between requests; diff is applied with applySceneDiff.
+// Requests are handled one at a time, relative paths are relative to the
+// working directory of the server.
+class RenderServer
+{
+    std::shared_ptr<ResourceCache> d_cache;
+    unsigned long d_requests = 0;
+    bool d_quit = false;
+
+    public:
+        RenderServer();
+
+        // serves requests from in until end of input or "quit"; the
+        // progress messages of the renders go to cerr instead of cout
+        void serve(std::istream &in, std::ostream &out);
+
+        // serves the clients of a Unix domain socket, one connection at a
+        // time, until a client sends "quit"
+        bool listen(std::string const &socketPath);
+
+        // returns the reply to one request line
+        std::string handle(std::string const &line);
+
+        // client side: sends request to the server at socketPath, returns
+        // false if the server could not be reached
+        static bool send(std::string const &socketPath,
+                         nlohmann::json const &request, nlohmann::json &reply);
+
+    private:
+        nlohmann::json render(nlohmann::json const &request);
+        nlohmann::json stats() const;
+};
+
+#endif
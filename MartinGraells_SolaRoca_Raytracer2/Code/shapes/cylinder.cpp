@@ -77,3 +77,12 @@ Cylinder::Cylinder(Point const &pos1,Point const &pos2,double radius)
     r(radius)
 
 {}
+
+AABB Cylinder::bounds() const
+{
+    // the caps lie within spheres of radius r around the end points
+    Vector extent(r, r, r);
+    AABB box(initial - extent, initial + extent);
+    box.extend(AABB(end - extent, end + extent));
+    return box;
+}
@@ -10,6 +10,7 @@ class Cylinder: public Object
 
         virtual Hit intersect(Ray const &ray);
         virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
         
         Point const initial;
         Point const end;
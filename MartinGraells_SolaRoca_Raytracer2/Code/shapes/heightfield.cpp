@@ -0,0 +1,197 @@
+#include "heightfield.h"
+
+#include "triangle.h"
+#include "../heightmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+// the ray in units of cells: x and z of the terrain become 0 and 1
+struct HeightField::GridRay
+{
+    Ray const &ray;
+    double origin[2];
+    double invDir[2];
+    bool parallel[2];
+
+    GridRay(Ray const &ray, Point const &origin, double const cell[2])
+    :
+        ray(ray)
+    {
+        unsigned const axes[2] = {0, 2};
+        for (unsigned axis = 0; axis != 2; ++axis)
+        {
+            double dir = ray.D.data[axes[axis]] / cell[axis];
+            this->origin[axis] = (ray.O.data[axes[axis]] - origin.data[axes[axis]])
+                                 / cell[axis];
+            parallel[axis] = dir == 0.0;
+            invDir[axis] = parallel[axis] ? 0.0 : 1 / dir;
+        }
+    }
+
+    // narrows [t0, t1] to the part over the cells [lower, upper),
+    // false if none
+    bool clip(double const lower[2], double const upper[2], double &t0,
+              double &t1) const
+    {
+        for (unsigned axis = 0; axis != 2; ++axis)
+        {
+            if (parallel[axis])
+            {
+                if (origin[axis] < lower[axis] || origin[axis] > upper[axis])
+                    return false;
+                continue;
+            }
+            double tLower = (lower[axis] - origin[axis]) * invDir[axis];
+            double tUpper = (upper[axis] - origin[axis]) * invDir[axis];
+            t0 = max(t0, min(tLower, tUpper));
+            t1 = min(t1, max(tLower, tUpper));
+        }
+        return t0 <= t1;
+    }
+};
+
+HeightField::HeightField(shared_ptr<HeightMap const> const &map,
+                         Point const &origin, Vector const &size)
+:
+    d_map(map),
+    d_origin(origin),
+    d_size(size),
+    d_cell{size.x / map->cellsX(), size.z / map->cellsY()},
+    d_scale(size.y / 65535)
+{
+    HeightMap::Range all = map->range(map->levels() - 1, 0, 0);
+    d_margin = 1e-6 * size.length() + 1e-9;
+    d_bounds = AABB(origin + Vector(0, all.low * d_scale, 0),
+                    origin + Vector(size.x, all.high * d_scale, size.z))
+               .expanded(Vector(d_margin, d_margin, d_margin));
+}
+
+Hit HeightField::intersect(Ray const &ray)
+{
+    if (!d_bounds.intersects(ray))
+        return Hit::NO_HIT();
+
+    GridRay gridRay(ray, d_origin, d_cell);
+    double const lower[2] = {0.0, 0.0};
+    double const upper[2] = {double(d_map->cellsX()), double(d_map->cellsY())};
+    double t0 = 0.0;
+    double t1 = numeric_limits<double>::infinity();
+    if (!gridRay.clip(lower, upper, t0, t1))
+        return Hit::NO_HIT();
+
+    double nearest = numeric_limits<double>::infinity();
+    uint64_t closest = 0;
+    walk(gridRay, d_map->levels() - 1, 0, 0, t0, t1, nearest, closest);
+    if (isinf(nearest))
+        return Hit::NO_HIT();
+
+    uint64_t cell = closest / 2;
+    Hit hit(nearest, normal(ray, cell % d_map->cellsX(), cell / d_map->cellsX(),
+                            closest % 2));
+    hit.primitive = closest;
+    return hit;
+}
+
+Hit HeightField::intersectPrimitive(Ray const &ray, uint64_t primitive)
+{
+    uint64_t cell = primitive / 2;
+    if (cell >= uint64_t(d_map->cellsX()) * d_map->cellsY())
+        return Hit::NO_HIT();
+    unsigned x = cell % d_map->cellsX();
+    unsigned y = cell / d_map->cellsX();
+    double t = distance(ray, x, y, primitive % 2);
+    if (isnan(t))
+        return Hit::NO_HIT();
+    Hit hit(t, normal(ray, x, y, primitive % 2));
+    hit.primitive = primitive;
+    return hit;
+}
+
+vector<float> HeightField::UVcoord(Vector v)
+{
+    return {float((v.x - d_origin.x) / d_size.x),
+            float((v.z - d_origin.z) / d_size.z)};
+}
+
+AABB HeightField::bounds() const
+{
+    return d_bounds;
+}
+
+void HeightField::walk(GridRay const &ray, unsigned level, unsigned x,
+                       unsigned y, double t0, double t1, double &nearest,
+                       uint64_t &closest) const
+{
+    if (t0 > nearest)
+        return;                 // behind the nearest hit
+
+    // does the ray pass above or below the block?
+    double y0 = ray.ray.O.y + t0 * ray.ray.D.y;
+    double y1 = ray.ray.O.y + t1 * ray.ray.D.y;
+    HeightMap::Range range = d_map->range(level, x, y);
+    if (min(y0, y1) > d_origin.y + range.high * d_scale + d_margin
+        || max(y0, y1) < d_origin.y + range.low * d_scale - d_margin)
+        return;
+
+    if (level == 0)
+    {
+        for (unsigned triangle = 0; triangle != 2; ++triangle)
+        {
+            double t = distance(ray.ray, x, y, triangle);
+            if (t < nearest)
+            {
+                nearest = t;
+                closest = 2 * (uint64_t(y) * d_map->cellsX() + x) + triangle;
+            }
+        }
+        return;
+    }
+
+    // children nearest first: a ray cannot cross the quadrants against
+    // the signs of its direction
+    unsigned flipX = ray.invDir[0] < 0;
+    unsigned flipY = ray.invDir[1] < 0;
+    for (unsigned child = 0; child != 4; ++child)
+    {
+        unsigned cx = 2 * x + ((child & 1) ^ flipX);
+        unsigned cy = 2 * y + ((child >> 1) ^ flipY);
+        if (cx >= d_map->blocksX(level - 1) || cy >= d_map->blocksY(level - 1))
+            continue;
+        unsigned const shift = level - 1;
+        double const lower[2] = {double(cx << shift), double(cy << shift)};
+        double const upper[2] = {double(min(d_map->cellsX(), (cx + 1) << shift)),
+                                 double(min(d_map->cellsY(), (cy + 1) << shift))};
+        double childT0 = t0;
+        double childT1 = t1;
+        if (ray.clip(lower, upper, childT0, childT1))
+            walk(ray, level - 1, cx, cy, childT0, childT1, nearest, closest);
+    }
+}
+
+// cell (x, y) is split into triangles (x, y) (x + 1, y) (x + 1, y + 1)
+// and (x, y) (x + 1, y + 1) (x, y + 1)
+double HeightField::distance(Ray const &ray, unsigned x, unsigned y,
+                             unsigned triangle) const
+{
+    return triangle == 0
+           ? Triangle::distance(vertex(x, y), vertex(x + 1, y), vertex(x + 1, y + 1), ray)
+           : Triangle::distance(vertex(x, y), vertex(x + 1, y + 1), vertex(x, y + 1), ray);
+}
+
+Vector HeightField::normal(Ray const &ray, unsigned x, unsigned y,
+                           unsigned triangle) const
+{
+    return triangle == 0
+           ? Triangle::normal(vertex(x, y), vertex(x + 1, y), vertex(x + 1, y + 1), ray)
+           : Triangle::normal(vertex(x, y), vertex(x + 1, y + 1), vertex(x, y + 1), ray);
+}
+
+Point HeightField::vertex(unsigned x, unsigned y) const
+{
+    return d_origin + Vector(x * d_cell[0], d_map->sample(x, y) * d_scale,
+                             y * d_cell[1]);
+}
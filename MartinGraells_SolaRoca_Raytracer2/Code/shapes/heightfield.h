@@ -0,0 +1,52 @@
+#ifndef HEIGHTFIELD_H_
+#define HEIGHTFIELD_H_
+
+#include "../object.h"
+
+#include <memory>
+
+class HeightMap;
+
+// Terrain over a HeightMap, placed with its first sample at origin: the
+// samples of a row run along x, the rows along z, and the highest sample
+// value (65535) is size.y above origin. Every cell is two triangles, made
+// when a ray reaches it. Rays walk the height pyramid of the map front to
+// back and skip blocks they pass above or below.
+class HeightField: public Object
+{
+    std::shared_ptr<HeightMap const> d_map;
+    Point d_origin;
+    Vector d_size;
+    double d_cell[2];       // along x and z
+    double d_scale;         // height per sample value
+    double d_margin;        // height ranges are grown by this
+    AABB d_bounds;
+
+    public:
+        HeightField(std::shared_ptr<HeightMap const> const &map,
+                    Point const &origin, Vector const &size);
+
+        virtual Hit intersect(Ray const &ray);
+        // Hit::primitive: 2 * cell + the triangle of the cell
+        virtual Hit intersectPrimitive(Ray const &ray, uint64_t primitive);
+        // u along x, v along z, over the whole terrain
+        virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
+
+    private:
+        struct GridRay;
+
+        // tests the cells of block (x, y) of level that the ray crosses
+        // between t0 and t1, keeping the nearest hit
+        void walk(GridRay const &ray, unsigned level, unsigned x, unsigned y,
+                  double t0, double t1, double &nearest,
+                  uint64_t &closest) const;
+        // distance to triangle 0 or 1 of cell (x, y), NaN if missed
+        double distance(Ray const &ray, unsigned x, unsigned y,
+                        unsigned triangle) const;
+        Vector normal(Ray const &ray, unsigned x, unsigned y,
+                      unsigned triangle) const;
+        Point vertex(unsigned x, unsigned y) const;
+};
+
+#endif
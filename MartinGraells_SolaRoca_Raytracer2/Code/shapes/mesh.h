@@ -2,18 +2,25 @@
 #define MESH_H_
 
 #include "../object.h"
-#include "triangle.h"
 #include "../vertex.h"
 
+#include <memory>
+
+class MeshData;
+
 class Mesh: public Object
 {
     public:
         Mesh(std::vector<Vertex> const &vertices,double const &scale, Point const &translate);
+        // shares triangles built (or loaded from a mesh cache) before
+        explicit Mesh(std::shared_ptr<MeshData const> const &data);
 
         virtual Hit intersect(Ray const &ray);
         virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
 
-        std::vector<Triangle> triangles;
+    private:
+        std::shared_ptr<MeshData const> d_data;
 };
 
 #endif
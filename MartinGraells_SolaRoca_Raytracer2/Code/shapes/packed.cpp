@@ -0,0 +1,213 @@
+#include "packed.h"
+
+#include "sphere.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    Point point(double const *coords)
+    {
+        return Point(coords[0], coords[1], coords[2]);
+    }
+
+    double distance(PackedSphere const &sphere, Ray const &ray)
+    {
+        return Sphere::distance(point(sphere.center), sphere.radius, ray);
+    }
+
+    Vector normal(PackedSphere const &sphere, Ray const &ray, double t)
+    {
+        return Sphere::normal(point(sphere.center), ray, t);
+    }
+
+    double distance(PackedTriangle const &triangle, Ray const &ray)
+    {
+        double const (*v)[3] = triangle.vertex;
+        return Triangle::distance(point(v[0]), point(v[1]), point(v[2]), ray);
+    }
+
+    Vector normal(PackedTriangle const &triangle, Ray const &ray, double)
+    {
+        double const (*v)[3] = triangle.vertex;
+        return Triangle::normal(point(v[0]), point(v[1]), point(v[2]), ray);
+    }
+
+    // a quad is the triangles (1, 2, 4) and (2, 3, 4), see Quad
+    double distance(PackedQuad const &quad, Ray const &ray, bool &second)
+    {
+        double const (*v)[3] = quad.vertex;
+        double t1 = Triangle::distance(point(v[0]), point(v[1]), point(v[3]), ray);
+        double t2 = Triangle::distance(point(v[1]), point(v[2]), point(v[3]), ray);
+        second = isnan(t1) || !(t1 < t2 || isnan(t2));
+        return second ? t2 : t1;
+    }
+
+    double distance(PackedQuad const &quad, Ray const &ray)
+    {
+        bool second;
+        return distance(quad, ray, second);
+    }
+
+    Vector normal(PackedQuad const &quad, Ray const &ray, double)
+    {
+        bool second;
+        distance(quad, ray, second);
+        double const (*v)[3] = quad.vertex;
+        return second ? Triangle::normal(point(v[1]), point(v[2]), point(v[3]), ray)
+                      : Triangle::normal(point(v[0]), point(v[1]), point(v[3]), ray);
+    }
+
+    // index of the nearest record hit by ray, count if none
+    template <typename Record>
+    uint64_t nearest(Record const *records, uint64_t count, Ray const &ray,
+                     double &t)
+    {
+        t = numeric_limits<double>::infinity();
+        uint64_t closest = count;
+        for (uint64_t idx = 0; idx != count; ++idx)
+        {
+            double distanceTo = distance(records[idx], ray);
+            if (distanceTo < t)
+            {
+                t = distanceTo;
+                closest = idx;
+            }
+        }
+        return closest;
+    }
+}
+
+PackedPrimitives::PackedPrimitives(BinaryScene const &scene,
+                                   BinaryScene::SectionId id,
+                                   shared_ptr<vector<Material> const> const &materials)
+:
+    d_file(scene.file()),
+    d_materials(materials),
+    d_bounds(scene.bounds(id)),
+    d_count(scene.count(id))
+{
+    // slightly grown, like Mesh, so rays along the faces are not culled
+    if (!d_bounds.empty())
+    {
+        double margin = 1e-6 * (d_bounds.upper - d_bounds.lower).length() + 1e-9;
+        d_bounds = d_bounds.expanded(Vector(margin, margin, margin));
+    }
+}
+
+vector<float> PackedPrimitives::UVcoord(Vector v)
+{
+    return {0, 0};
+}
+
+AABB PackedPrimitives::bounds() const
+{
+    return d_bounds;
+}
+
+uint64_t PackedPrimitives::size() const
+{
+    return d_count;
+}
+
+Hit PackedPrimitives::hit(double t, Vector const &N, uint64_t primitive,
+                          uint32_t idx) const
+{
+    Hit result(t, N);
+    // out of range indices of a damaged file get the last material
+    result.material = &(*d_materials)[min<size_t>(idx, d_materials->size() - 1)];
+    result.primitive = primitive;
+    return result;
+}
+
+PackedSpheres::PackedSpheres(BinaryScene const &scene,
+                             shared_ptr<vector<Material> const> const &materials)
+:
+    PackedPrimitives(scene, BinaryScene::SPHERES, materials),
+    d_spheres(scene.records<PackedSphere>(BinaryScene::SPHERES))
+{}
+
+Hit PackedSpheres::intersect(Ray const &ray)
+{
+    if (!d_bounds.intersects(ray))
+        return Hit::NO_HIT();
+    double t;
+    uint64_t idx = nearest(d_spheres, d_count, ray, t);
+    if (idx == d_count)
+        return Hit::NO_HIT();
+    return hit(t, normal(d_spheres[idx], ray, t), idx, d_spheres[idx].material);
+}
+
+Hit PackedSpheres::intersectPrimitive(Ray const &ray, uint64_t primitive)
+{
+    if (primitive >= d_count)
+        return Hit::NO_HIT();
+    PackedSphere const &sphere = d_spheres[primitive];
+    double t = distance(sphere, ray);
+    if (isnan(t))
+        return Hit::NO_HIT();
+    return hit(t, normal(sphere, ray, t), primitive, sphere.material);
+}
+
+PackedTriangles::PackedTriangles(BinaryScene const &scene,
+                                 shared_ptr<vector<Material> const> const &materials)
+:
+    PackedPrimitives(scene, BinaryScene::TRIANGLES, materials),
+    d_triangles(scene.records<PackedTriangle>(BinaryScene::TRIANGLES))
+{}
+
+Hit PackedTriangles::intersect(Ray const &ray)
+{
+    if (!d_bounds.intersects(ray))
+        return Hit::NO_HIT();
+    double t;
+    uint64_t idx = nearest(d_triangles, d_count, ray, t);
+    if (idx == d_count)
+        return Hit::NO_HIT();
+    return hit(t, normal(d_triangles[idx], ray, t), idx, d_triangles[idx].material);
+}
+
+Hit PackedTriangles::intersectPrimitive(Ray const &ray, uint64_t primitive)
+{
+    if (primitive >= d_count)
+        return Hit::NO_HIT();
+    PackedTriangle const &triangle = d_triangles[primitive];
+    double t = distance(triangle, ray);
+    if (isnan(t))
+        return Hit::NO_HIT();
+    return hit(t, normal(triangle, ray, t), primitive, triangle.material);
+}
+
+PackedQuads::PackedQuads(BinaryScene const &scene,
+                         shared_ptr<vector<Material> const> const &materials)
+:
+    PackedPrimitives(scene, BinaryScene::QUADS, materials),
+    d_quads(scene.records<PackedQuad>(BinaryScene::QUADS))
+{}
+
+Hit PackedQuads::intersect(Ray const &ray)
+{
+    if (!d_bounds.intersects(ray))
+        return Hit::NO_HIT();
+    double t;
+    uint64_t idx = nearest(d_quads, d_count, ray, t);
+    if (idx == d_count)
+        return Hit::NO_HIT();
+    return hit(t, normal(d_quads[idx], ray, t), idx, d_quads[idx].material);
+}
+
+Hit PackedQuads::intersectPrimitive(Ray const &ray, uint64_t primitive)
+{
+    if (primitive >= d_count)
+        return Hit::NO_HIT();
+    PackedQuad const &quad = d_quads[primitive];
+    double t = distance(quad, ray);
+    if (isnan(t))
+        return Hit::NO_HIT();
+    return hit(t, normal(quad, ray, t), primitive, quad.material);
+}
@@ -0,0 +1,77 @@
+#ifndef PACKED_H_
+#define PACKED_H_
+
+#include "../object.h"
+#include "../binaryscene.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class MappedFile;
+
+// The primitives of one section of a BinaryScene, used in place and
+// intersected as one object. Every primitive has its own material from
+// the material table, a hit points Hit::material at it. The primitives
+// are tested one by one.
+class PackedPrimitives: public Object
+{
+    std::shared_ptr<MappedFile const> d_file;  // keeps the records mapped
+    std::shared_ptr<std::vector<Material> const> d_materials;
+
+    protected:
+        AABB d_bounds;
+        uint64_t d_count;
+
+    public:
+        PackedPrimitives(BinaryScene const &scene, BinaryScene::SectionId id,
+                         std::shared_ptr<std::vector<Material> const> const &materials);
+
+        // packed materials have no textures
+        virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
+        uint64_t size() const;
+
+    protected:
+        // a hit at distance t with normal N on the given primitive with
+        // material idx
+        Hit hit(double t, Vector const &N, uint64_t primitive, uint32_t idx) const;
+};
+
+class PackedSpheres: public PackedPrimitives
+{
+    PackedSphere const *d_spheres;
+
+    public:
+        PackedSpheres(BinaryScene const &scene,
+                      std::shared_ptr<std::vector<Material> const> const &materials);
+
+        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersectPrimitive(Ray const &ray, uint64_t primitive);
+};
+
+class PackedTriangles: public PackedPrimitives
+{
+    PackedTriangle const *d_triangles;
+
+    public:
+        PackedTriangles(BinaryScene const &scene,
+                        std::shared_ptr<std::vector<Material> const> const &materials);
+
+        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersectPrimitive(Ray const &ray, uint64_t primitive);
+};
+
+class PackedQuads: public PackedPrimitives
+{
+    PackedQuad const *d_quads;
+
+    public:
+        PackedQuads(BinaryScene const &scene,
+                    std::shared_ptr<std::vector<Material> const> const &materials);
+
+        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersectPrimitive(Ray const &ray, uint64_t primitive);
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "pagedmesh.h"
+
+#include "../clusteredmesh.h"
+
+using namespace std;
+
+PagedMesh::PagedMesh(shared_ptr<ClusteredMesh const> const &data, double scale,
+                     Point const &translate)
+:
+    d_data(data),
+    d_scale(scale),
+    d_translate(translate)
+{
+    AABB model = data->bounds();
+    d_bounds.extend(model.lower * scale + translate);
+    d_bounds.extend(model.upper * scale + translate);
+}
+
+Hit PagedMesh::intersect(Ray const &ray)
+{
+    // the ray moves into the space of the model instead; its distances
+    // stay the same, and so do the normals (facing the ray) unless a
+    // negative scale turned the ray around
+    Hit hit = d_data->intersect(Ray((ray.O - d_translate) / d_scale, ray.D / d_scale));
+    if (d_scale < 0)
+        hit.N = -hit.N;
+    return hit;
+}
+
+vector<float> PagedMesh::UVcoord(Vector v)
+{
+    return {0, 0};
+}
+
+AABB PagedMesh::bounds() const
+{
+    return d_bounds;
+}
@@ -0,0 +1,28 @@
+#ifndef PAGEDMESH_H_
+#define PAGEDMESH_H_
+
+#include "../object.h"
+
+#include <memory>
+
+class ClusteredMesh;
+
+// A mesh from a clustered mesh file, scaled and translated into the scene.
+// Only the clusters rays reach are in memory, see ClusteredMesh.
+class PagedMesh: public Object
+{
+    std::shared_ptr<ClusteredMesh const> d_data;
+    double d_scale;
+    Point d_translate;
+    AABB d_bounds;
+
+    public:
+        PagedMesh(std::shared_ptr<ClusteredMesh const> const &data,
+                  double scale, Point const &translate);
+
+        virtual Hit intersect(Ray const &ray);
+        virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
+};
+
+#endif
@@ -54,3 +54,8 @@ Plane::Plane(Point const &pos1, Point const &pos2, Point const &pos3)
     point2(pos2),
     point3(pos3)
 {}
+
+AABB Plane::bounds() const
+{
+    return AABB::infinite();
+}
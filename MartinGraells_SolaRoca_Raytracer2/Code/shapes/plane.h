@@ -10,6 +10,7 @@ class Plane: public Object
 
         virtual Hit intersect(Ray const &ray);
         virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
         
         Point const point1;
         Point const point2;
@@ -45,3 +45,10 @@ Quad::Quad(Point const &pos1, Point const &pos2, Point const &pos3, Point const
     triangle1(pos1,pos2,pos4),
     triangle2(pos2,pos3,pos4)
 {}
+
+AABB Quad::bounds() const
+{
+    AABB box = triangle1.bounds();
+    box.extend(triangle2.bounds());
+    return box;
+}
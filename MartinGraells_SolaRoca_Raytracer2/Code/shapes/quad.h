@@ -10,6 +10,7 @@ class Quad: public Object
 
         virtual Hit intersect(Ray const &ray);
         virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
         
         Triangle triangle1;
         Triangle triangle2;
@@ -3,15 +3,24 @@
 
 #include <cmath>
 #include <iostream>
+#include <limits>
 
 using namespace std;
 
 Hit Sphere::intersect(Ray const &ray)
+{
+    double t = distance(position, r, ray);
+    if (std::isnan(t))
+        return Hit::NO_HIT();
+    return Hit(t, normal(position, ray, t));
+}
+
+double Sphere::distance(Point const &center, double r, Ray const &ray)
 {
     // Sphere formula: ||x - position||^2 = r^2
     // Line formula:   x = ray.O + t * ray.D
 
-    Vector L = ray.O - position;
+    Vector L = ray.O - center;
     double a = ray.D.dot(ray.D);
     double b = 2 * ray.D.dot(L);
     double c = L.dot(L) - r * r;
@@ -19,25 +28,28 @@ Hit Sphere::intersect(Ray const &ray)
     double t0;
     double t1;
     if (not Solvers::quadratic(a, b, c, t0, t1))
-        return Hit::NO_HIT();
+        return numeric_limits<double>::quiet_NaN();
 
     // t0 is closest hit
     if (t0 < 0)  // check if it is not behind the camera
     {
         t0 = t1;    // try t1
         if (t0 < 0) // both behind the camera
-            return Hit::NO_HIT();
+            return numeric_limits<double>::quiet_NaN();
     }
+    return t0;
+}
 
+Vector Sphere::normal(Point const &center, Ray const &ray, double t)
+{
     // calculate normal
-    Point hit = ray.at(t0);
-    Vector N = (hit - position).normalized();
+    Point hit = ray.at(t);
+    Vector N = (hit - center).normalized();
 
     // determine orientation of the normal
     if (N.dot(ray.D) > 0)
         N = -N;
-
-    return Hit(t0, N);
+    return N;
 }
 
 vector<float> Sphere::UVcoord(Vector v){ //v is initially a point in space coord
@@ -69,3 +81,9 @@ Sphere::Sphere(Point const &pos, double radius,double angle, Vector const &axis)
 Vector Sphere::applyRotation(Vector v){
     return v*cos(angle) + axis.cross(v)*sin(angle) + axis*v.dot(axis)*(1-cos(angle)); //Rodrigues' rotation formula https://en.wikipedia.org/wiki/Rodrigues%27_rotation_formula
 }
+
+AABB Sphere::bounds() const
+{
+    Vector extent(r, r, r);
+    return AABB(position - extent, position + extent);
+}
@@ -10,7 +10,12 @@ class Sphere: public Object
         Sphere(Point const &pos, double radius,double angle,Vector const &axis);
 
         virtual Hit intersect(Ray const &ray);
+        // distance to the sphere at center with radius r, NaN if missed
+        static double distance(Point const &center, double r, Ray const &ray);
+        // normal at the hit at distance t, facing the ray
+        static Vector normal(Point const &center, Ray const &ray, double t);
         virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
         Vector applyRotation(Vector v);
         Point const position;
         double const r;
@@ -0,0 +1,31 @@
+#include "spherecloud.h"
+
+#include "../clouddata.h"
+
+using namespace std;
+
+SphereCloud::SphereCloud(shared_ptr<CloudData const> const &data)
+:
+    d_data(data)
+{}
+
+Hit SphereCloud::intersect(Ray const &ray)
+{
+    return d_data->intersect(ray);
+}
+
+Hit SphereCloud::intersectPrimitive(Ray const &ray, uint64_t primitive)
+{
+    return d_data->intersectSphere(ray, primitive);
+}
+
+// particles are not textured
+vector<float> SphereCloud::UVcoord(Vector v)
+{
+    return {0, 0};
+}
+
+AABB SphereCloud::bounds() const
+{
+    return d_data->bounds();
+}
@@ -0,0 +1,25 @@
+#ifndef SPHERECLOUD_H_
+#define SPHERECLOUD_H_
+
+#include "../object.h"
+
+#include <memory>
+
+class CloudData;
+
+// Many spheres (particles) with the material of the cloud, intersected as
+// one object. A hit tells which sphere in Hit::primitive.
+class SphereCloud: public Object
+{
+    std::shared_ptr<CloudData const> d_data;
+
+    public:
+        explicit SphereCloud(std::shared_ptr<CloudData const> const &data);
+
+        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersectPrimitive(Ray const &ray, uint64_t primitive);
+        virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "translated.h"
+
+using namespace std;
+
+Translated::Translated(ObjectPtr const &object)
+:
+    d_object(object),
+    d_localBounds(object->bounds()),
+    d_bounds(d_localBounds)
+{
+    material = object->material;
+}
+
+void Translated::setOffset(Vector const &offset)
+{
+    d_offset = offset;
+    d_bounds = d_localBounds;
+    if (d_bounds.finite())
+        d_bounds = AABB(d_localBounds.lower + offset, d_localBounds.upper + offset);
+}
+
+Vector const &Translated::offset() const
+{
+    return d_offset;
+}
+
+Hit Translated::intersect(Ray const &ray)
+{
+    // distances, normals and footprints do not change under translation
+    Ray moved(ray);
+    moved.O = ray.O - d_offset;
+    return d_object->intersect(moved);
+}
+
+Hit Translated::intersectPrimitive(Ray const &ray, uint64_t primitive)
+{
+    Ray moved(ray);
+    moved.O = ray.O - d_offset;
+    return d_object->intersectPrimitive(moved, primitive);
+}
+
+vector<float> Translated::UVcoord(Vector v)
+{
+    return d_object->UVcoord(v - d_offset);
+}
+
+AABB Translated::bounds() const
+{
+    return d_bounds;
+}
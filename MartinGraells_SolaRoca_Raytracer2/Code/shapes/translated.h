@@ -0,0 +1,30 @@
+#ifndef TRANSLATED_H_
+#define TRANSLATED_H_
+
+#include "../object.h"
+
+// An object moved by an offset that can change between frames of an
+// animation. Rays are moved into the space of the wrapped object instead
+// of moving the object, so whatever the object built from its geometry
+// (the bounds of a mesh) stays valid; only the bounds of the wrapper are
+// refit when the offset changes.
+class Translated: public Object
+{
+    ObjectPtr d_object;
+    Vector d_offset;
+    AABB d_localBounds;     // of the wrapped object
+    AABB d_bounds;          // moved by d_offset
+
+    public:
+        explicit Translated(ObjectPtr const &object);
+
+        void setOffset(Vector const &offset);
+        Vector const &offset() const;
+
+        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersectPrimitive(Ray const &ray, uint64_t primitive);
+        virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
+};
+
+#endif
@@ -2,39 +2,62 @@
 
 #include <cfloat>   // DBL_EPSILON
 #include <cmath>
+#include <limits>
 
 Hit Triangle::intersect(Ray const &ray)
 {
+    double t = distance(v0, v1, v2, ray);
+    if (std::isnan(t))
+        return Hit::NO_HIT();
+
+    // determine orientation of the normal
+    Vector normal = N;
+    if (N.dot(ray.D) > 0)
+        normal = -normal;
+
+    return Hit(t, normal);
+}
+
+double Triangle::distance(Point const &v0, Point const &v1, Point const &v2,
+                          Ray const &ray)
+{
+    double const miss = std::numeric_limits<double>::quiet_NaN();
+
     // Möller-Trumbore
     Vector edge1(v1 - v0);
     Vector edge2(v2 - v0);
     Vector h = ray.D.cross(edge2);
     double a = edge1.dot(h);
     if (a > -DBL_EPSILON && a < DBL_EPSILON)
-        return Hit::NO_HIT();
+        return miss;
 
     double f = 1 / a;
     Vector s = ray.O - v0;
     double u = f * s.dot(h);
     if (u < 0.0 || u > 1.0)
-        return Hit::NO_HIT();
+        return miss;
 
     Vector q = s.cross(edge1);
     double v = f * ray.D.dot(q);
     if (v < 0.0 || u + v > 1.0)
-        return Hit::NO_HIT();
+        return miss;
 
     double t = f * edge2.dot(q);
 
     if (t <= DBL_EPSILON)    // line intersection (not ray)
-        return Hit::NO_HIT();
+        return miss;
+    return t;
+}
 
-    // determine orientation of the normal
-    Vector normal = N;
+Vector Triangle::normal(Point const &v0, Point const &v1, Point const &v2,
+                        Ray const &ray)
+{
+    // as computed by the constructor
+    Vector N = (v1 - v0).cross(v2 - v0);
+    N.normalize();
     if (N.dot(ray.D) > 0)
-        normal = -normal;
-
-    return Hit(t, normal);
+        N = -N;
+    return N;
 }
 
 std::vector<float> Triangle::UVcoord(Vector v){
@@ -57,3 +80,12 @@ Triangle::Triangle(Point const &v0,
     N = U.cross(V);
     N.normalize();
 }
+
+AABB Triangle::bounds() const
+{
+    AABB box;
+    box.extend(v0);
+    box.extend(v1);
+    box.extend(v2);
+    return box;
+}
@@ -11,7 +11,14 @@ class Triangle: public Object
                  Point const &v2);
 
         virtual Hit intersect(Ray const &ray);
+        // distance to the triangle v0 v1 v2, NaN if missed
+        static double distance(Point const &v0, Point const &v1,
+                               Point const &v2, Ray const &ray);
+        // unit normal of the triangle, facing the ray
+        static Vector normal(Point const &v0, Point const &v1,
+                             Point const &v2, Ray const &ray);
         virtual std::vector<float> UVcoord(Vector v);
+        virtual AABB bounds() const;
 
         Point v0;
         Point v1;
@@ -0,0 +1,159 @@
+#include "shard.h"
+
+#include "image.h"
+#include "tracelog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    char const shardMagic[8] = {'R', 'A', 'Y', 'S', 'H', 'R', 'D', '1'};
+
+    template <typename Value>
+    void writeValue(ostream &out, Value const &value)
+    {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(Value));
+    }
+
+    template <typename Value>
+    Value readValue(istream &in)
+    {
+        Value value = Value();
+        in.read(reinterpret_cast<char *>(&value), sizeof(Value));
+        return value;
+    }
+
+    struct Header
+    {
+        uint64_t hash;
+        unsigned width;
+        unsigned height;
+        unsigned index;
+        unsigned count;
+    };
+
+    Header readHeader(istream &in, string const &filename)
+    {
+        char magic[sizeof(shardMagic)];
+        in.read(magic, sizeof(magic));
+        if (!in || !equal(magic, magic + sizeof(magic), shardMagic))
+            throw runtime_error(filename + " is not a shard.");
+        Header header;
+        header.hash = readValue<uint64_t>(in);
+        header.width = readValue<unsigned>(in);
+        header.height = readValue<unsigned>(in);
+        header.index = readValue<unsigned>(in);
+        header.count = readValue<unsigned>(in);
+        if (!in || header.index >= header.count)
+            throw runtime_error(filename + " is damaged.");
+        return header;
+    }
+}
+
+unsigned const Shard::bandHeight;
+
+Shard::Shard(unsigned index, unsigned count)
+:
+    d_index(index),
+    d_count(count)
+{}
+
+unsigned Shard::index() const
+{
+    return d_index;
+}
+
+unsigned Shard::count() const
+{
+    return d_count;
+}
+
+vector<Region> Shard::regions(unsigned width, unsigned height) const
+{
+    vector<Region> bands;
+    for (unsigned y = d_index * bandHeight; y < height; y += d_count * bandHeight)
+        bands.push_back(Region(0, y, width, min(bandHeight, height - y)));
+    return bands;
+}
+
+bool Shard::save(string const &filename, Image const &img, uint64_t hash) const
+{
+    TraceScope scope("write shard", filename);
+
+    string tmpname = filename + ".tmp";
+    {
+        ofstream out(tmpname, ios::binary);
+        out.write(shardMagic, sizeof(shardMagic));
+        writeValue(out, hash);
+        for (unsigned value : {img.width(), img.height(), d_index, d_count})
+            writeValue(out, value);
+        for (Region const &band : regions(img.width(), img.height()))
+            for (unsigned y = band.y; y != band.y + band.height; ++y)
+                for (unsigned x = 0; x != band.width; ++x)
+                    writeValue(out, img(x, y));
+        if (!out.flush())
+        {
+            remove(tmpname.c_str());
+            return false;
+        }
+    }
+    return rename(tmpname.c_str(), filename.c_str()) == 0;
+}
+
+bool Shard::merge(vector<string> const &filenames, Image &img)
+try
+{
+    TraceScope scope("merge shards", "", filenames.size());
+    if (filenames.empty())
+        throw runtime_error("No shards to merge.");
+
+    Header first = Header();
+    vector<bool> seen;
+    for (string const &filename : filenames)
+    {
+        ifstream in(filename, ios::binary);
+        if (!in)
+            throw runtime_error("Could not open " + filename + " for reading.");
+        Header header = readHeader(in, filename);
+
+        if (seen.empty())
+        {
+            first = header;
+            seen.assign(header.count, false);
+            img = Image(header.width, header.height);
+        }
+        else if (header.hash != first.hash || header.width != first.width
+                 || header.height != first.height || header.count != first.count)
+            throw runtime_error(filename + " belongs to another render than "
+                                + filenames.front() + '.');
+        if (seen[header.index])
+            throw runtime_error("Shard " + to_string(header.index)
+                                + " is given twice.");
+        seen[header.index] = true;
+
+        Shard shard(header.index, header.count);
+        for (Region const &band : shard.regions(header.width, header.height))
+            for (unsigned y = band.y; y != band.y + band.height; ++y)
+                for (unsigned x = 0; x != band.width; ++x)
+                    img(x, y) = readValue<Color>(in);
+        if (!in)
+            throw runtime_error(filename + " is truncated.");
+    }
+
+    auto missing = find(seen.begin(), seen.end(), false);
+    if (missing != seen.end())
+        throw runtime_error("Shard " + to_string(missing - seen.begin())
+                            + " of " + to_string(first.count) + " is missing.");
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
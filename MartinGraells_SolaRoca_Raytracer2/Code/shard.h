@@ -0,0 +1,45 @@
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include "region.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Image;
+
+// Part of a frame rendered by one of several processes. The frame is cut
+// into bands of bandHeight rows that are dealt out round robin, so every
+// shard gets a similar mix of cheap and expensive rows. A shard file holds
+// the pixels of its bands as doubles; merging the files of all shards
+// gives exactly the frame a single process renders.
+class Shard
+{
+    unsigned d_index;
+    unsigned d_count;
+
+    public:
+        // same as TileCache::tileSize, so shards reuse cached tiles
+        static unsigned const bandHeight = 32;
+
+        Shard(unsigned index, unsigned count);
+
+        unsigned index() const;
+        unsigned count() const;
+
+        // bands of a width x height frame that belong to this shard
+        std::vector<Region> regions(unsigned width, unsigned height) const;
+
+        // writes the bands of this shard of the frame sized img, hash
+        // identifies the render (see Raytracer::contentHash)
+        bool save(std::string const &filename, Image const &img,
+                  uint64_t hash) const;
+
+        // assembles the shard files into img; all shards of one render
+        // must be given, in any order. Returns false on errors.
+        static bool merge(std::vector<std::string> const &filenames,
+                          Image &img);
+};
+
+#endif
@@ -0,0 +1,393 @@
+#include "simplifier.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+
+using namespace std;
+
+namespace
+{
+    // weight of the planes holding open boundaries, relative to the
+    // planes of the triangles
+    double const boundaryWeight = 10.0;
+
+    // symmetric 4 x 4 matrix, the sum of p p^T over planes p = (a, b, c, d)
+    // with unit normals: v^T Q v is the summed squared distance of v to
+    // the planes
+    struct Quadric
+    {
+        double m[10] = {};      // aa ab ac ad bb bc bd cc cd dd
+
+        void addPlane(Vector const &normal, double d, double weight)
+        {
+            double const p[4] = {normal.x, normal.y, normal.z, d};
+            unsigned idx = 0;
+            for (unsigned row = 0; row != 4; ++row)
+                for (unsigned col = row; col != 4; ++col)
+                    m[idx++] += weight * p[row] * p[col];
+        }
+
+        Quadric &operator+=(Quadric const &other)
+        {
+            for (unsigned idx = 0; idx != 10; ++idx)
+                m[idx] += other.m[idx];
+            return *this;
+        }
+
+        double error(Point const &v) const
+        {
+            return m[0] * v.x * v.x + 2 * m[1] * v.x * v.y + 2 * m[2] * v.x * v.z
+                   + 2 * m[3] * v.x + m[4] * v.y * v.y + 2 * m[5] * v.y * v.z
+                   + 2 * m[6] * v.y + m[7] * v.z * v.z + 2 * m[8] * v.z + m[9];
+        }
+
+        // the point of least error, false if there is no single one (the
+        // planes are all parallel to a line)
+        bool minimum(Point &v) const
+        {
+            double const a00 = m[0], a01 = m[1], a02 = m[2];
+            double const a11 = m[4], a12 = m[5], a22 = m[7];
+            double const c00 = a11 * a22 - a12 * a12;
+            double const c01 = a02 * a12 - a01 * a22;
+            double const c02 = a01 * a12 - a02 * a11;
+            double const det = a00 * c00 + a01 * c01 + a02 * c02;
+            double const trace = a00 + a11 + a22;
+            if (!(fabs(det) > 1e-6 * trace * trace * trace))
+                return false;
+            double const c11 = a00 * a22 - a02 * a02;
+            double const c12 = a01 * a02 - a00 * a12;
+            double const c22 = a00 * a11 - a01 * a01;
+            double const b0 = m[3], b1 = m[6], b2 = m[8];
+            v = Point(-(c00 * b0 + c01 * b1 + c02 * b2) / det,
+                      -(c01 * b0 + c11 * b1 + c12 * b2) / det,
+                      -(c02 * b0 + c12 * b1 + c22 * b2) / det);
+            return true;
+        }
+    };
+
+    struct Face
+    {
+        uint32_t v[3];
+        bool removed;
+
+        bool has(uint32_t vertex) const
+        {
+            return v[0] == vertex || v[1] == vertex || v[2] == vertex;
+        }
+    };
+
+    // collapsing edge (v[0], v[1]) into target; outdated once either
+    // vertex changed since (its stamp moved on)
+    struct Collapse
+    {
+        double cost;
+        uint32_t v[2];
+        uint32_t stamp[2];
+        Point target;
+
+        bool operator<(Collapse const &other) const
+        {
+            return cost > other.cost;   // cheapest on top
+        }
+    };
+
+    struct Corner
+    {
+        double coords[3];
+
+        bool operator==(Corner const &other) const
+        {
+            return coords[0] == other.coords[0] && coords[1] == other.coords[1]
+                   && coords[2] == other.coords[2];
+        }
+    };
+
+    struct CornerHash
+    {
+        size_t operator()(Corner const &corner) const
+        {
+            Hash hash;
+            return hash.add(corner.coords[0]).add(corner.coords[1])
+                       .add(corner.coords[2]).value();
+        }
+    };
+
+    class Collapser
+    {
+        vector<Point> d_position;
+        vector<Quadric> d_quadric;
+        vector<vector<uint32_t>> d_faces;   // per vertex, may hold removed ones
+        vector<uint32_t> d_stamp;
+        vector<bool> d_removed;
+        vector<Face> d_face;
+        size_t d_live = 0;                  // faces not removed
+        double d_worst = 0.0;               // largest cost collapsed
+        priority_queue<Collapse> d_queue;
+
+        public:
+            explicit Collapser(vector<MeshTriangle> const &triangles);
+
+            // collapses edges until at most target faces are left, false
+            // if it ran out of edges first
+            bool reduce(size_t target);
+            vector<MeshTriangle> triangles() const;
+            double error() const;
+
+        private:
+            Vector normal(Face const &face) const;
+            void addBoundaries();
+            void push(uint32_t a, uint32_t b);
+            // would moving vertex to target fold one of its faces (other
+            // than those shared with other, which disappear)?
+            bool folds(uint32_t vertex, uint32_t other, Point const &target) const;
+            void collapse(Collapse const &edge);
+    };
+
+    Collapser::Collapser(vector<MeshTriangle> const &triangles)
+    {
+        unordered_map<Corner, uint32_t, CornerHash> welded;
+        for (MeshTriangle const &triangle : triangles)
+        {
+            Face face = {{0, 0, 0}, false};
+            for (unsigned corner = 0; corner != 3; ++corner)
+            {
+                double const *v = triangle.vertex[corner];
+                Corner key = {{v[0], v[1], v[2]}};
+                auto found = welded.find(key);
+                if (found == welded.end())
+                {
+                    found = welded.emplace(key, d_position.size()).first;
+                    d_position.push_back(Point(v[0], v[1], v[2]));
+                }
+                face.v[corner] = found->second;
+            }
+            if (face.v[0] == face.v[1] || face.v[1] == face.v[2]
+                || face.v[0] == face.v[2])
+                continue;           // degenerate, nothing to keep
+            d_face.push_back(face);
+        }
+        d_live = d_face.size();
+
+        d_quadric.resize(d_position.size());
+        d_faces.resize(d_position.size());
+        d_stamp.resize(d_position.size(), 0);
+        d_removed.resize(d_position.size(), false);
+        for (uint32_t idx = 0; idx != d_face.size(); ++idx)
+        {
+            Face const &face = d_face[idx];
+            for (uint32_t vertex : face.v)
+                d_faces[vertex].push_back(idx);
+            Vector n = normal(face);
+            double length = n.length();
+            if (length == 0.0)
+                continue;           // no plane, but still collapsible
+            n = n / length;
+            double d = -n.dot(d_position[face.v[0]]);
+            for (uint32_t vertex : face.v)
+                d_quadric[vertex].addPlane(n, d, 1.0);
+        }
+        addBoundaries();
+
+        // every edge once
+        vector<pair<uint32_t, uint32_t>> edges;
+        edges.reserve(3 * d_face.size());
+        for (Face const &face : d_face)
+            for (unsigned corner = 0; corner != 3; ++corner)
+            {
+                uint32_t a = face.v[corner];
+                uint32_t b = face.v[(corner + 1) % 3];
+                edges.push_back(make_pair(min(a, b), max(a, b)));
+            }
+        sort(edges.begin(), edges.end());
+        edges.erase(unique(edges.begin(), edges.end()), edges.end());
+        for (auto const &edge : edges)
+            push(edge.first, edge.second);
+    }
+
+    Vector Collapser::normal(Face const &face) const
+    {
+        Point const &p0 = d_position[face.v[0]];
+        return (d_position[face.v[1]] - p0).cross(d_position[face.v[2]] - p0);
+    }
+
+    void Collapser::addBoundaries()
+    {
+        // an edge used by a single face is on an open boundary: a plane
+        // through it, upright on the face, keeps it from wandering off
+        for (Face const &face : d_face)
+        {
+            Vector n = normal(face);
+            for (unsigned corner = 0; corner != 3; ++corner)
+            {
+                uint32_t a = face.v[corner];
+                uint32_t b = face.v[(corner + 1) % 3];
+                unsigned uses = 0;
+                for (uint32_t other : d_faces[a])
+                    uses += d_face[other].has(b);
+                if (uses != 1)
+                    continue;
+                Vector across = n.cross(d_position[b] - d_position[a]);
+                double length = across.length();
+                if (length == 0.0)
+                    continue;
+                across = across / length;
+                double d = -across.dot(d_position[a]);
+                d_quadric[a].addPlane(across, d, boundaryWeight);
+                d_quadric[b].addPlane(across, d, boundaryWeight);
+            }
+        }
+    }
+
+    void Collapser::push(uint32_t a, uint32_t b)
+    {
+        Quadric sum = d_quadric[a];
+        sum += d_quadric[b];
+        Collapse edge = {0.0, {a, b}, {d_stamp[a], d_stamp[b]}, Point()};
+        if (!sum.minimum(edge.target))
+        {
+            // anywhere on a line will do: the best of the ends and middle
+            Point const candidates[3] = {d_position[a], d_position[b],
+                                         (d_position[a] + d_position[b]) / 2};
+            edge.target = candidates[0];
+            for (Point const &candidate : candidates)
+                if (sum.error(candidate) < sum.error(edge.target))
+                    edge.target = candidate;
+        }
+        edge.cost = max(0.0, sum.error(edge.target));
+        d_queue.push(edge);
+    }
+
+    bool Collapser::folds(uint32_t vertex, uint32_t other, Point const &target) const
+    {
+        for (uint32_t idx : d_faces[vertex])
+        {
+            Face const &face = d_face[idx];
+            if (face.removed || face.has(other))
+                continue;
+            Vector before = normal(face);
+            Point points[3];
+            for (unsigned corner = 0; corner != 3; ++corner)
+                points[corner] = face.v[corner] == vertex ? target
+                                                          : d_position[face.v[corner]];
+            Vector after = (points[1] - points[0]).cross(points[2] - points[0]);
+            // folded over, or nearly so
+            if (after.dot(before) <= 0.25 * after.length() * before.length())
+                return true;
+        }
+        return false;
+    }
+
+    void Collapser::collapse(Collapse const &edge)
+    {
+        uint32_t keep = edge.v[0];
+        uint32_t gone = edge.v[1];
+        d_position[keep] = edge.target;
+        d_quadric[keep] += d_quadric[gone];
+        d_removed[gone] = true;
+        ++d_stamp[keep];
+        ++d_stamp[gone];
+        d_worst = max(d_worst, edge.cost);
+
+        for (uint32_t idx : d_faces[gone])
+        {
+            Face &face = d_face[idx];
+            if (face.removed)
+                continue;
+            if (face.has(keep))
+            {
+                face.removed = true;
+                --d_live;
+                continue;
+            }
+            for (uint32_t &vertex : face.v)
+                if (vertex == gone)
+                    vertex = keep;
+            d_faces[keep].push_back(idx);
+        }
+        vector<uint32_t>().swap(d_faces[gone]);
+
+        // drop removed faces, and requeue the edges to the neighbours
+        vector<uint32_t> &faces = d_faces[keep];
+        faces.erase(remove_if(faces.begin(), faces.end(), [&](uint32_t idx)
+        {
+            return d_face[idx].removed;
+        }), faces.end());
+        vector<uint32_t> neighbours;
+        for (uint32_t idx : faces)
+            for (uint32_t vertex : d_face[idx].v)
+                if (vertex != keep)
+                    neighbours.push_back(vertex);
+        sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(unique(neighbours.begin(), neighbours.end()),
+                         neighbours.end());
+        for (uint32_t vertex : neighbours)
+            push(keep, vertex);
+    }
+
+    bool Collapser::reduce(size_t target)
+    {
+        while (d_live > target)
+        {
+            if (d_queue.empty())
+                return false;
+            Collapse edge = d_queue.top();
+            d_queue.pop();
+            uint32_t a = edge.v[0];
+            uint32_t b = edge.v[1];
+            if (d_removed[a] || d_removed[b] || d_stamp[a] != edge.stamp[0]
+                || d_stamp[b] != edge.stamp[1])
+                continue;           // outdated
+            if (folds(a, b, edge.target) || folds(b, a, edge.target))
+                continue;
+            collapse(edge);
+        }
+        return true;
+    }
+
+    vector<MeshTriangle> Collapser::triangles() const
+    {
+        vector<MeshTriangle> result;
+        result.reserve(d_live);
+        for (Face const &face : d_face)
+        {
+            if (face.removed)
+                continue;
+            MeshTriangle triangle = {};
+            for (unsigned corner = 0; corner != 3; ++corner)
+                for (unsigned axis = 0; axis != 3; ++axis)
+                    triangle.vertex[corner][axis] = d_position[face.v[corner]].data[axis];
+            triangle.index = result.size();
+            result.push_back(triangle);
+        }
+        return result;
+    }
+
+    double Collapser::error() const
+    {
+        return sqrt(d_worst);
+    }
+}
+
+vector<Simplifier::Level> Simplifier::levels(vector<MeshTriangle> const &triangles,
+                                             unsigned count, size_t minTriangles)
+{
+    vector<Level> result;
+    if (count == 0 || triangles.size() / 4 < minTriangles)
+        return result;
+
+    Collapser collapser(triangles);
+    size_t target = triangles.size();
+    while (result.size() != count)
+    {
+        target /= 4;
+        if (target < minTriangles || !collapser.reduce(target))
+            break;
+        result.push_back(Level{collapser.triangles(), collapser.error()});
+    }
+    return result;
+}
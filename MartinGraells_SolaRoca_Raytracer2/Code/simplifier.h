@@ -0,0 +1,34 @@
+#ifndef SIMPLIFIER_H_
+#define SIMPLIFIER_H_
+
+#include "meshdata.h"
+
+#include <cstddef>
+#include <vector>
+
+// Quadric error simplification (Garland and Heckbert) of a triangle soup,
+// for the levels of detail of a MeshData. Corners at the same position
+// are welded, then the edge whose collapse moves the surface least is
+// collapsed, again and again. The quadric of a vertex sums the squared
+// distances to the planes of the triangles it stands in for; edges of
+// open boundaries are held in place by planes across them, and collapses
+// that would fold a triangle over are skipped.
+class Simplifier
+{
+    public:
+        struct Level
+        {
+            std::vector<MeshTriangle> triangles;
+            // estimated distance to the original surface (the square root
+            // of the largest quadric error of a collapse), in its units
+            double error;
+        };
+
+        // up to count ever coarser levels, each with about a quarter of
+        // the triangles of the one before and none with fewer than
+        // minTriangles. Stops early once no edge can be collapsed.
+        static std::vector<Level> levels(std::vector<MeshTriangle> const &triangles,
+                                         unsigned count, size_t minTriangles);
+};
+
+#endif
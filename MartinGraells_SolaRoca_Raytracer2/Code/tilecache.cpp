@@ -0,0 +1,177 @@
+#include "tilecache.h"
+
+#include "hash.h"
+#include "image.h"
+#include "tracelog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    char const tileMagic[8] = {'R', 'A', 'Y', 'T', 'I', 'L', 'E', '1'};
+    string const tileExtension = ".tile";
+
+    template <typename Value>
+    void writeValue(ostream &out, Value const &value)
+    {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(Value));
+    }
+
+    template <typename Value>
+    Value readValue(istream &in)
+    {
+        Value value = Value();
+        in.read(reinterpret_cast<char *>(&value), sizeof(Value));
+        return value;
+    }
+}
+
+unsigned const TileCache::tileSize;
+
+TileCache::TileCache(string const &directory, uint64_t maxBytes)
+:
+    d_directory(directory),
+    d_maxBytes(maxBytes)
+{
+    if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST)
+        cerr << "Could not create the tile cache " << directory << '\n';
+}
+
+bool TileCache::load(uint64_t key, Image &tile)
+{
+    string name = filename(key);
+    ifstream in(name, ios::binary);
+    char magic[sizeof(tileMagic)];
+    in.read(magic, sizeof(magic));
+    if (!in || !equal(magic, magic + sizeof(magic), tileMagic)
+        || readValue<uint64_t>(in) != key
+        || readValue<unsigned>(in) != tile.width()
+        || readValue<unsigned>(in) != tile.height())
+    {
+        ++d_misses;
+        return false;
+    }
+
+    vector<Color> pixels(tile.size());
+    in.read(reinterpret_cast<char *>(pixels.data()),
+            pixels.size() * sizeof(Color));
+    if (!in)
+    {
+        ++d_misses;
+        return false;
+    }
+    for (unsigned y = 0; y != tile.height(); ++y)
+        for (unsigned x = 0; x != tile.width(); ++x)
+            tile(x, y) = pixels[y * tile.width() + x];
+
+    utimes(name.c_str(), nullptr);      // recently used
+    ++d_hits;
+    return true;
+}
+
+bool TileCache::store(uint64_t key, Image const &tile)
+{
+    string name = filename(key);
+    // processes sharing the cache (shards) may store the same tile at
+    // once: each writes its own file, and the last rename wins whole
+    string tmpname = name + ".tmp." + to_string(getpid());
+    {
+        ofstream out(tmpname, ios::binary);
+        out.write(tileMagic, sizeof(tileMagic));
+        writeValue(out, key);
+        writeValue(out, tile.width());
+        writeValue(out, tile.height());
+        for (unsigned y = 0; y != tile.height(); ++y)
+            for (unsigned x = 0; x != tile.width(); ++x)
+                writeValue(out, tile(x, y));
+        if (!out.flush())
+        {
+            remove(tmpname.c_str());
+            return false;
+        }
+    }
+    return rename(tmpname.c_str(), name.c_str()) == 0;
+}
+
+void TileCache::evict()
+{
+    TraceScope scope("evict tiles", d_directory);
+
+    struct Entry
+    {
+        string name;
+        double used;        // modification time, touched by load()
+        uint64_t size;
+    };
+    vector<Entry> entries;
+    uint64_t total = 0;
+
+    DIR *dir = opendir(d_directory.c_str());
+    if (!dir)
+        return;
+    while (dirent *entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if (name.size() <= tileExtension.size()
+            || name.compare(name.size() - tileExtension.size(),
+                            string::npos, tileExtension) != 0)
+            continue;
+        string path = d_directory + '/' + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            continue;
+        double used = info.st_mtim.tv_sec + 1e-9 * info.st_mtim.tv_nsec;
+        entries.push_back(Entry{path, used, static_cast<uint64_t>(info.st_size)});
+        total += info.st_size;
+    }
+    closedir(dir);
+
+    if (total <= d_maxBytes)
+        return;
+    sort(entries.begin(), entries.end(), [](Entry const &a, Entry const &b)
+    {
+        return a.used < b.used;
+    });
+    for (Entry const &entry : entries)
+    {
+        if (total <= d_maxBytes)
+            break;
+        if (remove(entry.name.c_str()) == 0)
+        {
+            total -= entry.size;
+            ++d_evicted;
+        }
+    }
+}
+
+unsigned long TileCache::hits() const
+{
+    return d_hits;
+}
+
+unsigned long TileCache::misses() const
+{
+    return d_misses;
+}
+
+unsigned long TileCache::evicted() const
+{
+    return d_evicted;
+}
+
+string TileCache::filename(uint64_t key) const
+{
+    return d_directory + '/' + Hash::hex(key) + tileExtension;
+}
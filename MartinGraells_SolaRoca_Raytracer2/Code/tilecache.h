@@ -0,0 +1,46 @@
+#ifndef TILECACHE_H_
+#define TILECACHE_H_
+
+#include <cstdint>
+#include <string>
+
+class Image;
+
+// On-disk cache of rendered tiles, addressed by a hash of everything that
+// determines their pixels (see Raytracer::contentHash) and the position of
+// the tile. Tiles are stored as doubles, so a cached tile is bit-identical
+// to a traced one. Once the directory grows beyond its size limit the
+// least recently used tiles are removed.
+class TileCache
+{
+    std::string d_directory;
+    uint64_t d_maxBytes;
+
+    unsigned long d_hits = 0;
+    unsigned long d_misses = 0;
+    unsigned long d_evicted = 0;
+
+    public:
+        static unsigned const tileSize = 32;    // pixels, square
+
+        // creates directory if it does not exist
+        TileCache(std::string const &directory, uint64_t maxBytes);
+
+        // tile (of tileSize x tileSize pixels, or less at the edges of the
+        // frame) for key, false on a miss
+        bool load(uint64_t key, Image &tile);
+        // returns false if the tile could not be written
+        bool store(uint64_t key, Image const &tile);
+
+        // removes the least recently used tiles until the cache fits
+        void evict();
+
+        unsigned long hits() const;
+        unsigned long misses() const;
+        unsigned long evicted() const;
+
+    private:
+        std::string filename(uint64_t key) const;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "tracelog.h"
+
+#include "json/json.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>     // getpid
+
+using namespace std;
+using namespace std::chrono;
+using json = nlohmann::json;
+
+namespace
+{
+    struct Event
+    {
+        char const *name;
+        double start;   // microseconds
+        double duration;
+        string detail;
+        long arg;
+    };
+
+    // Events are appended by the owning thread only. size and next are
+    // published with release stores, so write() may walk a buffer while
+    // its thread keeps appending.
+    struct Chunk
+    {
+        static unsigned const capacity = 1024;
+
+        Event events[capacity];
+        atomic<unsigned> size{0};
+        atomic<Chunk *> next{nullptr};
+    };
+
+    struct ThreadBuffer
+    {
+        unsigned tid;
+        string name;
+        Chunk *head;
+        Chunk *tail;
+
+        explicit ThreadBuffer(unsigned id)
+        :
+            tid(id),
+            head(new Chunk),
+            tail(head)
+        {}
+
+        ~ThreadBuffer()
+        {
+            while (head)
+            {
+                Chunk *next = head->next.load();
+                delete head;
+                head = next;
+            }
+        }
+
+        void append(Event &&event)
+        {
+            unsigned size = tail->size.load(memory_order_relaxed);
+            if (size == Chunk::capacity)
+            {
+                Chunk *chunk = new Chunk;
+                tail->next.store(chunk, memory_order_release);
+                tail = chunk;
+                size = 0;
+            }
+            tail->events[size] = move(event);
+            tail->size.store(size + 1, memory_order_release);
+        }
+    };
+
+    atomic<bool> traceEnabled{false};
+    string traceFile;
+    steady_clock::time_point epoch = steady_clock::now();
+
+    // registry of all thread buffers, only locked when a thread records
+    // its first event and while writing
+    mutex registryMutex;
+    vector<unique_ptr<ThreadBuffer>> registry;
+
+    ThreadBuffer &threadBuffer()
+    {
+        thread_local ThreadBuffer *buffer = nullptr;
+        if (!buffer)
+        {
+            lock_guard<mutex> lock(registryMutex);
+            registry.emplace_back(new ThreadBuffer(registry.size() + 1));
+            buffer = registry.back().get();
+        }
+        return *buffer;
+    }
+}
+
+void TraceLog::enable(string const &filename)
+{
+    traceFile = filename;
+    epoch = steady_clock::now();
+    traceEnabled = true;
+    setThreadName("main");
+}
+
+bool TraceLog::enabled()
+{
+    return traceEnabled.load(memory_order_relaxed);
+}
+
+void TraceLog::record(char const *name, double start, double end,
+                      string const &detail, long arg)
+{
+    if (!enabled())
+        return;
+    threadBuffer().append(Event{name, start, end - start, detail, arg});
+}
+
+void TraceLog::setThreadName(string const &name)
+{
+    if (!enabled())
+        return;
+    ThreadBuffer &buffer = threadBuffer();
+    lock_guard<mutex> lock(registryMutex);
+    buffer.name = name;
+}
+
+double TraceLog::now()
+{
+    return duration<double, micro>(steady_clock::now() - epoch).count();
+}
+
+bool TraceLog::write()
+{
+    if (!enabled())
+        return true;
+
+    ofstream out(traceFile);
+    if (!out)
+        return false;
+
+    int pid = getpid();
+    bool first = true;
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    lock_guard<mutex> lock(registryMutex);
+    for (auto const &buffer : registry)
+    {
+        if (!buffer->name.empty())
+        {
+            out << (first ? "" : ",\n")
+                << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << pid
+                << ", \"tid\": " << buffer->tid << ", \"args\": {\"name\": "
+                << json(buffer->name).dump() << "}}";
+            first = false;
+        }
+
+        for (Chunk *chunk = buffer->head; chunk;
+             chunk = chunk->next.load(memory_order_acquire))
+        {
+            unsigned size = chunk->size.load(memory_order_acquire);
+            for (unsigned idx = 0; idx != size; ++idx)
+            {
+                Event const &event = chunk->events[idx];
+                out << (first ? "" : ",\n")
+                    << "{\"ph\": \"X\", \"name\": " << json(event.name).dump()
+                    << ", \"pid\": " << pid << ", \"tid\": " << buffer->tid
+                    << ", \"ts\": " << event.start
+                    << ", \"dur\": " << event.duration << ", \"args\": {";
+                if (!event.detail.empty())
+                    out << "\"detail\": " << json(event.detail).dump()
+                        << (event.arg >= 0 ? ", " : "");
+                if (event.arg >= 0)
+                    out << "\"index\": " << event.arg;
+                out << "}}";
+                first = false;
+            }
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+// --- TraceScope --------------------------------------------------------------
+
+TraceScope::TraceScope(char const *name, string const &detail, long arg)
+:
+    d_name(name),
+    d_detail(TraceLog::enabled() ? detail : string()),
+    d_arg(arg),
+    d_start(TraceLog::enabled() ? TraceLog::now() : 0.0)
+{}
+
+TraceScope::TraceScope(char const *name, long arg)
+:
+    TraceScope(name, "", arg)
+{}
+
+TraceScope::~TraceScope()
+{
+    if (TraceLog::enabled())
+        TraceLog::record(d_name, d_start, TraceLog::now(), d_detail, d_arg);
+}
@@ -0,0 +1,52 @@
+#ifndef TRACELOG_H_
+#define TRACELOG_H_
+
+#include <string>
+
+// Timeline of render phases in the chrome://tracing / Perfetto trace-event
+// format. Every thread appends to its own buffer without locking; the
+// buffers are only walked by write().
+//
+// Usage: TraceLog::enable("trace.json");
+//        { TraceScope scope("render row", y); ... }
+//        TraceLog::write();
+class TraceLog
+{
+    public:
+        static void enable(std::string const &filename);
+        static bool enabled();
+
+        // records a complete event ("ph": "X") on the calling thread
+        static void record(char const *name, double start, double end,
+                           std::string const &detail, long arg);
+
+        // names the calling thread in the viewer
+        static void setThreadName(std::string const &name);
+
+        // microseconds since the trace was enabled
+        static double now();
+
+        // writes all events recorded so far, returns false on IO errors
+        static bool write();
+};
+
+// Records the lifetime of the scope as one event. The name must be a
+// string literal (or otherwise outlive the trace).
+class TraceScope
+{
+    char const *d_name;
+    std::string d_detail;
+    long d_arg;
+    double d_start;
+
+    public:
+        explicit TraceScope(char const *name, std::string const &detail = "",
+                            long arg = -1);
+        TraceScope(char const *name, long arg);
+        ~TraceScope();
+
+        TraceScope(TraceScope const &) = delete;
+        TraceScope &operator=(TraceScope const &) = delete;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "watcher.h"
+
+#include "binaryscene.h"
+#include "resourcecache.h"
+#include "tracelog.h"
+
+#include "json/json.h"
+
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <thread>
+
+#include <sys/stat.h>
+
+using namespace std;
+using json = nlohmann::json;
+using namespace std::chrono;
+
+namespace
+{
+    volatile sig_atomic_t interrupted = 0;
+
+    void interrupt(int)
+    {
+        interrupted = 1;
+    }
+
+    // scene settings that do not change the image
+    bool ignored(string const &key)
+    {
+        return key == "Objects" || key == "CostMap" || key == "CostBreakdown"
+               || key == "Progressive" || key == "Crop" || key == "CropFullFrame";
+    }
+
+    // why an edit needs a full render, empty if only objects changed
+    string fullRenderReason(json const &before, json const &after)
+    {
+        for (json const *scene : {&before, &after})
+            for (auto it = scene->begin(); it != scene->end(); ++it)
+            {
+                if (ignored(it.key()))
+                    continue;
+                auto old = before.find(it.key());
+                auto now = after.find(it.key());
+                if (old == before.end() || now == after.end() || *old != *now)
+                    return it.key() + " changed";
+            }
+        return "";
+    }
+
+    // an edit of only the material (or comment) casts the same shadows
+    bool sameGeometry(json before, json after)
+    {
+        for (char const *key : {"material", "comment"})
+        {
+            before.erase(key);
+            after.erase(key);
+        }
+        return before == after;
+    }
+
+    json const &objectsOf(json const &scene)
+    {
+        static json const none = json::array();
+        auto objects = scene.find("Objects");
+        return objects == scene.end() ? none : *objects;
+    }
+
+    double millisecondsSince(steady_clock::time_point start)
+    {
+        return duration<double, milli>(steady_clock::now() - start).count();
+    }
+}
+
+Watcher::Watcher(string const &ifname, string const &ofname,
+                 string const &format, function<void(Raytracer &)> const &configure)
+:
+    d_ifname(ifname),
+    d_ofname(ofname),
+    d_format(format),
+    d_configure(configure),
+    d_cache(make_shared<ResourceCache>())
+{}
+
+Watcher::~Watcher() = default;
+
+bool Watcher::run(double pollInterval)
+{
+    changed();      // current version
+    unique_ptr<Raytracer> raytracer = load();
+    if (!raytracer || !renderAll(move(raytracer)))
+        return false;
+
+    interrupted = 0;
+    auto previous = signal(SIGINT, interrupt);
+    cout << "Watching " << d_ifname << " for changes, Ctrl-C to stop.\n";
+
+    while (!interrupted)
+    {
+        this_thread::sleep_for(duration<double>(pollInterval));
+        if (!changed())
+            continue;
+
+        // a half written file fails to parse, the next write is picked up
+        raytracer = load();
+        if (raytracer)
+            update(move(raytracer));
+    }
+
+    signal(SIGINT, previous);
+    cout << "\nStopped watching.\n";
+    return true;
+}
+
+bool Watcher::changed()
+{
+    struct stat info;
+    if (stat(d_ifname.c_str(), &info) != 0)
+        return false;       // being replaced
+    bool same = info.st_size == d_size
+                && info.st_mtim.tv_sec == d_mtime.tv_sec
+                && info.st_mtim.tv_nsec == d_mtime.tv_nsec;
+    d_mtime = info.st_mtim;
+    d_size = info.st_size;
+    return !same;
+}
+
+unique_ptr<Raytracer> Watcher::load()
+{
+    if (BinaryScene::isBinary(d_ifname))
+    {
+        cerr << "Error: binary scenes cannot be watched, watch the JSON scene.\n";
+        return nullptr;
+    }
+    unique_ptr<Raytracer> raytracer(new Raytracer(d_cache));
+    // the objects are compared between versions, never stream
+    raytracer->setStreamThreshold(numeric_limits<uint64_t>::max());
+    if (!raytracer->readScene(d_ifname))
+    {
+        cerr << "Error: reading scene from " << d_ifname << " failed.\n";
+        return nullptr;
+    }
+    d_configure(*raytracer);
+    return raytracer;
+}
+
+bool Watcher::renderAll(unique_ptr<Raytracer> raytracer)
+{
+    auto start = steady_clock::now();
+    Scene &scene = raytracer->getScene();
+    d_img = Image(scene.getWidth(), scene.getHeight());
+    {
+        TraceScope scope("render", d_ofname);
+        scene.render(d_img, Region(0, 0, d_img.width(), d_img.height()),
+                     nullptr, &d_footprints);
+    }
+    d_raytracer = move(raytracer);
+    bool written = write();
+    cout << "Rendered " << d_img.width() << 'x' << d_img.height() << " in "
+         << millisecondsSince(start) << " ms.\n";
+    return written;
+}
+
+void Watcher::update(unique_ptr<Raytracer> raytracer)
+{
+    auto start = steady_clock::now();
+    json const &before = *d_raytracer->getSceneJson();
+    json const &after = *raytracer->getSceneJson();
+    Scene &oldScene = d_raytracer->getScene();
+    Scene &newScene = raytracer->getScene();
+
+    // objects are matched by index, which only works if all were parsed
+    json const &oldObjects = objectsOf(before);
+    json const &newObjects = objectsOf(after);
+    string reason = fullRenderReason(before, after);
+    if (reason.empty() && (oldScene.getNumObject() != oldObjects.size()
+                           || newScene.getNumObject() != newObjects.size()))
+        reason = "some objects could not be parsed";
+    if (!reason.empty())
+    {
+        cout << "Scene changed (" << reason << "), rendering all pixels.\n";
+        renderAll(move(raytracer));
+        return;
+    }
+
+    // Objects are matched by index from the front and from the back, so
+    // inserting or removing one object does not shift all the others.
+    size_t oldCount = oldObjects.size();
+    size_t newCount = newObjects.size();
+    size_t front = 0;
+    while (front < min(oldCount, newCount)
+           && oldObjects[front] == newObjects[front])
+        ++front;
+    size_t back = 0;
+    while (back < min(oldCount, newCount) - front
+           && oldObjects[oldCount - 1 - back] == newObjects[newCount - 1 - back])
+        ++back;
+
+    vector<AABB> boxes;         // old and new bounds of the changed objects
+    for (size_t idx = front; idx != oldCount - back; ++idx)
+        boxes.push_back(oldScene.getObjectBounds(idx));
+    for (size_t idx = front; idx != newCount - back; ++idx)
+        boxes.push_back(newScene.getObjectBounds(idx));
+    size_t changedObjects = max(oldCount, newCount) - front - back;
+
+    // only edits of materials keep the shadows, which needs pairs
+    bool geometry = oldCount != newCount;
+    for (size_t idx = front; !geometry && idx != oldCount - back; ++idx)
+        geometry = !sameGeometry(oldObjects[idx], newObjects[idx]);
+
+    if (boxes.empty())
+    {
+        cout << "Scene file touched, nothing to update.\n";
+        d_raytracer = move(raytracer);
+        return;
+    }
+
+    vector<unsigned> pixels = newScene.affectedPixels(boxes, geometry,
+                                                      d_footprints);
+    newScene.render(d_img, pixels, d_footprints);
+    d_raytracer = move(raytracer);
+    double traced = millisecondsSince(start);
+    write();
+    cout << "Updated " << changedObjects << " object(s): traced " << pixels.size() << " of "
+         << d_footprints.size() << " pixels in " << traced << " ms ("
+         << millisecondsSince(start) << " ms with writing).\n";
+}
+
+bool Watcher::write()
+{
+    if (d_img.write(d_ofname, d_format))
+        return true;
+    cerr << "Error: could not write " << d_ofname << '\n';
+    return false;
+}
@@ -0,0 +1,57 @@
+#ifndef WATCHER_H_
+#define WATCHER_H_
+
+#include "image.h"
+#include "raytracer.h"
+
+#include "json/json_fwd.h"
+
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ResourceCache;
+
+// Watch mode: renders a scene file and re-renders it whenever the file
+// changes, until interrupted. When an edit only touches objects, only the
+// pixels Scene::affectedPixels reports for the old and new bounds of the
+// changed objects are traced again; any other edit (lights, camera,
+// settings) renders the whole frame.
+//
+// Only the scene file itself is watched, not the models and textures it
+// uses.
+class Watcher
+{
+    std::string d_ifname;
+    std::string d_ofname;
+    std::string d_format;
+    std::function<void(Raytracer &)> d_configure;   // command line overrides
+    std::shared_ptr<ResourceCache> d_cache;
+
+    std::unique_ptr<Raytracer> d_raytracer;     // of the image on disk
+    Image d_img;
+    std::vector<Footprint> d_footprints;
+    timespec d_mtime;
+    off_t d_size = -1;
+
+    public:
+        Watcher(std::string const &ifname, std::string const &ofname,
+                std::string const &format,
+                std::function<void(Raytracer &)> const &configure);
+        ~Watcher();
+
+        // returns false if the first version of the scene cannot be
+        // rendered, true when interrupted (Ctrl-C)
+        bool run(double pollInterval = 0.1);
+
+    private:
+        bool changed();         // stat()s the scene file
+        std::unique_ptr<Raytracer> load();
+        bool renderAll(std::unique_ptr<Raytracer> raytracer);
+        void update(std::unique_ptr<Raytracer> raytracer);
+        bool write();
+};
+
+#endif
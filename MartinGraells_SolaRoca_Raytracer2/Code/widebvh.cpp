@@ -0,0 +1,313 @@
+#include "widebvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+unsigned const WideBVH::width;
+unsigned const WideBVH::maxDepth;
+
+namespace
+{
+    unsigned const maxCount = 255;      // primitives of a leaf child
+
+    // 2^exponent, without a call to ldexp
+    double power2(int exponent)
+    {
+        uint64_t bits = uint64_t(1023 + exponent) << 52;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // a bound decoded as traversal does it
+    double decode(float origin, unsigned q, double scale)
+    {
+        return origin + q * scale;
+    }
+
+    double halfArea(BVHNode const &node)
+    {
+        double x = node.upper[0] - node.lower[0];
+        double y = node.upper[1] - node.lower[1];
+        double z = node.upper[2] - node.lower[2];
+        return x * y + y * z + z * x;
+    }
+
+    struct Collapser
+    {
+        vector<BVHNode> const &binary;
+        vector<WideNode> &nodes;
+
+        // wide node over the children of an inner binary node
+        uint32_t inner(uint32_t binaryIdx);
+        // wide node over a binary leaf with too many primitives for one
+        // child: all children have its box
+        uint32_t chunks(BVHNode const &leaf);
+
+        // stores the frame of node and the quantized boxes
+        void quantize(WideNode &node, BVHNode const *const *boxes);
+    };
+
+    uint32_t Collapser::inner(uint32_t binaryIdx)
+    {
+        // open the largest inner child until there are width children
+        vector<uint32_t> children{binaryIdx + 1, binary[binaryIdx].first};
+        while (children.size() < WideBVH::width)
+        {
+            size_t largest = children.size();
+            for (size_t idx = 0; idx != children.size(); ++idx)
+                if (binary[children[idx]].count == 0
+                    && (largest == children.size()
+                        || halfArea(binary[children[idx]])
+                           > halfArea(binary[children[largest]])))
+                    largest = idx;
+            if (largest == children.size())
+                break;          // all leaves
+            uint32_t opened = children[largest];
+            children[largest] = opened + 1;
+            children.insert(children.begin() + largest + 1, binary[opened].first);
+        }
+
+        uint32_t nodeIdx = nodes.size();
+        nodes.push_back(WideNode());
+        WideNode node = {};
+        BVHNode const *boxes[WideBVH::width];
+        node.numChildren = children.size();
+        for (unsigned child = 0; child != children.size(); ++child)
+        {
+            BVHNode const &binaryChild = binary[children[child]];
+            boxes[child] = &binaryChild;
+            if (binaryChild.count == 0)
+                node.child[child] = inner(children[child]);
+            else if (binaryChild.count > maxCount)
+                node.child[child] = chunks(binaryChild);
+            else
+            {
+                node.leafMask |= 1 << child;
+                node.child[child] = binaryChild.first;
+                node.count[child] = binaryChild.count;
+            }
+        }
+        quantize(node, boxes);
+        nodes[nodeIdx] = node;
+        return nodeIdx;
+    }
+
+    uint32_t Collapser::chunks(BVHNode const &leaf)
+    {
+        uint32_t nodeIdx = nodes.size();
+        nodes.push_back(WideNode());
+        WideNode node = {};
+        BVHNode const *boxes[WideBVH::width];
+        uint32_t part = (leaf.count + WideBVH::width - 1) / WideBVH::width;
+        for (uint32_t first = leaf.first; first != leaf.first + leaf.count; )
+        {
+            unsigned child = node.numChildren++;
+            BVHNode chunk = leaf;
+            chunk.first = first;
+            chunk.count = min(part, leaf.first + leaf.count - first);
+            first += chunk.count;
+            boxes[child] = &leaf;
+            if (chunk.count > maxCount)
+                node.child[child] = chunks(chunk);
+            else
+            {
+                node.leafMask |= 1 << child;
+                node.child[child] = chunk.first;
+                node.count[child] = chunk.count;
+            }
+        }
+        quantize(node, boxes);
+        nodes[nodeIdx] = node;
+        return nodeIdx;
+    }
+
+    void Collapser::quantize(WideNode &node, BVHNode const *const *boxes)
+    {
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            double lower = boxes[0]->lower[axis];
+            double upper = boxes[0]->upper[axis];
+            for (unsigned child = 1; child != node.numChildren; ++child)
+            {
+                lower = min(lower, boxes[child]->lower[axis]);
+                upper = max(upper, boxes[child]->upper[axis]);
+            }
+
+            float origin = lower;
+            if (origin > lower)
+                origin = nextafter(origin, -INFINITY);
+            // the smallest step that reaches upper in maxCount steps
+            int exponent;
+            frexp((upper - origin) / maxCount, &exponent);
+            exponent = max(exponent - 1, -128);
+            while (exponent < 127
+                   && decode(origin, maxCount, power2(exponent)) < upper)
+                ++exponent;
+            double scale = power2(exponent);
+            node.origin[axis] = origin;
+            node.exponent[axis] = exponent;
+
+            for (unsigned child = 0; child != node.numChildren; ++child)
+            {
+                double childLower = boxes[child]->lower[axis];
+                double childUpper = boxes[child]->upper[axis];
+                double low = floor((childLower - origin) / scale);
+                double high = ceil((childUpper - origin) / scale);
+                unsigned qLower = fmin(fmax(low, 0.0), maxCount);
+                unsigned qUpper = fmin(fmax(high, 0.0), maxCount);
+                // rounding in the division could still cut off the box
+                while (qLower != 0 && decode(origin, qLower, scale) > childLower)
+                    --qLower;
+                while (qUpper != maxCount && decode(origin, qUpper, scale) < childUpper)
+                    ++qUpper;
+                node.lower[axis][child] = qLower;
+                node.upper[axis][child] = qUpper;
+            }
+        }
+    }
+}
+
+WideBVH::SlabRay::SlabRay(Ray const &ray)
+{
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        origin[axis] = ray.O.data[axis];
+        parallel[axis] = ray.D.data[axis] == 0.0;
+        invDir[axis] = parallel[axis] ? 0.0 : 1 / ray.D.data[axis];
+    }
+}
+
+void WideBVH::collapse(vector<BVHNode> const &binary, vector<WideNode> &nodes)
+{
+    nodes.clear();
+    if (binary.empty())
+        return;
+    nodes.reserve(binary.size() / 5 + 1);
+
+    Collapser collapser{binary, nodes};
+    BVHNode const &root = binary[0];
+    if (root.count == 0)
+        collapser.inner(0);
+    else if (root.count > maxCount)
+        collapser.chunks(root);
+    else
+    {
+        // a single leaf
+        WideNode node = {};
+        BVHNode const *boxes[width] = {&root};
+        node.numChildren = 1;
+        node.leafMask = 1;
+        node.child[0] = root.first;
+        node.count[0] = root.count;
+        collapser.quantize(node, boxes);
+        nodes.push_back(node);
+    }
+}
+
+bool WideBVH::valid(WideNode const *nodes, uint64_t numNodes, uint64_t numPrims)
+{
+    // children follow their parent, so one pass finds the depth of every
+    // node
+    vector<unsigned char> depth(numNodes, 0);
+    for (uint64_t idx = 0; idx != numNodes; ++idx)
+    {
+        WideNode const &node = nodes[idx];
+        if (node.numChildren == 0 || node.numChildren > width)
+            return false;
+        for (unsigned child = 0; child != node.numChildren; ++child)
+        {
+            if (node.leafMask & 1 << child)
+            {
+                if (node.child[child] + uint64_t(node.count[child]) > numPrims)
+                    return false;
+                continue;
+            }
+            uint32_t next = node.child[child];
+            if (next <= idx || next >= numNodes || depth[idx] + 1u >= maxDepth)
+                return false;
+            depth[next] = max<unsigned>(depth[next], depth[idx] + 1);
+        }
+    }
+    return true;
+}
+
+unsigned WideBVH::enters(WideNode const &node, SlabRay const &ray, double tMax,
+                         double tNear[width])
+{
+#ifdef __SSE2__
+    // two children per register
+    __m128d tmin[2] = {_mm_setzero_pd(), _mm_setzero_pd()};
+    __m128d tmax[2] = {_mm_set1_pd(tMax), _mm_set1_pd(tMax)};
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        __m128d origin = _mm_set1_pd(node.origin[axis]);
+        __m128d scale = _mm_set1_pd(power2(node.exponent[axis]));
+        __m128d rayOrigin = _mm_set1_pd(ray.origin[axis]);
+        __m128d invDir = _mm_set1_pd(ray.invDir[axis]);
+        uint8_t const *lower = node.lower[axis];
+        uint8_t const *upper = node.upper[axis];
+        for (unsigned pair = 0; pair != 2; ++pair)
+        {
+            __m128d low = _mm_add_pd(origin, _mm_mul_pd(_mm_set_pd(lower[2 * pair + 1],
+                                                                   lower[2 * pair]), scale));
+            __m128d high = _mm_add_pd(origin, _mm_mul_pd(_mm_set_pd(upper[2 * pair + 1],
+                                                                    upper[2 * pair]), scale));
+            if (ray.parallel[axis])
+            {
+                __m128d outside = _mm_or_pd(_mm_cmplt_pd(rayOrigin, low),
+                                            _mm_cmpgt_pd(rayOrigin, high));
+                tmax[pair] = _mm_or_pd(_mm_andnot_pd(outside, tmax[pair]),
+                                       _mm_and_pd(outside, _mm_set1_pd(-1.0)));
+                continue;
+            }
+            __m128d t1 = _mm_mul_pd(_mm_sub_pd(low, rayOrigin), invDir);
+            __m128d t2 = _mm_mul_pd(_mm_sub_pd(high, rayOrigin), invDir);
+            tmin[pair] = _mm_max_pd(tmin[pair], _mm_min_pd(t1, t2));
+            tmax[pair] = _mm_min_pd(tmax[pair], _mm_max_pd(t1, t2));
+        }
+    }
+    unsigned mask = _mm_movemask_pd(_mm_cmple_pd(tmin[0], tmax[0]))
+                    | _mm_movemask_pd(_mm_cmple_pd(tmin[1], tmax[1])) << 2;
+    _mm_storeu_pd(tNear, tmin[0]);
+    _mm_storeu_pd(tNear + 2, tmin[1]);
+#else
+    double tFar[width];
+    for (unsigned child = 0; child != width; ++child)
+    {
+        tNear[child] = 0.0;
+        tFar[child] = tMax;
+    }
+    for (unsigned axis = 0; axis != 3; ++axis)
+    {
+        double scale = power2(node.exponent[axis]);
+        for (unsigned child = 0; child != width; ++child)
+        {
+            double low = decode(node.origin[axis], node.lower[axis][child], scale);
+            double high = decode(node.origin[axis], node.upper[axis][child], scale);
+            if (ray.parallel[axis])
+            {
+                if (ray.origin[axis] < low || ray.origin[axis] > high)
+                    tFar[child] = -1.0;
+                continue;
+            }
+            double t1 = (low - ray.origin[axis]) * ray.invDir[axis];
+            double t2 = (high - ray.origin[axis]) * ray.invDir[axis];
+            tNear[child] = max(tNear[child], min(t1, t2));
+            tFar[child] = min(tFar[child], max(t1, t2));
+        }
+    }
+    unsigned mask = 0;
+    for (unsigned child = 0; child != width; ++child)
+        if (tNear[child] <= tFar[child])
+            mask |= 1 << child;
+#endif
+    return mask & ((1 << node.numChildren) - 1);
+}
@@ -0,0 +1,144 @@
+#ifndef WIDEBVH_H_
+#define WIDEBVH_H_
+
+#include "bvh.h"
+#include "ray.h"
+
+#include <cstdint>
+#include <vector>
+
+// Node of a 4-wide BVH, one cache line. The boxes of the children are
+// 8-bit offsets in a frame of the node: along each axis a bound is
+// origin + q * 2^exponent, rounded outward so it contains the real box.
+struct WideNode
+{
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t leafMask;       // bit c set: child c is a leaf
+    uint8_t lower[3][4];    // [axis][child]
+    uint8_t upper[3][4];
+    uint32_t child[4];      // inner child: node index, leaf: first primitive
+    uint8_t count[4];       // primitives of a leaf child
+    uint8_t numChildren;
+    uint8_t unused[3];
+};
+
+static_assert(sizeof(WideNode) == 64, "a WideNode fills one cache line");
+
+// BVH with four children per node, collapsed from the binary BVH that
+// BVH::build() makes. Nodes are stored depth first (a node, then the
+// subtrees of its children in order) and take about a fifth of the
+// memory of the binary nodes; one node is read per four box tests.
+class WideBVH
+{
+    public:
+        static unsigned const width = 4;
+        // binary depth, plus the levels over leaves of more than 255
+        // primitives
+        static unsigned const maxDepth = BVH::maxDepth + 16;
+
+        // a ray prepared for the box tests
+        struct SlabRay
+        {
+            double origin[3];
+            double invDir[3];
+            bool parallel[3];   // direction is 0 along the axis
+
+            explicit SlabRay(Ray const &ray);
+        };
+
+        static void collapse(std::vector<BVHNode> const &binary,
+                             std::vector<WideNode> &nodes);
+
+        // do the nodes (e.g. read from a file) only refer to primitives
+        // below numPrims and stay within maxDepth?
+        static bool valid(WideNode const *nodes, uint64_t numNodes,
+                          uint64_t numPrims);
+
+        // calls test(idx) for the primitives of all leaves the ray enters
+        // before distance tMax, which test may lower. Nearer children are
+        // visited first.
+        template <typename Test>
+        static void traverse(WideNode const *nodes, uint64_t numNodes,
+                             Ray const &ray, double &tMax, Test const &test);
+        // as traverse(), but calls test(first, count) once per leaf, so
+        // the primitives of a leaf can be tested together
+        template <typename Test>
+        static void traverseLeaves(WideNode const *nodes, uint64_t numNodes,
+                                   Ray const &ray, double &tMax,
+                                   Test const &test);
+
+        // bit c set if the ray enters child c before tMax, at distance
+        // tNear[c]
+        static unsigned enters(WideNode const &node, SlabRay const &ray,
+                               double tMax, double tNear[width]);
+};
+
+template <typename Test>
+void WideBVH::traverse(WideNode const *nodes, uint64_t numNodes,
+                       Ray const &ray, double &tMax, Test const &test)
+{
+    traverseLeaves(nodes, numNodes, ray, tMax, [&](uint32_t first, uint32_t count)
+    {
+        for (uint32_t prim = first; prim != first + count; ++prim)
+            test(prim);
+    });
+}
+
+template <typename Test>
+void WideBVH::traverseLeaves(WideNode const *nodes, uint64_t numNodes,
+                             Ray const &ray, double &tMax, Test const &test)
+{
+    if (numNodes == 0)
+        return;
+
+    struct Entry
+    {
+        uint32_t node;
+        double tNear;
+    };
+    // every level adds at most width - 1 entries
+    Entry stack[(width - 1) * maxDepth + 1];
+    unsigned size = 0;
+    stack[size++] = Entry{0, 0.0};
+
+    SlabRay slab(ray);
+    while (size != 0)
+    {
+        Entry entry = stack[--size];
+        if (entry.tNear > tMax)
+            continue;           // a nearer hit was found meanwhile
+        WideNode const &node = nodes[entry.node];
+        double tNear[width];
+        unsigned mask = enters(node, slab, tMax, tNear);
+
+        // the children that were entered, nearest first
+        unsigned order[width];
+        unsigned num = 0;
+        for (unsigned child = 0; child != node.numChildren; ++child)
+        {
+            if ((mask & 1 << child) == 0)
+                continue;
+            unsigned pos = num++;
+            for (; pos != 0 && tNear[order[pos - 1]] > tNear[child]; --pos)
+                order[pos] = order[pos - 1];
+            order[pos] = child;
+        }
+
+        // leaves are tested right away, inner nodes pushed farthest first
+        for (unsigned idx = 0; idx != num; ++idx)
+        {
+            unsigned child = order[idx];
+            if (node.leafMask & 1 << child)
+                test(node.child[child], node.count[child]);
+        }
+        for (unsigned idx = num; idx-- != 0; )
+        {
+            unsigned child = order[idx];
+            if ((node.leafMask & 1 << child) == 0)
+                stack[size++] = Entry{node.child[child], tNear[child]};
+        }
+    }
+}
+
+#endif